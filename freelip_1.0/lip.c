@@ -36,9 +36,16 @@ Permission is granted for free re-distribution for non-commercial uses only.
 #include <stddef.h>
 #include <math.h>
 #include <stdio.h>
+#include <string.h>
 #include <malloc.h>
 #include <sys/time.h>
 #include <sys/resource.h>
+#ifdef ZCOUNT
+#include <time.h>
+#endif
+#ifdef THREADS
+#include <pthread.h>
+#endif
 #include "lip.h"
 
 
@@ -54,19 +61,172 @@ Permission is granted for free re-distribution for non-commercial uses only.
 # define KAR_SQU_CROV   30
 #endif
 
+#ifndef TOOM3_MUL_CROV
+# define TOOM3_MUL_CROV 400
+#endif
+
+#ifndef TOOM3_SQU_CROV
+# define TOOM3_SQU_CROV 400
+#endif
+
+#ifndef TOOM4_MUL_CROV
+# define TOOM4_MUL_CROV 1000
+#endif
+
+#ifndef TOOM4_SQU_CROV
+# define TOOM4_SQU_CROV 1000
+#endif
+
+#ifndef NTT_MUL_CROV
+# define NTT_MUL_CROV   3000
+#endif
+
+#ifndef NTT_SQU_CROV
+# define NTT_SQU_CROV   3000
+#endif
+
+#ifdef ALPHA_OR_ALPHA50
+#define NTT_HBITS	(NBITS >> 1)
+#define NTT_HMASK	((1L << NTT_HBITS) - 1)
+#define NTT_MAXLOG	25
+#define NTT_MAXLEN	(1L << (NTT_MAXLOG - 1))
+#endif
+
+
+#ifndef DIV_CROV
+# define DIV_CROV       60
+#endif
+
+#ifndef RECIP_CROV
+# define RECIP_CROV     1500
+#endif
+
+#ifndef BARRETT_CROV
+# define BARRETT_CROV   60
+#endif
+
+#ifndef SPECIAL_CROV
+# define SPECIAL_CROV   10
+#endif
+
+#ifndef RADIX_CROV
+# define RADIX_CROV     30
+#endif
+
+#ifndef LEHMER_CROV
+# define LEHMER_CROV    8
+#endif
+
+#ifndef HGCD_CROV
+# define HGCD_CROV      100
+#endif
+
+#ifndef PIPPENGER_CROV
+# define PIPPENGER_CROV 128
+#endif
+
+#ifndef SDIV_CROV
+# define SDIV_CROV      3
+#endif
+
+#ifndef TRIDIV_BLOCK
+# define TRIDIV_BLOCK   32
+#endif
+
+#ifndef PRIM_SEG
+# define PRIM_SEG       32768   /* bytes per sieve segment */
+#endif
+
+#ifndef PRIME_WINDOW
+# define PRIME_WINDOW   4096    /* candidates sieved at once in zrandomprime */
+#endif
+
+#ifndef PRIME_WINDOW_BND
+# define PRIME_WINDOW_BND 32768 /* sieving bound for those candidates */
+#endif
+
+#ifndef MONT_SIMD_CROV
+# define MONT_SIMD_CROV 10
+#endif
+
+#if defined(ALPHA_OR_ALPHA50) && defined(__GNUC__) && defined(__x86_64__) \
+	&& !defined(NO_SIMD)
+#define MONT_SIMD
+#include <immintrin.h>
+#endif
+
+
+#if defined(ALPHA) && !defined(ALPHA50) && defined(__SIZEOF_INT128__)
+#define ZSRECIP_MG
+typedef unsigned __int128 zsr_udlong;
+#endif
+
+
+#ifdef THREADS
+#define TLS             __thread
+#else
+#define TLS
+#endif
+
+#ifndef INLINE_SIZE
+# define INLINE_SIZE    8
+#endif
+
+#ifndef ARENA_CHUNK
+# define ARENA_CHUNK    8192    /* longs per arena chunk */
+#endif
+
+#define ARENA_MIN_CLASS 5       /* smallest arena block 2^5 longs */
+#define ZARENA_BIT      (1L << (BITSOFLONG - 2))
+#define ZCAP(x)         ((x)[-1] < 0 ? -(x)[-1] : (x)[-1] & ~ZARENA_BIT)
+
+typedef struct
+{	/* a range sieved by zprange, see zprange_run */
+	const unsigned int *bp;
+	const unsigned int *binv;
+	long bn;
+	long k;                 /* segment j starts at 30 * (k + j * PRIM_SEG) */
+	long kend;
+	long nseg;
+	long nslot;
+	unsigned char *seg;     /* nslot segments of PRIM_SEG bytes */
+	unsigned int **off;     /* primes of a slot, from its segment start */
+	long *cnt;              /* primes in a slot, -1 if out of memory */
+	long *size;             /* room in off[] */
+	long *ready;            /* segment in a slot, -1 if none yet */
+	long next;              /* next segment to sieve */
+	long used;              /* segments taken by the caller */
+#ifdef THREADS
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+#endif
+} zprange_job;
 
 #ifdef FREE
 #define STATIC
+#define STATIC_INLINE(x) ZINLINE(x, INLINE_SIZE)
 #define FREESPACE(x)    zfree(&x);
 #define FREE2SPACE(x,y) zfree(&x); zfree(&y);
 #define FREE3SPACE(x,y,z) zfree(&x); zfree(&y); zfree(&z);
 #else
-#define STATIC          static
+#define STATIC          static TLS
+#define STATIC_INLINE(x) STATIC verylong x = 0
 #define FREESPACE(x)
 #define FREE2SPACE(x,y) 
 #define FREE3SPACE(x,y,z)
 #endif
 
+#ifdef ZCOUNT
+#define ZCOUNT_LEN(a)   ((a) ? ((a)[0] < 0 ? -(a)[0] : (a)[0]) : 0)
+#define ZCOUNT_IN(op,n) double zcount_t0 = zcount_in(&zcount.op, &zcount_nest.op, (n))
+#define ZCOUNT_OUT(op)  zcount_out(&zcount.op, &zcount_nest.op, zcount_t0)
+#define ZCOUNT_ADD(f,n) zcount.f += (n)
+#else
+#define ZCOUNT_IN(op,n)
+#define ZCOUNT_OUT(op)
+#define ZCOUNT_ADD(f,n)
+#endif
+
 #if (!ILLEGAL)
 
 
@@ -89,6 +249,46 @@ static void hidetimer(
 	long w
 	);
 
+#ifdef ZCOUNT
+static double zcount_clock(
+	void
+	);
+
+static double zcount_in(
+	zcount_op *o,
+	zcount_op *nest,
+	long n
+	);
+
+static void zcount_out(
+	zcount_op *o,
+	zcount_op *nest,
+	double t0
+	);
+#endif
+
+static long *zalloc_heap(
+	long n
+	);
+
+static void zfree_heap(
+	long *p,
+	long n
+	);
+
+static long *zarena_get(
+	zarena *a,
+	long n
+	);
+
+static void zarena_put(
+	long *p
+	);
+
+static verylong znewlength(
+	long len
+	);
+
 static void zhalt(
 	char *c
 	);
@@ -110,377 +310,736 @@ static void zmkeep(
 static void zmback(
         );
 
+static void zmont_swap(
+	zmont_ctx *m
+	);
+
+static long kar_space(
+	long n,
+	long sq
+	);
+
+static verylong kar_slots(
+	verylong mem,
+	long n,
+	long k,
+	verylong *t
+	);
+
 static void kar_mul(
 	verylong a,
 	verylong b,
 	verylong *c,
-	long shi
+	verylong mem,
+	long depth
 	);
 
 static void kar_sq(
 	verylong a,
 	verylong *c,
-	long shi
+	verylong mem,
+	long depth
 	);
 
-static long zxxeucl(
-	verylong ain,
-	verylong nin,
-	verylong *invv,
-	verylong *uu
+static void kar_mul_top(
+	verylong a,
+	verylong b,
+	verylong *c,
+	verylong *s
 	);
 
-static void mont_init_odd_power(
+static void kar_sq_top(
 	verylong a,
-	verylong *a_sq,
-	long m,
-	verylong **odd_a_power
+	verylong *c,
+	verylong *s
 	);
 
-static void init_odd_power(
+static void toom_mul(
 	verylong a,
-	verylong n,
-	verylong *a_sq,
-	long m,
-	verylong **odd_a_power
+	verylong b,
+	verylong *c,
+	verylong *s
 	);
 
-static void zsmexp(
-	long a,
-	verylong e,
-	verylong *bb
+static void toom3_mul(
+	verylong a,
+	verylong b,
+	verylong *c,
+	verylong *s
 	);
 
-static void zpshift(
-	void
+static void toom4_mul(
+	verylong a,
+	verylong b,
+	verylong *c,
+	verylong *s
 	);
 
-static long zrootnewton(
+#ifdef ALPHA_OR_ALPHA50
+static void ntt_mul(
 	verylong a,
-	verylong *b,
-	long n
+	verylong b,
+	verylong *c
 	);
+#endif
 
-static long ph1set(
-	verylong n,
-	verylong *rap,
-	verylong *alpha,
-	verylong *mu,
-	verylong *x,
-	verylong *f
+static void zdiv_nits(
+	verylong a,
+	long lo,
+	long len,
+	verylong *c
 	);
 
-static long ph1exp(
-	verylong n,
-	verylong *x,
-	verylong e,
-	verylong rap,
-	verylong *f
+static void zdiv_rec(
+	verylong a,
+	verylong b,
+	verylong *q,
+	verylong *r
 	);
 
-static long ph1(
-	verylong n,
-	verylong *x,
-	long m,
-	verylong rap,
-	verylong *f
+static void zdiv_dc(
+	verylong a,
+	verylong b,
+	verylong *q,
+	verylong *r
 	);
 
-static long ph1toph2(
-	verylong n,
-	verylong *x,
-	verylong *y,
-	verylong *ra,
-	verylong alpha,
-	verylong mu,
-	verylong *f
+#ifndef INT128
+static long zdiv_low(
+	verylong c,
+	verylong b
 	);
+#endif
 
-static long ph2squ(
-	verylong n,
-	verylong x1s,
-	verylong y1s,
-	verylong *x2,
-	verylong *y2,
-	verylong ra,
-	verylong *f
+static void zrecip_block(
+	zrecip *m,
+	verylong t,
+	verylong *q,
+	verylong *r
 	);
 
-static long ph2mul(
-	verylong n,
-	verylong x1s,
-	verylong y1s,
-	verylong x2s,
-	verylong y2s,
-	verylong *x3,
-	verylong *y3,
-	verylong ra,
-	verylong *f
+static void zbarrett_red(
+	zbarrett *m,
+	verylong x,
+	verylong *rr
 	);
 
-static long ph2exp(
-	verylong n,
-	verylong x1,
-	verylong yy1,
-	verylong *x2,
-	verylong *y2,
-	long e,
-	verylong ra,
-	verylong *f
+static zbarrett *zbarrett_last(
+	verylong n
 	);
 
-static long ph2set(
-	verylong n,
+static void zspecial_red(
+	zspecial *m,
 	verylong x,
-	verylong y,
-	long te,
-	verylong ra,
-	verylong *f
+	verylong *rr
 	);
 
-static void ph2prec(
-	verylong n,
-	long n1,
-	long j
+static zspecial *zspecial_last(
+	verylong n
 	);
 
-static void ph2eval(
-	verylong n,
-	long ind,
-	long n1,
-	long j,
-	verylong *result
+static void zexpmod_slide(
+	zbarrett *bm,
+	zspecial *sm,
+	verylong x,
+	verylong e,
+	verylong *bb
 	);
 
-static long ph2(
-	verylong n,
-	verylong inx,
-	verylong iny,
-	long m,
-	long te,
-	verylong ra,
-	verylong *f
+static long zmulti_bits(
+	verylong e,
+	long p,
+	long c
 	);
 
-static void message(
-	char *str,
-	double t,
-	FILE *fp
+static void zmulti_window(
+	verylong e,
+	long w,
+	long *st
 	);
 
+static void zmulti_straus(
+	verylong *x,
+	verylong *e,
+	long k,
+	long bits,
+	verylong *rr
+	);
 
-#ifdef DOUBLES_LOW_HIGH
-#define LO_WD 0
-#define HI_WD 1
-#else
-#define LO_WD 1
-#define HI_WD 0
-#endif
+static void zmulti_pippenger(
+	verylong *x,
+	verylong *e,
+	long k,
+	long bits,
+	verylong *rr
+	);
 
+static verylong zradix_pow(
+	verylong b,
+	long k
+	);
 
-/* globals for Montgomery multiplication */
-static verylong zn = 0;
-static verylong zoldzn = 0;
-static verylong zr = 0;
-static verylong zrr = 0;
-static verylong zrrr = 0;
-static verylong znm = 0;
-static long znotinternal = 0;
-static long zntop;
-#ifdef PLAIN_OR_KARAT
-static long zninv1;
-static long zninv2;
-#else
-static long zninv;
-#endif
+static long zradix_leaf(
+	verylong b
+	);
 
+static long zradix_len(
+	verylong a,
+	verylong b
+	);
 
-#ifdef SINGLE_MUL
+static void zradix_split(
+	verylong a,
+	long b,
+	verylong vb,
+	long *row,
+	long n,
+	long leaf
+	);
 
-#define ExtractHiLo(Hi,Lo,x) \
-{ \
-double t=x+(4503599627370496.0); \
-unsigned int *it = (unsigned int *)&t; \
-Lo = it[LO_WD]; \
-Hi = ((it[HI_WD]<<6)|(it[LO_WD]>>26)); \
-Lo &= 0x3FFFFFF; \
-Hi &= 0x3FFFFFF; \
-}
+static void zradix_vsplit(
+	verylong a,
+	verylong b,
+	verylong *row,
+	long n,
+	long leaf
+	);
 
-#define zaddmulp(a,b,d,t) \
-{ \
-   double __lx = ((double) ((*a) + (*t))) + ((double) b)*((double) d); \
-   register long  __lhi = 0, __llo = 0;\
-   ExtractHiLo(__lhi,__llo,__lx);\
-   (*a) = __llo;\
-   (*t) = __lhi;\
-}
+static void zradix_join(
+	long *row,
+	long n,
+	long b,
+	verylong vb,
+	long leaf,
+	verylong *a
+	);
 
-#define zaddmulpsq(a,b,t) \
-{ \
-   double __lx = ((double) (*a)) + ((double) b)*((double) b); \
-   register long  __lhi = 0, __llo = 0;\
-   ExtractHiLo(__lhi,__llo,__lx);\
-   (*a) = __llo;\
-   (*t) = __lhi;\
-}
+static void zradix_vjoin(
+	verylong *row,
+	long n,
+	verylong b,
+	long leaf,
+	verylong *a
+	);
 
+static char *zradix_buf(
+	long n
+	);
 
-typedef union { double d; unsigned long rep[2]; } d_or_rep;
+static void zradix_scan(
+	char *s,
+	long len,
+	long b,
+	verylong *a
+	);
 
-#define FetchHiLo(hi,lo,x) \
-{ \
-   d_or_rep _l_xx; \
-   _l_xx.d = x; \
-   hi = _l_xx.rep[HI_WD]; \
-   lo = _l_xx.rep[LO_WD]; \
-}
+static void zradix_hex(
+	char *s,
+	long len,
+	verylong *a
+	);
 
-static
-void zaddmul(
-        long ams,
-        long *ama,
-        long *amb
-        ) 
-{ 
-        register long carry = 0; 
-        register long i = (*amb++);
-        register double dams = (double) ams;
-        register double xx;
-        register double yy;
-        register unsigned long lo_wd, lo;
-        register unsigned long hi_wd, hi;
+static long zgcd_top(
+	verylong a,
+	long h
+	);
 
-        xx  =  ((double) (*amb))*dams + 4503599627370496.0;
-        for (; i > 1; i--) 
-        { 
-                yy =  ((double) (*(++amb)))*dams +4503599627370496.0;
-                FetchHiLo(hi_wd, lo_wd, xx);
-                lo = lo_wd & 0x3FFFFFF;
-                hi = ((hi_wd<<6)|(lo_wd>>26)) & 0x3FFFFFF;
-                lo = lo + (*ama) + carry;
-                *ama = lo & 0x3FFFFFF;
-                carry = hi + (lo >> 26);
-                ama++; 
-                xx = yy;
-        } 
+static long zgcd_step(
+	verylong *a,
+	verylong *b,
+	verylong *m,
+	long *det,
+	long s
+	);
 
-        FetchHiLo(hi_wd, lo_wd, xx);
-        lo = lo_wd & 0x3FFFFFF;
-        hi = ((hi_wd<<6)|(lo_wd>>26)) & 0x3FFFFFF;
-        lo = lo + (*ama) + carry;
-        *ama = lo & 0x3FFFFFF;
-        carry = hi + (lo >> 26);
-        ama++; 
-        *ama += carry; 
-}
+static long zgcd_lehmer(
+	verylong *a,
+	verylong *b,
+	verylong *m,
+	long *det,
+	long s
+	);
 
+static void zhgcd_mul(
+	verylong *m,
+	verylong *n
+	);
 
-static
-void zmmulp(long *ama)
-{ 
-        register long carry = 0; 
-        register long i = (*zn);
-        register long *amb = (zn+1);
-        register double dams = (double) ((zninv*(*ama))&RADIXM);
-        double xx;
-	register double yy;
-        register unsigned long lo_wd, lo;
-        register unsigned long hi_wd, hi;
+static long zhgcd_adjust(
+	verylong *a,
+	verylong *b,
+	long p,
+	verylong a1,
+	verylong b1,
+	verylong *m,
+	long *det
+	);
 
-        xx =  ((double) (*amb))*dams + 4503599627370496.0;
-        for (; i > 1; i--) 
-        { 
-                yy =  ((double) (*(++amb)))*dams +4503599627370496.0;
-                FetchHiLo(hi_wd, lo_wd, xx);
-                lo = lo_wd & 0x3FFFFFF;
-                hi = ((hi_wd<<6)|(lo_wd>>26)) & 0x3FFFFFF;
-                lo = lo + (*ama) + carry;
-                *ama = lo & 0x3FFFFFF;
-                carry = hi + (lo >> 26);
-                ama++; 
-                xx = yy;
-        } 
-        FetchHiLo(hi_wd, lo_wd, xx);
-        lo = lo_wd & 0x3FFFFFF;
-        hi = ((hi_wd<<6)|(lo_wd>>26)) & 0x3FFFFFF;
-        lo = lo + (*ama) + carry;
-        *ama = lo & 0x3FFFFFF;
-        carry = hi + (lo >> 26);
-        ama++; 
-        if (((*ama += carry) & RADIX) > 0 )
-	{
-		(*ama++) &= RADIXM;
-		(*ama)++;
-	}
-}
+static void zhgcd(
+	verylong *a,
+	verylong *b,
+	verylong *m,
+	long *det
+	);
 
+static void zgcd_fast(
+	verylong a,
+	verylong b,
+	verylong *g,
+	verylong *xa
+	);
 
-static
-void zaddmulsq(
-	long ams,
-	long *ama,
-	long *amb
-	) 
-{ 
-        register long carry = 0; 
-        register long i = ams;
-        register double dams = (double) (*amb);
-        double xx;
-	register double yy;
-        register unsigned long lo_wd,lo;
-	register unsigned long hi_wd,hi;
+static long zxxeucl(
+	verylong ain,
+	verylong nin,
+	verylong *invv,
+	verylong *uu
+	);
 
-        xx =  ((double) (*(++amb)))*dams + 4503599627370496.0;
-        for (; i > 1; i--) 
-        { 
-                yy =  ((double) (*(++amb)))*dams + 4503599627370496.0;
-		FetchHiLo(hi_wd, lo_wd, xx);
-                lo = lo_wd  & 0x3FFFFFF;
-                hi = ((hi_wd <<6)|(lo_wd >>26)) & 0x3FFFFFF;
-                lo = lo + (*ama) + carry;
-                *ama = lo & 0x3FFFFFF;
-                carry = hi + (lo >> 26);
-                ama++; 
-                xx = yy;
-        } 
-	if (i==1)
-	{
-		FetchHiLo(hi_wd, lo_wd, xx);
-        	lo = lo_wd  & 0x3FFFFFF;
-        	hi = ((hi_wd <<6)|(lo_wd >>26)) & 0x3FFFFFF;
-        	lo = lo + (*ama) + carry;
-        	*ama = lo & 0x3FFFFFF;
-        	carry = hi + (lo >> 26);
-        	ama++; 
-	}
-        *ama += carry; 
-}
+static long zinv_batch(
+	verylong *in,
+	long count,
+	verylong n,
+	verylong *out,
+	long mont
+	);
 
+static void mont_init_odd_power(
+	verylong a,
+	verylong *a_sq,
+	long m,
+	verylong **odd_a_power
+	);
 
-/* a[s:] -= d*b, optimize this one, a and b not at overlapping addresses */
+static void init_odd_power(
+	verylong a,
+	verylong n,
+	verylong *a_sq,
+	long m,
+	verylong **odd_a_power
+	);
 
-static
-void zsubmul(
-	long ams,
-	long *ama,
-	long *amb
-	) 
-{ 
-        register long carry = RADIX; 
-        register long i = (*amb++);
-        register double dams = (double) (RADIX-ams);
-        double xx;
-	register double yy;
-        register unsigned long lo_wd,lo;
-	register unsigned long hi_wd,hi;
+static void zsmexp(
+	long a,
+	verylong e,
+	verylong *bb
+	);
 
-        xx =  ((double) (*amb))*dams + 4503599627370496.0;
-        for (; i > 1; i--) 
-        { 
-                yy =  ((double) (*(amb+1)))*dams + 4503599627370496.0;
-		FetchHiLo(hi_wd, lo_wd, xx);
-                lo = lo_wd & 0x3FFFFFF;
+static long zmlcomposite(
+	verylong m,
+	long t
+	);
+
+static void zpwindow(
+	verylong a,
+	verylong d,
+	long n,
+	long bound,
+	unsigned char *s
+	);
+
+static void zpbase_add(
+	long p
+	);
+
+static void zpbase_init(
+	void
+	);
+
+static void zpbase_grow(
+	long n
+	);
+
+static void zpcross(
+	const unsigned int *bp,
+	const unsigned int *binv,
+	long bn,
+	unsigned char *s,
+	long k,
+	long len
+	);
+
+static void zpsieve(
+	unsigned char *s,
+	long k,
+	long len
+	);
+
+static void zprange_seg(
+	zprange_job *job,
+	long j
+	);
+
+static long zprange_put(
+	long p,
+	void (*f) (long, void *),
+	void *arg,
+	long **a,
+	long *count,
+	long *asize
+	);
+
+#ifdef THREADS
+static void *zprange_work(
+	void *arg
+	);
+#endif
+
+static long zprange_run(
+	long lo,
+	long hi,
+	long nthreads,
+	void (*f) (long, void *),
+	void *arg,
+	long **a
+	);
+
+static long zrootnewton(
+	verylong a,
+	verylong *b,
+	long n
+	);
+
+static long ph1set(
+	verylong n,
+	verylong *rap,
+	verylong *alpha,
+	verylong *mu,
+	verylong *x,
+	verylong *f
+	);
+
+static long ph1exp(
+	verylong n,
+	verylong *x,
+	verylong e,
+	verylong rap,
+	verylong *f
+	);
+
+static long ph1(
+	verylong n,
+	verylong *x,
+	long m,
+	verylong rap,
+	verylong *f
+	);
+
+static long ph1toph2(
+	verylong n,
+	verylong *x,
+	verylong *y,
+	verylong *ra,
+	verylong alpha,
+	verylong mu,
+	verylong *f
+	);
+
+static long ph2squ(
+	verylong n,
+	verylong x1s,
+	verylong y1s,
+	verylong *x2,
+	verylong *y2,
+	verylong ra,
+	verylong *f
+	);
+
+static long ph2mul(
+	verylong n,
+	verylong x1s,
+	verylong y1s,
+	verylong x2s,
+	verylong y2s,
+	verylong *x3,
+	verylong *y3,
+	verylong ra,
+	verylong *f
+	);
+
+static long ph2exp(
+	verylong n,
+	verylong x1,
+	verylong yy1,
+	verylong *x2,
+	verylong *y2,
+	long e,
+	verylong ra,
+	verylong *f
+	);
+
+static long ph2next(
+	verylong n,
+	long te,
+	verylong ra,
+	verylong *f
+	);
+
+static long ph2set(
+	verylong n,
+	verylong x,
+	verylong y,
+	long te,
+	verylong ra,
+	verylong *f
+	);
+
+static void ph2prec(
+	verylong n,
+	long n1,
+	long j
+	);
+
+static void ph2eval(
+	verylong n,
+	long ind,
+	long n1,
+	long j,
+	verylong *result
+	);
+
+static long ph2(
+	verylong n,
+	verylong inx,
+	verylong iny,
+	long m,
+	long te,
+	verylong ra,
+	verylong *f
+	);
+
+static void message(
+	char *str,
+	double t,
+	FILE *fp
+	);
+
+
+#ifdef DOUBLES_LOW_HIGH
+#define LO_WD 0
+#define HI_WD 1
+#else
+#define LO_WD 1
+#define HI_WD 0
+#endif
+
+
+/* allocator set by zset_alloc, and the arena new very long ints come from */
+static void *(*zalloc_fn)(size_t) = 0;
+static void *(*zrealloc_fn)(void *, size_t, size_t) = 0;
+static void (*zfree_fn)(void *, size_t) = 0;
+static TLS zarena *zarena_cur = 0;
+
+/* counters returned by zcount_get, with -DZCOUNT */
+#ifdef ZCOUNT
+static TLS zcounters zcount;
+static TLS zcounters zcount_nest;       /* calls is the nesting depth */
+static TLS double zcount_start = -1.0;
+#endif
+
+/* globals for Montgomery multiplication */
+static TLS verylong zn = 0;
+static TLS verylong zoldzn = 0;
+static TLS verylong zr = 0;
+static TLS verylong zrr = 0;
+static TLS verylong zrrr = 0;
+static TLS verylong znm = 0;
+static TLS long znotinternal = 0;
+static TLS long zntop;
+#ifdef PLAIN_OR_KARAT
+static TLS long zninv1;
+static TLS long zninv2;
+#else
+static TLS long zninv;
+#endif
+
+
+#ifdef SINGLE_MUL
+
+#define ExtractHiLo(Hi,Lo,x) \
+{ \
+double t=x+(4503599627370496.0); \
+unsigned int *it = (unsigned int *)&t; \
+Lo = it[LO_WD]; \
+Hi = ((it[HI_WD]<<6)|(it[LO_WD]>>26)); \
+Lo &= 0x3FFFFFF; \
+Hi &= 0x3FFFFFF; \
+}
+
+#define zaddmulp(a,b,d,t) \
+{ \
+   double __lx = ((double) ((*a) + (*t))) + ((double) b)*((double) d); \
+   register long  __lhi = 0, __llo = 0;\
+   ExtractHiLo(__lhi,__llo,__lx);\
+   (*a) = __llo;\
+   (*t) = __lhi;\
+}
+
+#define zaddmulpsq(a,b,t) \
+{ \
+   double __lx = ((double) (*a)) + ((double) b)*((double) b); \
+   register long  __lhi = 0, __llo = 0;\
+   ExtractHiLo(__lhi,__llo,__lx);\
+   (*a) = __llo;\
+   (*t) = __lhi;\
+}
+
+
+typedef union { double d; unsigned long rep[2]; } d_or_rep;
+
+#define FetchHiLo(hi,lo,x) \
+{ \
+   d_or_rep _l_xx; \
+   _l_xx.d = x; \
+   hi = _l_xx.rep[HI_WD]; \
+   lo = _l_xx.rep[LO_WD]; \
+}
+
+static
+void zaddmul(
+        long ams,
+        long *ama,
+        long *amb
+        ) 
+{ 
+        register long carry = 0; 
+        register long i = (*amb++);
+        register double dams = (double) ams;
+        register double xx;
+        register double yy;
+        register unsigned long lo_wd, lo;
+        register unsigned long hi_wd, hi;
+
+        xx  =  ((double) (*amb))*dams + 4503599627370496.0;
+        for (; i > 1; i--) 
+        { 
+                yy =  ((double) (*(++amb)))*dams +4503599627370496.0;
+                FetchHiLo(hi_wd, lo_wd, xx);
+                lo = lo_wd & 0x3FFFFFF;
+                hi = ((hi_wd<<6)|(lo_wd>>26)) & 0x3FFFFFF;
+                lo = lo + (*ama) + carry;
+                *ama = lo & 0x3FFFFFF;
+                carry = hi + (lo >> 26);
+                ama++; 
+                xx = yy;
+        } 
+
+        FetchHiLo(hi_wd, lo_wd, xx);
+        lo = lo_wd & 0x3FFFFFF;
+        hi = ((hi_wd<<6)|(lo_wd>>26)) & 0x3FFFFFF;
+        lo = lo + (*ama) + carry;
+        *ama = lo & 0x3FFFFFF;
+        carry = hi + (lo >> 26);
+        ama++; 
+        *ama += carry; 
+}
+
+
+static
+void zmmulp(long *ama)
+{ 
+        register long carry = 0; 
+        register long i = (*zn);
+        register long *amb = (zn+1);
+        register double dams = (double) ((zninv*(*ama))&RADIXM);
+        double xx;
+	register double yy;
+        register unsigned long lo_wd, lo;
+        register unsigned long hi_wd, hi;
+
+        xx =  ((double) (*amb))*dams + 4503599627370496.0;
+        for (; i > 1; i--) 
+        { 
+                yy =  ((double) (*(++amb)))*dams +4503599627370496.0;
+                FetchHiLo(hi_wd, lo_wd, xx);
+                lo = lo_wd & 0x3FFFFFF;
+                hi = ((hi_wd<<6)|(lo_wd>>26)) & 0x3FFFFFF;
+                lo = lo + (*ama) + carry;
+                *ama = lo & 0x3FFFFFF;
+                carry = hi + (lo >> 26);
+                ama++; 
+                xx = yy;
+        } 
+        FetchHiLo(hi_wd, lo_wd, xx);
+        lo = lo_wd & 0x3FFFFFF;
+        hi = ((hi_wd<<6)|(lo_wd>>26)) & 0x3FFFFFF;
+        lo = lo + (*ama) + carry;
+        *ama = lo & 0x3FFFFFF;
+        carry = hi + (lo >> 26);
+        ama++; 
+        if (((*ama += carry) & RADIX) > 0 )
+	{
+		(*ama++) &= RADIXM;
+		(*ama)++;
+	}
+}
+
+
+static
+void zaddmulsq(
+	long ams,
+	long *ama,
+	long *amb
+	) 
+{ 
+        register long carry = 0; 
+        register long i = ams;
+        register double dams = (double) (*amb);
+        double xx;
+	register double yy;
+        register unsigned long lo_wd,lo;
+	register unsigned long hi_wd,hi;
+
+        xx =  ((double) (*(++amb)))*dams + 4503599627370496.0;
+        for (; i > 1; i--) 
+        { 
+                yy =  ((double) (*(++amb)))*dams + 4503599627370496.0;
+		FetchHiLo(hi_wd, lo_wd, xx);
+                lo = lo_wd  & 0x3FFFFFF;
+                hi = ((hi_wd <<6)|(lo_wd >>26)) & 0x3FFFFFF;
+                lo = lo + (*ama) + carry;
+                *ama = lo & 0x3FFFFFF;
+                carry = hi + (lo >> 26);
+                ama++; 
+                xx = yy;
+        } 
+	if (i==1)
+	{
+		FetchHiLo(hi_wd, lo_wd, xx);
+        	lo = lo_wd  & 0x3FFFFFF;
+        	hi = ((hi_wd <<6)|(lo_wd >>26)) & 0x3FFFFFF;
+        	lo = lo + (*ama) + carry;
+        	*ama = lo & 0x3FFFFFF;
+        	carry = hi + (lo >> 26);
+        	ama++; 
+	}
+        *ama += carry; 
+}
+
+
+/* a[s:] -= d*b, optimize this one, a and b not at overlapping addresses */
+
+static
+void zsubmul(
+	long ams,
+	long *ama,
+	long *amb
+	) 
+{ 
+        register long carry = RADIX; 
+        register long i = (*amb++);
+        register double dams = (double) (RADIX-ams);
+        double xx;
+	register double yy;
+        register unsigned long lo_wd,lo;
+	register unsigned long hi_wd,hi;
+
+        xx =  ((double) (*amb))*dams + 4503599627370496.0;
+        for (; i > 1; i--) 
+        { 
+                yy =  ((double) (*(amb+1)))*dams + 4503599627370496.0;
+		FetchHiLo(hi_wd, lo_wd, xx);
+                lo = lo_wd & 0x3FFFFFF;
                 hi = ((hi_wd<<6)|(lo_wd>>26)) & 0x3FFFFFF;
                 lo = lo + (*ama) + carry;
                 *ama = lo & 0x3FFFFFF;
@@ -499,28 +1058,142 @@ void zsubmul(
 	carry += RADIXM - (*amb);
         *ama += carry - RADIX; 
 }
-#elif KARAT
+#elif KARAT
+
+/*
+	This definition of zaddmulp and zaddmulpsq assumes nothing
+*/
+#define zaddmulp(  a,  b,  d,  t) { \
+        register unsigned long b1 = b & RADIXROOTM; \
+        register unsigned long d1 = d & RADIXROOTM; \
+        register unsigned long bd,b1d1,m,aa= (*a) + (*t); \
+	register unsigned long ld = (d>>NBITSH); \
+	register unsigned long lb = (b>>NBITSH); \
+ \
+        bd=lb*ld; \
+        b1d1=b1*d1; \
+        m=(lb+b1)*(ld+d1) - bd - b1d1; \
+        aa += ( b1d1+ ((m&RADIXROOTM)<<NBITSH)); \
+        (*t) = (aa >> NBITS) + bd + (m>>NBITSH); \
+        (*a) = aa & RADIXM; \
+}
+
+
+
+#define zaddmulpsq(_a, _b, _t) \
+{ \
+	register long lb = (_b); \
+	register long b1 = (_b) & RADIXROOTM; \
+	register long aa = *(_a) + b1 * b1; \
+ \
+	b1 = (b1 * (lb >>= NBITSH) << 1) + (aa >> NBITSH); \
+	aa = (aa & RADIXROOTM) + ((b1 & RADIXROOTM) << NBITSH); \
+	*(_t) = lb * lb + (b1 >> NBITSH) + (aa >> NBITS); \
+	*(_a) = (aa & RADIXM); \
+}
+
+#define zmmulp(mmpa) \
+{ \
+	register verylong lmmpa = (mmpa); \
+	register verylong lmmpb = (zn); \
+	register long lmmi = (*lmmpa) >> NBITSH; \
+	register long lmmd = (*lmmpa) & RADIXROOTM; \
+	long zmmtemp = 0; \
+ \
+	lmmd = (zninv1 * lmmd + (((zninv1 * lmmi + zninv2 * lmmd) & RADIXROOTM) << NBITSH)) & RADIXM; \
+	for (lmmi = *lmmpb++; lmmi > 0; lmmi--) \
+	{ \
+		zaddmulp(lmmpa, *lmmpb, lmmd, &zmmtemp); \
+		lmmpa++; \
+		*lmmpb++; \
+	} \
+	if (((*lmmpa += zmmtemp) & RADIX) > 0) \
+	{ \
+		(*lmmpa++) &= RADIXM; \
+		(*lmmpa)++; \
+	} \
+}
+
+
+#define zaddmul(ams, ama, amb) \
+{ \
+	register long lami; \
+	register long lams = (ams); \
+	register verylong lama = (ama); \
+	register verylong lamb = (amb); \
+	long lamcarry = 0; \
+ \
+	for (lami = (*lamb++); lami > 0; lami--) \
+	{ \
+		zaddmulp(lama, *lamb, lams, &lamcarry); \
+	/* Be careful, the last lama is unnormalized */ \
+		lama++; \
+		lamb++; \
+	} \
+        *lama += lamcarry; \
+}
+
+
+#define zaddmulsq(sql, sqa, sqb) \
+{ \
+	register long lsqi = (sql); \
+	register long lsqs = *(sqb); \
+	register verylong lsqa = (sqa); \
+	register verylong lsqb = (sqb); \
+	long lsqcarry = 0; \
+ \
+	lsqb++; \
+	for (; lsqi > 0; lsqi--) \
+	{ \
+		zaddmulp(lsqa, *lsqb, lsqs, &lsqcarry); \
+		lsqa++; \
+		lsqb++; \
+	} \
+	*lsqa += lsqcarry; \
+/* Be careful, the last lama is unnormalized */ \
+}
+
+static void
+zsubmul(
+	long r,
+	verylong a,
+	verylong b
+	)
+{
+	register long rd = RADIX - r;
+	register long i;
+	long carry = RADIX;
+
+	for (i = (*b++); i > 0; i--)
+	{
+		zaddmulp(a, *b, rd, &carry);
+		a++;
+		carry += RADIXM - (*b++);
+	}
+	*a += carry - RADIX;	/* unnormalized */
+}
+
+
+#elif PLAIN
 
 /*
 	This definition of zaddmulp and zaddmulpsq assumes nothing
 */
-#define zaddmulp(  a,  b,  d,  t) { \
-        register unsigned long b1 = b & RADIXROOTM; \
-        register unsigned long d1 = d & RADIXROOTM; \
-        register unsigned long bd,b1d1,m,aa= (*a) + (*t); \
-	register unsigned long ld = (d>>NBITSH); \
-	register unsigned long lb = (b>>NBITSH); \
+#define zaddmulp(_a, _b, _d, _t) \
+{ \
+	register long lb = (_b); \
+	register long ld = (_d); \
+	register long b1 = (_b) & RADIXROOTM; \
+	register long d1 = (_d) & RADIXROOTM; \
+	register long aa = *(_a) + b1 * d1; \
  \
-        bd=lb*ld; \
-        b1d1=b1*d1; \
-        m=(lb+b1)*(ld+d1) - bd - b1d1; \
-        aa += ( b1d1+ ((m&RADIXROOTM)<<NBITSH)); \
-        (*t) = (aa >> NBITS) + bd + (m>>NBITSH); \
-        (*a) = aa & RADIXM; \
+	b1 = b1 * (ld >>= NBITSH) + d1 * (lb >>= NBITSH) + (aa >> NBITSH); \
+	aa = (aa & RADIXROOTM) + ((b1 & RADIXROOTM) << NBITSH) + *(_t); \
+	*(_t) = ld * lb + (b1 >> NBITSH) + (aa >> NBITS); \
+	*(_a) = (aa & RADIXM); \
 }
 
 
-
 #define zaddmulpsq(_a, _b, _t) \
 { \
 	register long lb = (_b); \
@@ -614,78 +1287,70 @@ zsubmul(
 	*a += carry - RADIX;	/* unnormalized */
 }
 
-
-#elif PLAIN
+#elif INT128
 
 /*
-	This definition of zaddmulp and zaddmulpsq assumes nothing
+	This definition of zaddmulp and zaddmulpsq uses the 128-bit
+	integer type of the compiler, so each product of two nits is a
+	single machine multiply. Intermediate sums stay below 2^126.
 */
+typedef __int128 dlong;
+typedef unsigned __int128 udlong;
+
 #define zaddmulp(_a, _b, _d, _t) \
 { \
-	register long lb = (_b); \
-	register long ld = (_d); \
-	register long b1 = (_b) & RADIXROOTM; \
-	register long d1 = (_d) & RADIXROOTM; \
-	register long aa = *(_a) + b1 * d1; \
+	register dlong lp = (dlong) (_b) * (_d) + *(_a) + *(_t); \
  \
-	b1 = b1 * (ld >>= NBITSH) + d1 * (lb >>= NBITSH) + (aa >> NBITSH); \
-	aa = (aa & RADIXROOTM) + ((b1 & RADIXROOTM) << NBITSH) + *(_t); \
-	*(_t) = ld * lb + (b1 >> NBITSH) + (aa >> NBITS); \
-	*(_a) = (aa & RADIXM); \
+	*(_t) = (long) (lp >> NBITS); \
+	*(_a) = ((long) lp) & RADIXM; \
 }
 
-
 #define zaddmulpsq(_a, _b, _t) \
 { \
-	register long lb = (_b); \
-	register long b1 = (_b) & RADIXROOTM; \
-	register long aa = *(_a) + b1 * b1; \
+	register dlong lp = (dlong) (_b) * (_b) + *(_a); \
  \
-	b1 = (b1 * (lb >>= NBITSH) << 1) + (aa >> NBITSH); \
-	aa = (aa & RADIXROOTM) + ((b1 & RADIXROOTM) << NBITSH); \
-	*(_t) = lb * lb + (b1 >> NBITSH) + (aa >> NBITS); \
-	*(_a) = (aa & RADIXM); \
+	*(_t) = (long) (lp >> NBITS); \
+	*(_a) = ((long) lp) & RADIXM; \
 }
 
 #define zmmulp(mmpa) \
 { \
 	register verylong lmmpa = (mmpa); \
 	register verylong lmmpb = (zn); \
-	register long lmmi = (*lmmpa) >> NBITSH; \
-	register long lmmd = (*lmmpa) & RADIXROOTM; \
-	long zmmtemp = 0; \
+	register long lmmi; \
+	register long lmmd; \
+	register dlong lmmcarry = 0; \
  \
-	lmmd = (zninv1 * lmmd + (((zninv1 * lmmi + zninv2 * lmmd) & RADIXROOTM) << NBITSH)) & RADIXM; \
+	lmmd = (long) (((unsigned long) zninv * (unsigned long) (*lmmpa)) & RADIXM); \
 	for (lmmi = *lmmpb++; lmmi > 0; lmmi--) \
 	{ \
-		zaddmulp(lmmpa, *lmmpb, lmmd, &zmmtemp); \
-		lmmpa++; \
-		*lmmpb++; \
+		lmmcarry += (dlong) (*lmmpb++) * lmmd + *lmmpa; \
+		*lmmpa++ = ((long) lmmcarry) & RADIXM; \
+		lmmcarry >>= NBITS; \
 	} \
-	if (((*lmmpa += zmmtemp) & RADIX) > 0) \
+	if (((*lmmpa += (long) lmmcarry) & RADIX) > 0) \
 	{ \
 		(*lmmpa++) &= RADIXM; \
 		(*lmmpa)++; \
 	} \
 }
 
-
 #define zaddmul(ams, ama, amb) \
 { \
 	register long lami; \
 	register long lams = (ams); \
 	register verylong lama = (ama); \
 	register verylong lamb = (amb); \
-	long lamcarry = 0; \
+	register dlong lamcarry = 0; \
  \
 	for (lami = (*lamb++); lami > 0; lami--) \
 	{ \
-		zaddmulp(lama, *lamb, lams, &lamcarry); \
-	/* Be careful, the last lama is unnormalized */ \
-		lama++; \
-		lamb++; \
+		lamcarry += (dlong) (*lamb++) * lams + *lama; \
+		*lama++ = ((long) lamcarry) & RADIXM; \
+		lamcarry >>= NBITS; \
 	} \
-        *lama += lamcarry; \
+	/* Be careful, the last lama is unnormalized */ \
+	*lama += (long) lamcarry; \
 }
 
 
@@ -695,16 +1360,16 @@ zsubmul(
 	register long lsqs = *(sqb); \
 	register verylong lsqa = (sqa); \
 	register verylong lsqb = (sqb); \
-	long lsqcarry = 0; \
+	register dlong lsqcarry = 0; \
  \
 	lsqb++; \
 	for (; lsqi > 0; lsqi--) \
 	{ \
-		zaddmulp(lsqa, *lsqb, lsqs, &lsqcarry); \
-		lsqa++; \
-		lsqb++; \
+		lsqcarry += (dlong) (*lsqb++) * lsqs + *lsqa; \
+		*lsqa++ = ((long) lsqcarry) & RADIXM; \
+		lsqcarry >>= NBITS; \
 	} \
-	*lsqa += lsqcarry; \
+	*lsqa += (long) lsqcarry; \
 /* Be careful, the last lama is unnormalized */ \
 }
 
@@ -908,6 +1573,20 @@ Assumes 0 <= numhigh < denom < RADIX and 0 <= numlow < RADIX.
 */
 
 
+#ifdef INT128
+
+#define zdiv21(numhigh, numlow, denom, deninv, quot) \
+{ \
+	register udlong ln21 = ((udlong) (numhigh) << NBITS) \
+			 + (unsigned long) (numlow); \
+	register long lq21 = (long) (ln21 / (unsigned long) (denom)); \
+ \
+	numhigh = (long) (ln21 - (udlong) lq21 * (unsigned long) (denom)); \
+	quot = lq21; \
+	(void) (deninv); \
+}
+
+#else
 #ifdef ALPHA
 
 #define zdiv21(numhigh, numlow, denom, deninv, quot) \
@@ -937,7 +1616,7 @@ Assumes 0 <= numhigh < denom < RADIX and 0 <= numlow < RADIX.
 		dd = numhigh-lprodhigh; \
 	} \
 	lr21 = RADIX * dd + (numlow - lprodlow); \
-	if (dd=lr21*(deninv)) { \
+	if ((dd=lr21*(deninv))) { \
 		lq21 += dd; \
 		lr21 -= denom*dd; \
 	} \
@@ -1054,6 +1733,7 @@ Assumes 0 <= numhigh < denom < RADIX and 0 <= numlow < RADIX.
 #endif
 
 
+#endif
 #endif
 #endif
 
@@ -1068,6 +1748,9 @@ zmulmods(
 	register long nn=n;
 	register long na= (a >= nn||a<0) ? (a % nn) : a;
 	register long nb= (b >= nn||b<0 ) ? (b % nn) : b;
+#ifdef INT128
+	register long lr = (long) (((dlong) na * nb) % nn);
+#else
 	register long lqmul = (long) (((double)na) * ((double)nb) / ((double)nn));
 #ifdef PLAIN_OR_KARAT
 	register long lr;
@@ -1100,6 +1783,7 @@ zmulmods(
 #else
 /* Many machines compute the following modulo 2^32, which is OK */
 	register long lr = na * nb - lqmul * nn;
+#endif
 #endif
 	while (lr >= nn)
 		lr -= nn;
@@ -1143,37 +1827,35 @@ extern void *calloc();
 /* global variables */
 
 /* for long division */
-static double log10rad = -1.0;
-static double log16rad = -1.0;
-static double epsilon;
+static TLS double epsilon;
 static double fradix = (double)RADIX;
-static double fudge = -1.0;
+static TLS double fudge = -1.0;
 #ifdef ALPHA
-static double fudge2 = -1.0;
+static TLS double fudge2 = -1.0;
 #endif
 #ifdef ALPHA50
-static double alpha50fudge = -1.0;
+static TLS double alpha50fudge = -1.0;
 static double alpha50fradix = (double) ALPHA50RADIX;
 #endif
 /* for random generator */
-static verylong zseed = 0;
-static verylong zranp = 0;
-static verylong zprroot = 0;
+static TLS verylong zseed = 0;
+static TLS verylong zranp = 0;
+static TLS verylong zprroot = 0;
 /* for small prime genaration */
-static short *lowsieve = 0;
-static short *movesieve = 0;
-static long pindex;
-static long pshift = -1;
-static long lastp = 0;
+static TLS unsigned int *zpbase_p = 0;
+static TLS unsigned int *zpbase_inv = 0;
+static TLS long zpbase_n = 0;
+static TLS long zpbase_size = 0;
+static TLS long zpbase_max = 0;
+static TLS zpiter zpglobal = {0, 0, 0, 0, 0, 2, 0, -1};
 /* for convenience */
 static long oner[] = {1, 1, 1};
-static long glosho[] = {1, 1, 0};
+static TLS long glosho[] = {1, 1, 0};
 static verylong one = &oner[1];
 /* for m_ary exponentiation */
-static verylong **exp_odd_powers = 0;
-/* for karatsuba */
-static verylong kar_mem[5*KAR_DEPTH];
-static long kar_mem_initialized = 0;
+static TLS verylong **exp_odd_powers = 0;
+/* scratch space of zmul, zsq, zmontmul and zmontsq, see kar_space */
+static TLS verylong kar_scratch = 0;
 
 double 
 getutime()
@@ -1224,7 +1906,7 @@ hidetimer(
 	long what
 	)
 {
-	static double keep_time = 0.0;
+	static TLS double keep_time = 0.0;
 	if (what)
 	{
 		fprintf(f,"%8.5lf sec.\n",gettime()-keep_time);
@@ -1248,6 +1930,77 @@ printtime(
 	hidetimer(f,1);
 }
 
+#ifdef ZCOUNT
+static double
+zcount_clock(
+	void
+	)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return ((double)t.tv_sec + 1.0e-9 * (double)t.tv_nsec);
+}
+
+static double
+zcount_in(
+	zcount_op *o,
+	zcount_op *nest,
+	long n
+	)
+{
+	/* only the outermost call of a primitive is timed */
+	o->calls++;
+	o->nits += n;
+	if (nest->calls++)
+		return (0.0);
+	if (zcount_start < 0)
+		zcount_start = zcount_clock();
+	return (zcount_clock());
+}
+
+static void
+zcount_out(
+	zcount_op *o,
+	zcount_op *nest,
+	double t0
+	)
+{
+	if (!--nest->calls)
+		o->time += zcount_clock() - t0;
+}
+#endif
+
+void
+zcount_get(
+	zcounters *c
+	)
+{
+#ifdef ZCOUNT
+	*c = zcount;
+	if (zcount_start < 0)
+		zcount_start = zcount_clock();
+	c->time = zcount_clock() - zcount_start;
+#else
+	static zcounters zero;
+
+	*c = zero;
+#endif
+}
+
+void
+zcount_reset(
+	void
+	)
+{
+#ifdef ZCOUNT
+	static zcounters zero;
+
+	zcount = zero;
+	zcount_start = zcount_clock();
+#endif
+}
+
 static void
 zhalt(
         char *c
@@ -1263,6 +2016,139 @@ zhalt(
 #endif
 }
 
+static long *
+zalloc_heap(
+	long n
+	)
+{
+	long *p;
+
+	if (zalloc_fn)
+	{
+		if ((p = (long *)(*zalloc_fn)((size_t)n * SIZEOFLONG)))
+			memset((void *)p, 0, (size_t)n * SIZEOFLONG);
+	}
+	else
+		p = (long *)calloc((size_t)n, (size_t)SIZEOFLONG);
+	if (!p)
+	{
+		fprintf(stderr,"%ld bytes calloc failed\n", n * SIZEOFLONG);
+		zhalt("allocation failed in zsetlength");
+	}
+	return (p);
+}
+
+static void
+zfree_heap(
+	long *p,
+	long n
+	)
+{
+	if (zfree_fn)
+		(*zfree_fn)((void *)p, (size_t)n * SIZEOFLONG);
+	else
+		free((void *)p);
+}
+
+static long *
+zarena_get(
+	zarena *a,
+	long n
+	)
+{
+	/* a block of 2^k >= n longs: its chunk, capacity | ZARENA_BIT, nits */
+	/* a chunk: next chunk, its length, its arena, blocks in use */
+	register long k = ARENA_MIN_CLASS;
+	register long sz;
+	long *p;
+	long *c;
+
+	while ((1L << k) < n)
+		k++;
+	sz = 1L << k;
+	if ((p = a->free[k]))
+	{
+		a->free[k] = (long *)p[2];
+		c = (long *)p[0];
+	}
+	else
+	{
+		if (sz > (ARENA_CHUNK >> 2) || a->end - a->next < sz)
+		{
+			long csz = (sz > (ARENA_CHUNK >> 2) ? sz : ARENA_CHUNK) + 4;
+
+			c = zalloc_heap(csz);
+			c[0] = (long)a->chunks;
+			c[1] = csz;
+			c[2] = (long)a;
+			a->chunks = (void *)c;
+			a->size += csz * SIZEOFLONG;
+			if (sz > (ARENA_CHUNK >> 2))
+				p = c + 4;
+			else
+			{
+				a->next = c + 4;
+				a->end = c + csz;
+			}
+		}
+		if (!p)
+		{
+			p = a->next;
+			a->next += sz;
+			c = a->end - (ARENA_CHUNK + 4);
+		}
+	}
+	memset((void *)p, 0, (size_t)sz * SIZEOFLONG);
+	p[0] = (long)c;
+	p[1] = (sz - 3) | ZARENA_BIT;
+	c[3]++;
+	if ((a->current += sz * SIZEOFLONG) > a->peak)
+		a->peak = a->current;
+	return (p);
+}
+
+static void
+zarena_put(
+	long *p
+	)
+{
+	long *c = (long *)p[0];
+	zarena *a = (zarena *)c[2];
+	register long sz = (p[1] & ~ZARENA_BIT) + 3;
+	register long k = ARENA_MIN_CLASS;
+
+	c[3]--;
+	if (!a)
+	{
+		/* left behind by zarena_free */
+		if (!c[3])
+			zfree_heap(c, c[1]);
+		return;
+	}
+	while ((1L << k) < sz)
+		k++;
+	p[2] = (long)a->free[k];
+	a->free[k] = p;
+	a->current -= sz * SIZEOFLONG;
+}
+
+static verylong
+znewlength(
+	long len
+	)
+{
+	long *p;
+
+	if (zarena_cur)
+	{
+		p = zarena_get(zarena_cur, len + 3);
+		return (p + 2);
+	}
+	p = zalloc_heap(len + 2);
+	p[0] = len;
+	return (p + 1);
+}
+
 void
 zsetlength(
 	verylong *v,
@@ -1272,8 +2158,37 @@ zsetlength(
 {
 	verylong x = *v;
 
-	if (x)
+	if (x && (x[-1] < 0 || (x[-1] & ZARENA_BIT)))
+	{
+		/* inline or arena: move to a new block and copy */
+		verylong y;
+		register long i;
+
+		if (len <= ZCAP(x))
+			return;
+		if (len < SIZE)
+			len = SIZE;
+		if (PRT_REALLOC)
+		{
+			fprintf(stderr,"%s moving with %ld\n", str, len);
+			fflush(stderr);
+		}
+		ZCOUNT_ADD(reallocs, 1);
+		ZCOUNT_ADD(bytes, (len + 2) * SIZEOFLONG);
+		if (x[-1] > 0 && ((long *)x[-2])[2])
+			y = zarena_get((zarena *)((long *)x[-2])[2], len + 3) + 2;
+		else
+			y = znewlength(len);
+		for (i = (x[0] < 0 ? -x[0] : x[0]); i >= 0; i--)
+			y[i] = x[i];
+		if (x[-1] > 0)
+			zarena_put(x - 2);
+		*v = y;
+	}
+	else if (x)
 	{
+		long *p;
+
 		if (len <= x[-1])
 			return;
 		if (PRT_REALLOC)
@@ -1281,12 +2196,22 @@ zsetlength(
 			fprintf(stderr,"%s reallocating to %ld\n", str, len);
 			fflush(stderr);
 		}
-		x[-1] = len;
-		if (!(x = (verylong)realloc((void*)(&(x[-1])), (size_t)(len + 2) * SIZEOFLONG)))
+		ZCOUNT_ADD(reallocs, 1);
+		ZCOUNT_ADD(bytes, (len + 2) * SIZEOFLONG);
+		if (zrealloc_fn)
+			p = (long *)(*zrealloc_fn)((void *)(&(x[-1])),
+				(size_t)(x[-1] + 2) * SIZEOFLONG,
+				(size_t)(len + 2) * SIZEOFLONG);
+		else
+			p = (long *)realloc((void *)(&(x[-1])), (size_t)(len + 2) * SIZEOFLONG);
+		if (!p)
 		{
-			fprintf(stderr,"%d bytes realloc failed\n", ((int)len + 2) * SIZEOFLONG);
+			fprintf(stderr,"%ld bytes realloc failed\n", (len + 2) * SIZEOFLONG);
 			zhalt("reallocation failed in zsetlength");
+			return;
 		}
+		p[0] = len;
+		*v = p + 1;
 	}
 	else if (len >= 0)
 	{
@@ -1297,19 +2222,15 @@ zsetlength(
 			fprintf(stderr,"%s allocating to %ld\n", str, len);
 			fflush(stderr);
 		}
-		if (!(x = (verylong)calloc((size_t)(len + 2), (size_t)SIZEOFLONG)))
-		{
-			fprintf(stderr,"%d bytes calloc failed\n", ((int)len + 2) * SIZEOFLONG);
-			zhalt("allocation failed in zsetlength");
-		}
-		x[0] = len;
-		x[1] = 1;
-		x[2] = 0;
+		ZCOUNT_ADD(allocs, 1);
+		ZCOUNT_ADD(bytes, (len + 2) * SIZEOFLONG);
+		x = znewlength(len);
+		x[0] = 1;
+		x[1] = 0;
+		*v = x;
 	}
 	else
 		zhalt("negative size allocation in zsetlength");
-	x++;
-	*v = x;
 }
 
 void
@@ -1319,12 +2240,108 @@ zfree(
 {
 	if (!(*x))
 		return;
+	if ((*x)[-1] >= 0)
+	{
+		/* not inline */
+		ZCOUNT_ADD(frees, 1);
+		if ((*x)[-1] & ZARENA_BIT)
+			zarena_put(*x - 2);
+		else
+			zfree_heap(*x - 1, (*x)[-1] + 2);
+	}
+	*x = 0;
+}
+
+verylong
+zinline(
+	long *buf,
+	long len
+	)
+{
+	if (len < 1)
+	{
+		zhalt("non-positive length in zinline");
+		return (0);
+	}
+	buf[0] = -len;
+	buf[1] = 1;
+	buf[2] = 0;
+	return (&buf[1]);
+}
+
+void
+zset_alloc(
+	void *(*alloc)(size_t),
+	void *(*ralloc)(void *, size_t, size_t),
+	void (*dealloc)(void *, size_t)
+	)
+{
+	if (alloc && ralloc && dealloc)
+	{
+		zalloc_fn = alloc;
+		zrealloc_fn = ralloc;
+		zfree_fn = dealloc;
+	}
+	else
+	{
+		zalloc_fn = 0;
+		zrealloc_fn = 0;
+		zfree_fn = 0;
+	}
+}
+
+void
+zarena_open(
+	zarena *a
+	)
+{
+	a->prev = zarena_cur;
+	zarena_cur = a;
+}
+
+void
+zarena_close(
+	zarena *a
+	)
+{
+	if (zarena_cur != a)
 	{
-		verylong y = (*x - 1);
-		free((void*)y);
-		*x = 0;
+		zhalt("not the last open arena in zarena_close");
 		return;
 	}
+	zarena_cur = a->prev;
+	a->prev = 0;
+}
+
+void
+zarena_free(
+	zarena *a
+	)
+{
+	register long i;
+	long *c;
+	zarena *o;
+
+	if (zarena_cur == a)
+		zarena_close(a);
+	for (o = zarena_cur; o; o = o->prev)
+		if (o == a)
+		{
+			zhalt("arena still open in zarena_free");
+			return;
+		}
+	while ((c = (long *)a->chunks))
+	{
+		a->chunks = (void *)c[0];
+		if (c[3])
+			c[2] = 0;
+		else
+			zfree_heap(c, c[1]);
+	}
+	a->next = a->end = 0;
+	for (i = 0; i < ZARENA_CLASSES; i++)
+		a->free[i] = 0;
+	a->current = a->peak = a->size = 0;
 }
 
 double 
@@ -1589,7 +2606,15 @@ zsbastoz(
 	)
 {
 	register long i;
+	STATIC verylong vb = 0;
 
+	if (base < -1 || base > 1)
+	{
+		zintoz(base, &vb);
+		zradix_join(row, len, base, vb, zradix_leaf(vb), n);
+		FREESPACE(vb);
+		return;
+	}
 	zintoz(row[len - 1], n);
 	for (i = len - 1; i--;)
 	{
@@ -1608,6 +2633,11 @@ zbastoz(
 {
 	register long i;
 
+	if (z2log(base) > 1)
+	{
+		zradix_vjoin(row, len, base, zradix_leaf(base), n);
+		return;
+	}
 	zcopy(row[len - 1], n);
 	for (i = len - 1; i--;)
 	{
@@ -1626,9 +2656,10 @@ zstobas(
 {
  /* return 1 if it fits, 0 otherwise */
  /* n >= 0, base > 1 */
-	register long i = 0;
+	register long i;
 	register long max = *len;
-	STATIC verylong q = 0;
+	long *r = row;
+	STATIC verylong vb = 0;
 	STATIC verylong nn = 0;
 
 	if (max < 1)
@@ -1641,22 +2672,27 @@ zstobas(
 	row[0] = 0;
 	zcopy(n, &nn);
 	zabs(&nn);
-	for (;;)
+	zintoz(base, &vb);
+	i = zradix_len(nn, vb);
+	if (i > max && !(r = (long *)malloc((size_t)(i * sizeof(long)))))
 	{
-		row[i] = zsdiv(nn, base, &q);
-		i++;
-		if ((q[1] == 0) && (q[0] == 1))
-		{
-			*len = i;
-			FREE2SPACE(q,nn);
-			return (1);
-		}
-		if (i == max) {
-			FREE2SPACE(q,nn);
-			return (0);
-		}
-		zswap(&q, &nn);
+		zhalt("allocation failure in zstobas");
+		return (0);
+	}
+	zradix_split(nn, base, vb, r, i, zradix_leaf(vb));
+	while (i > 1 && !r[i - 1])
+		i--;
+	if (r != row)
+	{
+		if (i <= max)
+			for (*len = i; i--;)
+				row[i] = r[i];
+		free((void *)r);
 	}
+	else
+		*len = i;
+	FREE2SPACE(vb,nn);
+	return (*len > 0);
 }
 
 long 
@@ -1718,38 +2754,49 @@ ztobas(
 {
  /* return 1 if it fits, 0 otherwise */
  /* n >= 0, base > 1 */
-	register long i = 0;
+	register long i;
+	register long j;
 	register long max = *len;
-	STATIC verylong q = 0;
+	long m;
+	verylong *r = row;
 	STATIC verylong nn = 0;
-	STATIC verylong lbase = 0;
 
 	if (max < 1)
 		return (0);
-	zcopy(base, &lbase);
-	zabs(&lbase);
 	if (zscompare(base, 1) <= 0)
 		return (0);
 	*len = 0;
 	zintoz(0, &(row[0]));
 	zcopy(n, &nn);
 	zabs(&nn);
-	for (;;)
+	m = i = zradix_len(nn, base);
+	if (i > max)
 	{
-		zdiv(nn, lbase, &q, &(row[i]));
-		i++;
-		if ((q[1] == 0) && (q[0] == 1))
+		if (!(r = (verylong *)calloc((size_t)i, sizeof(verylong))))
 		{
-			*len = i;
-			FREE2SPACE(q,nn); FREESPACE(lbase);
-			return (1);
-		}
-		if (i == max) {
-			FREE2SPACE(q,nn); FREESPACE(lbase);
+			zhalt("allocation failure in ztobas");
 			return (0);
 		}
-		zswap(&q, &nn);
 	}
+	zradix_vsplit(nn, base, r, i, zradix_leaf(base));
+	while (i > 1 && ziszero(r[i - 1]))
+		i--;
+	if (r != row)
+	{
+		if (i <= max)
+		{
+			*len = i;
+			for (j = 0; j < i; j++)
+				zswap(&row[j], &r[j]);
+		}
+		for (j = 0; j < m; j++)
+			zfree(&r[j]);
+		free((void *)r);
+	}
+	else
+		*len = i;
+	FREESPACE(nn);
+	return (*len > 0);
 }
 
 long 
@@ -2311,28 +3358,112 @@ zsmul(
 		b[0] = (-b[0]);
 }
 
+/*
+	Scratch space for the Karatsuba recursion. kar_mul and kar_sq do not
+	allocate: each level carves its 5 (or 3) locals of at most 2n+6 nits
+	out of mem, where n is the length of its longest operand, and passes
+	the rest of mem down. The operands one level down have at most
+	((n+1)>>1)+4 nits, so kar_space(n, sq) longs are enough for the
+	whole recursion on operands of at most n nits. kar_mul_top and
+	kar_sq_top grow the arena *s once, before the recursion starts.
+*/
+
+static long
+kar_space(
+	long n,
+	long sq
+	)
+{
+	register long s = 0;
+	register long depth;
+
+	for (depth = 0; depth < KAR_DEPTH; depth++)
+	{
+		if (n < (sq ? KAR_SQU_CROV : KAR_MUL_CROV))
+			break;
+		s += (sq ? 3 : 5) * (2 * n + 8);
+		n = ((n + 1) >> 1) + 4;
+	}
+	return (s);
+}
+
+static verylong
+kar_slots(
+	verylong mem,
+	long n,
+	long k,
+	verylong *t
+	)
+{
+	for (; k; k--)
+	{
+		mem[0] = 2 * n + 6;
+		*t = mem + 1;
+		(*t)[0] = 1;
+		(*t++)[1] = 0;
+		mem += 2 * n + 8;
+	}
+	return (mem);
+}
+
+static void
+kar_mul_top(
+	verylong a,
+	verylong b,
+	verylong *c,
+	verylong *s
+	)
+{	/* a[0] >= b[0] >= 0, squares if a == b */
+	if (a == b)
+	{	/* kar_mul truncates a[0] and b[0] in place */
+		kar_sq_top(a, c, s);
+		return;
+	}
+	zsetlength(s, kar_space(a[0], (long) 0), "in kar_mul, scratch space");
+	zsetlength(c, a[0] + b[0] + 1, "in kar_mul, third argument");
+	kar_mul(a, b, c, *s, (long) 0);
+}
+
+static void
+kar_sq_top(
+	verylong a,
+	verylong *c,
+	verylong *s
+	)
+{	/* a >= 0 */
+	zsetlength(s, kar_space(a[0], (long) 1), "in kar_sq, scratch space");
+	zsetlength(c, (a[0] << 1) + 1, "in kar_sq, second argument");
+	kar_sq(a, c, *s, (long) 0);
+}
+
 static void
 kar_mul(
 	verylong a,
 	verylong b,
 	verylong *c,
-	long shi
+	verylong mem,
+	long depth
 	)
-{
+{	/* a[0] >= b[0] >= 0, scratch from mem, see kar_space */
 	register long al;
 	register long hal;
 	register long i;
 	register long restoreb0 = b[0];
 	register verylong pc;
 	register long bbig = 1;
-	verylong *a0;
-	verylong *a1;
-	verylong *a2;
-	verylong *a3;
-	verylong *a4;
-
+	verylong t[5];
+	verylong *a0 = &t[0];
+	verylong *a1 = &t[1];
+	verylong *a2 = &t[2];
+	verylong *a3 = &t[3];
+	verylong *a4 = &t[4];
+
+#ifdef ZCOUNT
+	if (depth > zcount.kar_depth)
+		zcount.kar_depth = depth;
+#endif
 	zsetlength(c, (hal = (al = a[0]) + (i = b[0])), "in kar_mul, third argument");
-	if ((shi >= (5 * KAR_DEPTH)) || (al < KAR_MUL_CROV) || (i < KAR_MUL_CROV))
+	if ((depth >= KAR_DEPTH) || (al < KAR_MUL_CROV) || (i < KAR_MUL_CROV))
 	{
 		pc = &(*c)[1];
 		for (i = hal; i > 0; i--)
@@ -2353,17 +3484,8 @@ kar_mul(
 		(*c)[0] = hal;
 		return;
 	}
-	a0 = &(kar_mem[shi]);
-	a1 = &(kar_mem[shi + 1]);
-	a2 = &(kar_mem[shi + 2]);
-	a3 = &(kar_mem[shi + 3]);
-	a4 = &(kar_mem[shi + 4]);
+	mem = kar_slots(mem, (al > i ? al : i), 5, t);
 	hal = ((al + 1) >> 1);
-	zsetlength(a0, al, "in kar_mul, locals\n");
-	zsetlength(a1, al, "");
-	zsetlength(a2, al, "");
-	zsetlength(a3, al + hal, "");
-	zsetlength(a4, al + 2, "");
 	i = hal;
 	while ((i > 1) && (!(a[i])))
 		i--;
@@ -2386,18 +3508,18 @@ kar_mul(
 			(*a3)[i - hal] = b[i];
 		(*a3)[0] = restoreb0 - hal;
 	}
-	kar_mul(a, b, a4, shi + 5);
+	kar_mul(a, b, a4, mem, depth + 1);
 	zadd(a, (*a1), a0);
 	a[0] = al;
 	if (bbig)
 	{
-		kar_mul((*a1), (*a3), c, shi + 5);
+		kar_mul((*a1), (*a3), c, mem, depth + 1);
 		zadd(b, (*a3), a2);
 		b[0] = restoreb0;
-		kar_mul((*a0), (*a2), a3, shi + 5);
+		kar_mul((*a0), (*a2), a3, mem, depth + 1);
 	}
 	else
-		kar_mul((*a0), b, a3, shi + 5);
+		kar_mul((*a0), b, a3, mem, depth + 1);
 	zsubpos((*a3), (*a4), a3);
 	if (bbig)
 		zsubpos((*a3), *c, a3);
@@ -2427,27 +3549,42 @@ zmul(
 	verylong b,
 	verylong *c
 	)
+{	/* output not input */
+	zmul_r(a, b, c, &kar_scratch);
+}
+
+void
+zmul_r(
+	verylong a,
+	verylong b,
+	verylong *c,
+	verylong *s
+	)
 {	/* output not input */
 	register long aneg;
 	register long bneg;
 	verylong olda;
 	verylong oldb;
+	ZCOUNT_IN(mul, ZCOUNT_LEN(a) + ZCOUNT_LEN(b));
 
 	if (ALLOCATE && (!a || !b))
 	{
 		zzero(c);
+		ZCOUNT_OUT(mul);
 		return;
 	}
 	if (a == b)
 	{
-		zsq(a, c);
+		zsq_r(a, c, s);
+		ZCOUNT_OUT(mul);
 		return;
 	}
-	if (!kar_mem_initialized)
+	if ((a[0] >= TOOM3_MUL_CROV || a[0] <= -TOOM3_MUL_CROV)
+		&& (b[0] >= TOOM3_MUL_CROV || b[0] <= -TOOM3_MUL_CROV))
 	{
-		kar_mem_initialized = 1;
-		for (aneg = (5 * KAR_DEPTH) - 1; aneg >= 0; aneg--)
-			kar_mem[aneg] = (verylong) 0;
+		toom_mul(a, b, c, s);
+		ZCOUNT_OUT(mul);
+		return;
 	}
 	olda = a;
 	oldb = b;
@@ -2456,34 +3593,41 @@ zmul(
 	if (bneg = (*b < 0))
 		b[0] = -b[0];
 	if (*a > *b)
-		kar_mul(a, b, c, (long) 0);
+		kar_mul_top(a, b, c, s);
 	else
-		kar_mul(b, a, c, (long) 0);
+		kar_mul_top(b, a, c, s);
 	if (aneg != bneg && ((*c)[1] || (*c)[0] != 1))
 		(*c)[0] = -(*c)[0];
 	if (aneg)
 		olda[0] = -olda[0];
 	if (bneg)
 		oldb[0] = -oldb[0];
+	ZCOUNT_OUT(mul);
 }
 
 static void
 kar_sq(
 	verylong a,
 	verylong *c,
-	long shi
+	verylong mem,
+	long depth
 	)
-{
+{	/* a >= 0, scratch from mem, see kar_space */
 	register long al;
 	register long hal;
 	register long i;
 	register verylong pc;
-	verylong *a0;
-	verylong *a1;
-	verylong *a2;
-
+	verylong t[3];
+	verylong *a0 = &t[0];
+	verylong *a1 = &t[1];
+	verylong *a2 = &t[2];
+
+#ifdef ZCOUNT
+	if (depth > zcount.kar_depth)
+		zcount.kar_depth = depth;
+#endif
 	zsetlength(c, (i = ((al = a[0]) << 1)), "in kar_sq, second argument");
-	if ((shi >= (3 * KAR_DEPTH)) || (al < KAR_SQU_CROV))
+	if ((depth >= KAR_DEPTH) || (al < KAR_SQU_CROV))
 	{
 		register unsigned long uncar;
 		long carry = 0;
@@ -2511,13 +3655,8 @@ kar_sq(
 		(*c)[0] = i;
 		return;
 	}
-	a0 = &(kar_mem[shi]);
-	a1 = &(kar_mem[shi + 1]);
-	a2 = &(kar_mem[shi + 2]);
+	mem = kar_slots(mem, al, 3, t);
 	hal = ((al + 1) >> 1);
-	zsetlength(a0, al + hal + 2, "in kar_sq, locals\n");
-	zsetlength(a1, al + 2, "");
-	zsetlength(a2, al, "");
 	i = hal;
 	while ((i > 1) && (!(a[i])))
 		i--;
@@ -2525,11 +3664,11 @@ kar_sq(
 	for (i = hal + 1; i <= al; i++)
 		(*a0)[i - hal] = a[i];
 	(*a0)[0] = al - hal;
-	kar_sq(a, a1, shi + 3);
+	kar_sq(a, a1, mem, depth + 1);
 	zadd(a, (*a0), a2);
-	kar_sq((*a0), c, shi + 3);
+	kar_sq((*a0), c, mem, depth + 1);
 	a[0] = al;
-	kar_sq((*a2), a0, shi + 3);
+	kar_sq((*a2), a0, mem, depth + 1);
 	zsubpos((*a0), (*a1), a0);
 	zsubpos((*a0), *c, a0);
 	zlshift((*a0), hal * NBITS, a0);
@@ -2549,27 +3688,651 @@ zsq(
 	verylong a,
 	verylong *c
 	)
+{	/* output is not input */
+	zsq_r(a, c, &kar_scratch);
+}
+
+void
+zsq_r(
+	verylong a,
+	verylong *c,
+	verylong *s
+	)
 {	/* output is not input */
 	register long aneg;
+	ZCOUNT_IN(sq, ZCOUNT_LEN(a));
 
 	if (ALLOCATE && !a)
 	{
 		zzero(c);
+		ZCOUNT_OUT(sq);
+		return;
+	}
+	if (a[0] >= TOOM3_SQU_CROV || a[0] <= -TOOM3_SQU_CROV)
+	{
+		toom_mul(a, a, c, s);
+		ZCOUNT_OUT(sq);
 		return;
 	}
-        if (!kar_mem_initialized)
-        {
-                kar_mem_initialized = 1;
-                for (aneg = (5 * KAR_DEPTH) - 1; aneg >= 0; aneg--)
-                        kar_mem[aneg] = (verylong) 0;
-        }
 	if (aneg = (*a < 0))
 		a[0] = -a[0];
-	kar_sq(a, c, (long) 0);
+	kar_sq_top(a, c, s);
 	if (aneg)
 		a[0] = -a[0];
+	ZCOUNT_OUT(sq);
+}
+
+/*
+	Toom-Cook multiplication and squaring, used by zmul and zsq for
+	operands of at least TOOM3_MUL_CROV (TOOM3_SQU_CROV) nits. Below
+	that the Karatsuba routines take over. The locals are allocated in
+	each call and freed before returning; the Karatsuba leaves share the
+	scratch space *s.
+*/
+
+static void
+toom_piece(
+	verylong a,
+	long i,
+	long k,
+	verylong *p
+	)
+{	/* *p = nits i*k+1 .. i*k+k of a, a >= 0 */
+	register long j;
+	register long lo = i * k;
+	register verylong pp;
+	register verylong pa;
+
+	if (lo >= a[0])
+	{
+		zzero(p);
+		return;
+	}
+	if ((j = a[0] - lo) > k)
+		j = k;
+	zsetlength(p, j, "in toom_piece, fourth argument");
+	pp = &((*p)[1]);
+	pa = &(a[lo + 1]);
+	for (i = j; i; i--)
+		*pp++ = *pa++;
+	while ((j > 1) && (!((*p)[j])))
+		j--;
+	(*p)[0] = j;
+}
+
+static void
+toom_addin(
+	verylong a,
+	long k,
+	verylong c
+	)
+{	/* c += a * RADIX^k, a >= 0, c long enough and nonnegative */
+	register long i;
+	register long carry = 0;
+	register verylong pa = &(a[1]);
+	register verylong pc = &(c[k + 1]);
+
+	if ((!a[1]) && (a[0] == 1))
+		return;
+	for (i = a[0]; i; i--)
+	{
+		*pc += *pa++ + carry;
+		carry = (*pc >> NBITS);
+		*pc++ &= RADIXM;
+	}
+	while (carry)
+	{
+		*pc += carry;
+		carry = (*pc >> NBITS);
+		*pc++ &= RADIXM;
+	}
+}
+
+static void
+toom_mul(
+	verylong a,
+	verylong b,
+	verylong *c,
+	verylong *s
+	)
+{	/* squares if a == b, output not input */
+	register long aneg;
+	register long bneg = 0;
+	register long i;
+	register long sc;
+	verylong olda = a;
+	verylong oldb = b;
+
+	if ((aneg = (*a < 0)))
+		a[0] = -a[0];
+	if (a == b)
+	{
+#ifdef ALPHA_OR_ALPHA50
+		if (*a >= NTT_SQU_CROV && (*a << 1) < NTT_MAXLEN)
+			ntt_mul(a, a, c);
+		else
+#endif
+		if (*a >= TOOM4_SQU_CROV)
+			toom4_mul(a, a, c, s);
+		else if (*a >= TOOM3_SQU_CROV)
+			toom3_mul(a, a, c, s);
+		else
+			kar_sq_top(a, c, s);
+		if (aneg)
+			a[0] = -a[0];
+		return;
+	}
+	if ((bneg = (*b < 0)))
+		b[0] = -b[0];
+	if (*a < *b)
+	{
+		a = oldb;
+		b = olda;
+	}
+	if (*b < TOOM3_MUL_CROV)
+		kar_mul_top(a, b, c, s);
+#ifdef ALPHA_OR_ALPHA50
+	else if (*b >= NTT_MUL_CROV && *a + *b < NTT_MAXLEN)
+		ntt_mul(a, b, c);
+#endif
+	else if (*a > (*b << 1))
+	{
+		verylong ai = 0;
+		verylong ci = 0;
+
+		/* unbalanced, cut a in pieces the size of b */
+		zsetlength(c, (sc = *a + *b), "in toom_mul, third argument");
+		for (i = sc; i; i--)
+			(*c)[i] = 0;
+		for (i = 0; i * (*b) < *a; i++)
+		{
+			toom_piece(a, i, *b, &ai);
+			toom_mul(ai, b, &ci, s);
+			toom_addin(ci, i * (*b), *c);
+		}
+		while ((sc > 1) && (!((*c)[sc])))
+			sc--;
+		(*c)[0] = sc;
+		zfree(&ai);
+		zfree(&ci);
+	}
+	else if (*b >= TOOM4_MUL_CROV)
+		toom4_mul(a, b, c, s);
+	else
+		toom3_mul(a, b, c, s);
+	if (aneg != bneg && ((*c)[1] || (*c)[0] != 1))
+		(*c)[0] = -(*c)[0];
+	if (aneg)
+		olda[0] = -olda[0];
+	if (bneg)
+		oldb[0] = -oldb[0];
+}
+
+static void
+toom3_mul(
+	verylong a,
+	verylong b,
+	verylong *c,
+	verylong *s
+	)
+{	/* a >= 0, b >= 0, a[0] >= b[0], squares if a == b */
+	/* evaluates in 0, 1, -1, -2 and infinity */
+	register long k = (a[0] + 2) / 3;
+	register long i;
+	long sc = a[0] + b[0];
+	verylong a0 = 0;
+	verylong a1 = 0;
+	verylong a2 = 0;
+	verylong b0 = 0;
+	verylong b1 = 0;
+	verylong b2 = 0;
+	verylong p1 = 0;
+	verylong pm1 = 0;
+	verylong pm2 = 0;
+	verylong q1 = 0;
+	verylong qm1 = 0;
+	verylong qm2 = 0;
+	verylong r0 = 0;
+	verylong r1 = 0;
+	verylong rm1 = 0;
+	verylong rm2 = 0;
+	verylong rinf = 0;
+
+	toom_piece(a, 0, k, &a0);
+	toom_piece(a, 1, k, &a1);
+	toom_piece(a, 2, k, &a2);
+	zadd(a0, a2, &r0);
+	zadd(r0, a1, &p1);
+	zsub(r0, a1, &pm1);
+	zadd(pm1, a2, &pm2);
+	z2mul(pm2, &pm2);
+	zsub(pm2, a0, &pm2);
+	if (a == b)
+	{
+		toom_mul(a0, a0, &r0, s);
+		toom_mul(p1, p1, &r1, s);
+		toom_mul(pm1, pm1, &rm1, s);
+		toom_mul(pm2, pm2, &rm2, s);
+		toom_mul(a2, a2, &rinf, s);
+	}
+	else
+	{
+		toom_piece(b, 0, k, &b0);
+		toom_piece(b, 1, k, &b1);
+		toom_piece(b, 2, k, &b2);
+		zadd(b0, b2, &r0);
+		zadd(r0, b1, &q1);
+		zsub(r0, b1, &qm1);
+		zadd(qm1, b2, &qm2);
+		z2mul(qm2, &qm2);
+		zsub(qm2, b0, &qm2);
+		toom_mul(a0, b0, &r0, s);
+		toom_mul(p1, q1, &r1, s);
+		toom_mul(pm1, qm1, &rm1, s);
+		toom_mul(pm2, qm2, &rm2, s);
+		toom_mul(a2, b2, &rinf, s);
+	}
+	/* interpolation, all divisions are exact */
+	zsub(rm2, r1, &rm2);
+	zsdiv(rm2, (long) 3, &rm2);
+	zsub(r1, rm1, &r1);
+	z2div(r1, &r1);
+	zsub(rm1, r0, &rm1);
+	zsub(rm1, rm2, &rm2);
+	z2div(rm2, &rm2);
+	zadd(rm2, rinf, &rm2);
+	zadd(rm2, rinf, &rm2);
+	zadd(rm1, r1, &rm1);
+	zsub(rm1, rinf, &rm1);
+	zsub(r1, rm2, &r1);
+	/* c = r0 + r1 X + rm1 X^2 + rm2 X^3 + rinf X^4, X = RADIX^k */
+	zsetlength(c, sc + 1, "in toom3_mul, third argument");
+	for (i = sc + 1; i; i--)
+		(*c)[i] = 0;
+	toom_addin(r0, 0, *c);
+	toom_addin(r1, k, *c);
+	toom_addin(rm1, 2 * k, *c);
+	toom_addin(rm2, 3 * k, *c);
+	toom_addin(rinf, 4 * k, *c);
+	while ((sc > 1) && (!((*c)[sc])))
+		sc--;
+	(*c)[0] = sc;
+	zfree(&a0);
+	zfree(&a1);
+	zfree(&a2);
+	zfree(&b0);
+	zfree(&b1);
+	zfree(&b2);
+	zfree(&p1);
+	zfree(&pm1);
+	zfree(&pm2);
+	zfree(&q1);
+	zfree(&qm1);
+	zfree(&qm2);
+	zfree(&r0);
+	zfree(&r1);
+	zfree(&rm1);
+	zfree(&rm2);
+	zfree(&rinf);
+}
+
+static void
+toom4_mul(
+	verylong a,
+	verylong b,
+	verylong *c,
+	verylong *s
+	)
+{	/* a >= 0, b >= 0, a[0] >= b[0], squares if a == b */
+	/* evaluates in 0, 1, -1, 2, -2, 1/2 and infinity */
+	register long k = (a[0] + 3) / 4;
+	register long i;
+	long sc = a[0] + b[0];
+	verylong x[4];
+	verylong y[4];
+	verylong p[5];
+	verylong q[5];
+	verylong r[7];
+	verylong t = 0;
+	verylong u = 0;
+
+	for (i = 0; i < 4; i++)
+		x[i] = y[i] = 0;
+	for (i = 0; i < 5; i++)
+		p[i] = q[i] = 0;
+	for (i = 0; i < 7; i++)
+		r[i] = 0;
+	for (i = 0; i < 4; i++)
+		toom_piece(a, i, k, &x[i]);
+	if (a != b)
+		for (i = 0; i < 4; i++)
+			toom_piece(b, i, k, &y[i]);
+	/* p[0..4] = values in 1, -1, 2, -2, and 8 times the value in 1/2 */
+	for (i = (a == b ? 1 : 0); i < 2; i++)
+	{
+		register verylong *e = (i ? x : y);
+		register verylong *d = (i ? p : q);
+
+		zadd(e[0], e[2], &t);
+		zadd(e[1], e[3], &u);
+		zadd(t, u, &d[0]);
+		zsub(t, u, &d[1]);
+		zlshift(e[2], (long) 2, &t);
+		zadd(t, e[0], &t);
+		zlshift(e[3], (long) 2, &u);
+		zadd(u, e[1], &u);
+		z2mul(u, &u);
+		zadd(t, u, &d[2]);
+		zsub(t, u, &d[3]);
+		z2mul(e[0], &t);
+		zadd(t, e[1], &t);
+		z2mul(t, &t);
+		zadd(t, e[2], &t);
+		z2mul(t, &t);
+		zadd(t, e[3], &d[4]);
+	}
+	if (a == b)
+	{
+		toom_mul(x[0], x[0], &r[0], s);
+		for (i = 0; i < 5; i++)
+			toom_mul(p[i], p[i], &r[i + 1], s);
+		toom_mul(x[3], x[3], &r[6], s);
+	}
+	else
+	{
+		toom_mul(x[0], y[0], &r[0], s);
+		for (i = 0; i < 5; i++)
+			toom_mul(p[i], q[i], &r[i + 1], s);
+		toom_mul(x[3], y[3], &r[6], s);
+	}
+	/*
+	 * interpolation, all divisions are exact; on entry r[1..5] hold the
+	 * products in 1, -1, 2, -2 and 64 times the one in 1/2, on exit
+	 * r[i] is the coefficient of X^i
+	 */
+	zadd(r[1], r[2], &t);
+	z2div(t, &t);
+	zsub(t, r[0], &t);
+	zsub(t, r[6], &t);		/* t = c2 + c4 */
+	zsub(r[1], r[2], &r[1]);
+	z2div(r[1], &r[1]);		/* r1 = c1 + c3 + c5 */
+	zadd(r[3], r[4], &u);
+	z2div(u, &u);
+	zsub(u, r[0], &u);
+	zlshift(r[6], (long) 6, &r[2]);
+	zsub(u, r[2], &u);
+	zrshift(u, (long) 2, &u);	/* u = c2 + 4 c4 */
+	zsub(r[3], r[4], &r[3]);
+	zrshift(r[3], (long) 2, &r[3]);	/* r3 = c1 + 4 c3 + 16 c5 */
+	zsub(u, t, &r[4]);
+	zsdiv(r[4], (long) 3, &r[4]);	/* r4 = c4 */
+	zsub(t, r[4], &r[2]);		/* r2 = c2 */
+	zlshift(r[0], (long) 6, &t);
+	zsub(r[5], t, &r[5]);
+	zlshift(r[2], (long) 4, &t);
+	zsub(r[5], t, &r[5]);
+	zlshift(r[4], (long) 2, &t);
+	zsub(r[5], t, &r[5]);
+	zsub(r[5], r[6], &r[5]);
+	z2div(r[5], &r[5]);		/* r5 = 16 c1 + 4 c3 + c5 */
+	zsub(r[3], r[1], &r[3]);
+	zsdiv(r[3], (long) 3, &r[3]);	/* r3 = c3 + 5 c5 */
+	zlshift(r[1], (long) 4, &t);
+	zsub(t, r[5], &t);
+	zsdiv(t, (long) 3, &t);		/* t = 4 c3 + 5 c5 */
+	zsub(t, r[3], &t);
+	zsdiv(t, (long) 3, &t);		/* t = c3 */
+	zsub(r[3], t, &r[5]);
+	zsdiv(r[5], (long) 5, &r[5]);	/* r5 = c5 */
+	zsub(r[1], t, &r[1]);
+	zsub(r[1], r[5], &r[1]);	/* r1 = c1 */
+	zcopy(t, &r[3]);
+	zsetlength(c, sc + 1, "in toom4_mul, third argument");
+	for (i = sc + 1; i; i--)
+		(*c)[i] = 0;
+	for (i = 0; i < 7; i++)
+		toom_addin(r[i], i * k, *c);
+	while ((sc > 1) && (!((*c)[sc])))
+		sc--;
+	(*c)[0] = sc;
+	for (i = 0; i < 4; i++)
+	{
+		zfree(&x[i]);
+		zfree(&y[i]);
+	}
+	for (i = 0; i < 5; i++)
+	{
+		zfree(&p[i]);
+		zfree(&q[i]);
+	}
+	for (i = 0; i < 7; i++)
+		zfree(&r[i]);
+	zfree(&t);
+	zfree(&u);
+}
+
+#ifdef ALPHA_OR_ALPHA50
+/*
+	Number theoretic transform multiplication, for 64-bit longs only.
+	The operands are cut in half nits of NBITS/2 bits, their cyclic
+	convolution is computed modulo three primes p < 2^32 with
+	2^25 | p-1, and the coefficients (less than 2^94) are recovered
+	with the Chinese remainder theorem and carried into the result.
+	Products must have less than NTT_MAXLEN nits.
+*/
+
+static unsigned long ntt_prime[3] = {3221225473UL, 2113929217UL, 2013265921UL};
+static unsigned long ntt_gen[3] = {5, 5, 31};
+
+/* r = a*b mod p for a, b < p < 2^32, pinv = 1/p; as in zmulmods */
+#define ntt_mulmod(_a,_b,_p,_pinv,_r) \
+{ register unsigned long _q = (unsigned long)((double)(_a)*(double)(_b)*(_pinv)); \
+  register long _x = (long)((_a)*(_b) - _q*(_p)); \
+  if (_x < 0) _x += (_p); else if (_x >= (long)(_p)) _x -= (_p); \
+  _r = (unsigned long)_x; }
+
+static unsigned long
+ntt_powmod(
+	unsigned long a,
+	unsigned long e,
+	unsigned long p
+	)
+{
+	register unsigned long r = 1;
+	register double pinv = 1.0 / p;
+
+	for (; e; e >>= 1)
+	{
+		if (e & 1)
+			ntt_mulmod(r, a, p, pinv, r);
+		ntt_mulmod(a, a, p, pinv, a);
+	}
+	return (r);
+}
+
+static void
+ntt_transform(
+	unsigned long *x,
+	long n,
+	unsigned long *w,
+	unsigned long p,
+	long inverse
+	)
+{	/* forward: natural to bit reversed order, inverse: the other way */
+	register long i;
+	register long j;
+	register long len;
+	register long st;
+	register unsigned long u;
+	register unsigned long v;
+	register double pinv = 1.0 / p;
+
+	if (!inverse)
+	{
+		for (len = n >> 1, st = 1; len; len >>= 1, st <<= 1)
+			for (j = 0; j < n; j += (len << 1))
+				for (i = 0; i < len; i++)
+				{
+					u = x[j + i];
+					v = x[j + i + len];
+					x[j + i] = (u + v >= p ? u + v - p : u + v);
+					u = (u >= v ? u - v : u + p - v);
+					ntt_mulmod(u, w[i * st], p, pinv, x[j + i + len]);
+				}
+	}
+	else
+	{
+		for (len = 1, st = n >> 1; len < n; len <<= 1, st >>= 1)
+			for (j = 0; j < n; j += (len << 1))
+				for (i = 0; i < len; i++)
+				{
+					u = x[j + i];
+					ntt_mulmod(x[j + i + len], w[i * st], p, pinv, v);
+					x[j + i] = (u + v >= p ? u + v - p : u + v);
+					x[j + i + len] = (u >= v ? u - v : u + p - v);
+				}
+	}
+}
+
+static void
+ntt_mul(
+	verylong a,
+	verylong b,
+	verylong *c
+	)
+{	/* a >= 0, b >= 0, a[0] + b[0] < NTT_MAXLEN, squares if a == b */
+	register long i;
+	register long k;
+	long n;
+	long lg;
+	long sc = a[0] + b[0];
+	unsigned long *fa;
+	unsigned long *fb;
+	unsigned long *w;
+	unsigned long *x;
+	unsigned long *y;
+	unsigned long p;
+	unsigned long root;
+	unsigned long inv12;
+	unsigned long inv13;
+	unsigned long inv23;
+	unsigned long v1;
+	unsigned long v2;
+	unsigned long v3;
+	unsigned long d0;
+	unsigned long d1;
+	unsigned long d2;
+	unsigned long c0 = 0;
+	unsigned long c1 = 0;
+	unsigned long c2 = 0;
+	double pinv;
+
+	for (n = 1, lg = 0; n < ((sc << 1) - 1); n <<= 1, lg++)
+		;
+	fa = (unsigned long *) malloc(3 * n * sizeof(unsigned long));
+	fb = (a == b ? fa : (unsigned long *) malloc(3 * n * sizeof(unsigned long)));
+	w = (unsigned long *) malloc(((n >> 1) + 1) * sizeof(unsigned long));
+	if (!fa || !fb || !w)
+	{
+		free(fa);
+		if (fb != fa)
+			free(fb);
+		free(w);
+		zhalt("allocation failed in ntt_mul");
+		return;
+	}
+	for (k = 0; k < 3; k++)
+	{
+		p = ntt_prime[k];
+		pinv = 1.0 / p;
+		x = fa + k * n;
+		for (i = 1; i <= a[0]; i++)
+		{
+			x[(i << 1) - 2] = (a[i] & NTT_HMASK) % p;
+			x[(i << 1) - 1] = (a[i] >> NTT_HBITS) % p;
+		}
+		for (i = a[0] << 1; i < n; i++)
+			x[i] = 0;
+		root = ntt_powmod(ntt_gen[k], (p - 1) >> lg, p);
+		w[0] = 1;
+		for (i = 1; i < (n >> 1); i++)
+			ntt_mulmod(w[i - 1], root, p, pinv, w[i]);
+		ntt_transform(x, n, w, p, 0);
+		if (a == b)
+			y = x;
+		else
+		{
+			y = fb + k * n;
+			for (i = 1; i <= b[0]; i++)
+			{
+				y[(i << 1) - 2] = (b[i] & NTT_HMASK) % p;
+				y[(i << 1) - 1] = (b[i] >> NTT_HBITS) % p;
+			}
+			for (i = b[0] << 1; i < n; i++)
+				y[i] = 0;
+			ntt_transform(y, n, w, p, 0);
+		}
+		v1 = ntt_powmod((unsigned long) n, p - 2, p);
+		for (i = 0; i < n; i++)
+		{
+			ntt_mulmod(x[i], y[i], p, pinv, v2);
+			ntt_mulmod(v2, v1, p, pinv, x[i]);
+		}
+		root = ntt_powmod(root, p - 2, p);
+		for (i = 1; i < (n >> 1); i++)
+			ntt_mulmod(w[i - 1], root, p, pinv, w[i]);
+		ntt_transform(x, n, w, p, 1);
+	}
+	inv12 = ntt_powmod(ntt_prime[0] % ntt_prime[1], ntt_prime[1] - 2, ntt_prime[1]);
+	inv13 = ntt_powmod(ntt_prime[0] % ntt_prime[2], ntt_prime[2] - 2, ntt_prime[2]);
+	inv23 = ntt_powmod(ntt_prime[1] % ntt_prime[2], ntt_prime[2] - 2, ntt_prime[2]);
+	zsetlength(c, sc, "in ntt_mul, third argument");
+	for (i = 0; i < (sc << 1); i++)
+	{
+		if (i < n)
+		{
+			/* coefficient = v1 + p1 (v2 + p2 v3) = d0 + d1 R + d2 R^2 */
+			v1 = fa[i];
+			p = ntt_prime[1];
+			v2 = fa[n + i] + p - v1 % p;
+			ntt_mulmod(v2 % p, inv12, p, 1.0 / p, v2);
+			p = ntt_prime[2];
+			pinv = 1.0 / p;
+			v3 = fa[2 * n + i] + p - v1 % p;
+			ntt_mulmod(v3 % p, inv13, p, pinv, v3);
+			v3 = v3 + p - v2 % p;
+			ntt_mulmod(v3 % p, inv23, p, pinv, v3);
+			v3 = v2 + ntt_prime[1] * v3;
+			d0 = ntt_prime[0] * (v3 & NTT_HMASK) + v1;
+			d1 = (d0 >> NTT_HBITS) + ntt_prime[0] * (v3 >> NTT_HBITS);
+			d0 &= NTT_HMASK;
+			d2 = d1 >> NTT_HBITS;
+			d1 &= NTT_HMASK;
+		}
+		else
+			d0 = d1 = d2 = 0;
+		c0 += d0;
+		c1 += d1 + (c0 >> NTT_HBITS);
+		c2 += d2 + (c1 >> NTT_HBITS);
+		if (i & 1)
+			(*c)[(i >> 1) + 1] |= (c0 & NTT_HMASK) << NTT_HBITS;
+		else
+			(*c)[(i >> 1) + 1] = c0 & NTT_HMASK;
+		c0 = c1 & NTT_HMASK;
+		c1 = (c2 & NTT_HMASK);
+		c2 >>= NTT_HBITS;
+	}
+	while ((sc > 1) && (!((*c)[sc])))
+		sc--;
+	(*c)[0] = sc;
+	free(fa);
+	if (fb != fa)
+		free(fb);
+	free(w);
 }
 
+#endif
+
 void
 zmul_plain(
 	verylong a,
@@ -2734,6 +4497,15 @@ zsdiv(
 		zhalt("division by zero in zsdiv");
 		return (0);
 	}
+#ifdef ZSRECIP_MG
+	if (d > 0 && d < RADIX && (a[0] >= SDIV_CROV || a[0] <= -SDIV_CROV))
+	{
+		zsrecip m;
+
+		zsrecip_init(&m, d);
+		return (zsdiv_recip(&m, a, bb));
+	}
+#endif
 	if ((sa = a[0]) < 0)
 		sa = (-sa);
 	zsetlength(&b, sa, "in zsdiv, third argument");
@@ -2741,8 +4513,8 @@ zsdiv(
 	*bb = b;
 	if ((d >= RADIX) || (d <= -RADIX))
 	{
-		STATIC verylong zd = 0;
-		STATIC verylong zb = 0;
+		STATIC_INLINE(zd);
+		STATIC_INLINE(zb);
 		zintoz(d, &zb);
 		zdiv(a, zb, &b, &zd);
 		*bb = b;
@@ -2803,15 +4575,257 @@ zsmod(
 	long b
 	)
 {
-	STATIC verylong q = 0;
+	STATIC_INLINE(q);
 	long y;
 
+#ifdef ZSRECIP_MG
+	if (b > 0 && b < RADIX && (!ALLOCATE || a)
+		&& (a[0] >= SDIV_CROV || a[0] <= -SDIV_CROV))
+	{
+		zsrecip m;
+
+		zsrecip_init(&m, b);
+		return (zsmod_recip(&m, a));
+	}
+#endif
+#ifndef ALPHA50
+	if (b < RADIX && b > -RADIX && b && (!ALLOCATE || a))
+	{	/* as zsdiv, without storing the quotient */
+		register long den = (b < 0 ? -b : b);
+		register double deninv = (double)1/den;
+		register long i;
+		long qd;
+
+		y = 0;
+		for (i = (a[0] < 0 ? -a[0] : a[0]); i; i--)
+		{
+			zdiv21(y, a[i], den, deninv, qd);
+		}
+		(void) qd;	/* only the remainder y is kept */
+		if (y && (a[0] < 0) != (b < 0))
+			y = (b < 0 ? y - den : den - y);
+		else if (a[0] < 0 && b < 0)
+			y = -y;
+		return (y);
+	}
+#endif
 	y= zsdiv(a, b, &q);
 	FREESPACE(q);
 	return y;
 }
 
 
+/*
+	Division by one nit with a precomputed reciprocal (Moller and
+	Granlund, Improved division by invariant integers, 2011). The
+	divisor d is shifted left over s bits so that its top bit is set,
+	dn = d << s, and v = (2^128 - 1) / dn - 2^64. A step divides
+	(r * RADIX + a[i]) << s by dn with two multiplications and no
+	division, and keeps the remainder shifted left over s bits.
+	zsmod_block does such steps, without the quotient (zsr_rem), for
+	many divisors in one pass over a, which is what trial division in
+	ztridiv needs.
+*/
+
+#ifdef ZSRECIP_MG
+
+#define zsr_step(rr, ai, dn, s, v, q) \
+{ \
+	register zsr_udlong lu = ((zsr_udlong) (rr) << NBITS) \
+			+ ((zsr_udlong) (unsigned long) (ai) << (s)); \
+	register unsigned long lu1 = (unsigned long) (lu >> 64); \
+	register unsigned long lu0 = (unsigned long) lu; \
+	register zsr_udlong lq = (zsr_udlong) (v) * lu1 \
+			+ ((zsr_udlong) (lu1 + 1) << 64) + lu0; \
+	register unsigned long lq1 = (unsigned long) (lq >> 64); \
+	register unsigned long lr = lu0 - lq1 * (dn); \
+ \
+	if (lr > (unsigned long) lq) \
+	{ \
+		lq1--; \
+		lr += (dn); \
+	} \
+	if (lr >= (dn)) \
+	{ \
+		lq1++; \
+		lr -= (dn); \
+	} \
+	rr = lr; \
+	q = (long) lq1; \
+}
+
+#define zsr_rem(rr, ai, dn, s, v) \
+{ \
+	register zsr_udlong lu = ((zsr_udlong) (rr) << NBITS) \
+			+ ((zsr_udlong) (unsigned long) (ai) << (s)); \
+	register unsigned long lu1 = (unsigned long) (lu >> 64); \
+	register unsigned long lu0 = (unsigned long) lu; \
+	register zsr_udlong lq = (zsr_udlong) (v) * lu1 \
+			+ ((zsr_udlong) (lu1 + 1) << 64) + lu0; \
+	register unsigned long lr = lu0 - (unsigned long) (lq >> 64) * (dn); \
+ \
+	if (lr > (unsigned long) lq) \
+		lr += (dn); \
+	if (lr >= (dn)) \
+		lr -= (dn); \
+	rr = lr; \
+}
+
+#endif
+
+void
+zsrecip_init(
+	zsrecip *m,
+	long d
+	)
+{
+	if (d <= 0 || d >= RADIX)
+	{
+		zhalt("wrong divisor in zsrecip_init");
+		return;
+	}
+	m->d = d;
+#ifdef ZSRECIP_MG
+	m->s = __builtin_clzl((unsigned long) d);
+	m->dn = (unsigned long) d << m->s;
+	m->v = (unsigned long) ((((zsr_udlong) ~m->dn) << 64 | ~0UL) / m->dn);
+#else
+	m->s = 0;
+	m->dn = (unsigned long) d;
+	m->v = 0;
+#endif
+}
+
+long
+zsdiv_recip(
+	zsrecip *m,
+	verylong a,
+	verylong *qq
+	)
+{
+#ifdef ZSRECIP_MG
+	register long sa;
+	register long i;
+	register unsigned long rr = 0;
+	register unsigned long dn = m->dn;
+	register unsigned long v = m->v;
+	register long s = m->s;
+	long aneg;
+	verylong q = *qq;
+
+	if (ALLOCATE && !a)
+	{
+		zzero(qq);
+		return (0);
+	}
+	if (!m->d)
+	{
+		zhalt("undefined divisor in zsdiv_recip");
+		return (0);
+	}
+	if ((aneg = ((sa = a[0]) < 0)))
+		sa = -sa;
+	zsetlength(&q, sa, "in zsdiv_recip, third argument");
+	if (a == *qq) a = q;
+	*qq = q;
+	for (i = sa; i; i--)
+	{
+		zsr_step(rr, a[i], dn, s, v, q[i]);
+	}
+	while ((sa > 1) && (!(q[sa])))
+		sa--;
+	q[0] = sa;
+	rr >>= s;
+	if (aneg)
+	{
+		if (!rr)
+			znegate(&q);
+		else
+		{
+			zadd(q, one, &q);
+			q[0] = -q[0];
+			rr = m->d - rr;
+			*qq = q;
+		}
+	}
+	return ((long) rr);
+#else
+	if (!m->d)
+	{
+		zhalt("undefined divisor in zsdiv_recip");
+		return (0);
+	}
+	return (zsdiv(a, m->d, qq));
+#endif
+}
+
+long
+zsmod_recip(
+	zsrecip *m,
+	verylong a
+	)
+{
+	long r;
+
+	zsmod_block(m, 1, a, &r);
+	return (r);
+}
+
+void
+zsmod_block(
+	zsrecip *m,
+	long k,
+	verylong a,
+	long *r
+	)
+{
+	register long j;
+
+	for (j = 0; j < k; j++)
+		if (!m[j].d)
+		{
+			zhalt("undefined divisor in zsmod_block");
+			return;
+		}
+	if (ALLOCATE && !a)
+	{
+		for (j = 0; j < k; j++)
+			r[j] = 0;
+		return;
+	}
+#ifdef ZSRECIP_MG
+	{
+		register long i;
+		register long sa = (a[0] < 0 ? -a[0] : a[0]);
+
+		for (j = 0; j < k; j++)
+			r[j] = 0;
+		for (i = sa; i; i--)
+		{
+			register long ai = a[i];
+
+			for (j = 0; j < k; j++)
+			{
+				register unsigned long rr = (unsigned long) r[j];
+
+				zsr_rem(rr, ai, m[j].dn, m[j].s, m[j].v);
+				r[j] = (long) rr;
+			}
+		}
+		for (j = 0; j < k; j++)
+		{
+			r[j] = (long) ((unsigned long) r[j] >> m[j].s);
+			if (r[j] && a[0] < 0)
+				r[j] = m[j].d - r[j];
+		}
+	}
+#else
+	for (j = 0; j < k; j++)
+		r[j] = zsmod(a, m[j].d);
+#endif
+}
+
+
 #define correct( q, x1, x2, x3, y1, y2, btopinv) { \
 	register long ix1=x1,ix2=x2,ix3=x3,iy1=y1,iy2=y2; \
 	long lprodlow=0,lprodhigh=0; \
@@ -2837,6 +4851,346 @@ zsmod(
 }
 
 
+/*
+	Divide and conquer division (Burnikel and Ziegler; this is algorithm
+	1.8 in Brent and Zimmermann, Modern Computer Arithmetic). zdiv and
+	zmod use it when the divisor and the quotient both have at least
+	DIV_CROV nits: half of the quotient is found recursively from the
+	top half of the divisor, and corrected with one multiplication by
+	the bottom half, done by zmul. Below DIV_CROV zdiv does the work.
+*/
+
+#define ZDIV_DC(a, b) \
+	((b)[0] >= DIV_CROV || (b)[0] <= -DIV_CROV) \
+	&& ((a)[0] < 0 ? -(a)[0] : (a)[0]) \
+		- ((b)[0] < 0 ? -(b)[0] : (b)[0]) >= DIV_CROV
+
+static void
+zdiv_nits(
+	verylong a,
+	long lo,
+	long len,
+	verylong *cc
+	)
+{	/* *cc = (a / RADIX^lo) % RADIX^len, a >= 0 */
+	register long i;
+	register long j;
+	verylong c;
+
+	if ((j = a[0] - lo) > len)
+		j = len;
+	if (j <= 0)
+	{
+		zzero(cc);
+		return;
+	}
+	zsetlength(cc, j, "in zdiv, local");
+	c = *cc;
+	for (i = 1; i <= j; i++)
+		c[i] = a[lo + i];
+	while ((j > 1) && (!(c[j])))
+		j--;
+	c[0] = j;
+}
+
+static void
+zdiv_rec(
+	verylong a,
+	verylong b,
+	verylong *q,
+	verylong *r
+	)
+{	/* a >= 0, top bit of the top nit of b set, a[0] <= 2 * b[0] */
+	register long k = (a[0] - b[0]) >> 1;
+	verylong b0 = 0;
+	verylong b1 = 0;
+	verylong q1 = 0;
+	verylong t = 0;
+	verylong u = 0;
+
+	if (a[0] - b[0] < DIV_CROV || b[0] < DIV_CROV)
+	{
+		zdiv(a, b, q, r);
+		return;
+	}
+	zdiv_nits(b, k, b[0], &b1);
+	zdiv_nits(b, 0, k, &b0);
+	zdiv_nits(a, k << 1, a[0], &t);
+	zdiv_rec(t, b1, &q1, &u);
+	zlshift(u, (k << 1) * NBITS, &u);
+	zdiv_nits(a, 0, k << 1, &t);
+	zadd(u, t, &u);
+	zmul(q1, b0, &t);
+	zlshift(t, k * NBITS, &t);
+	zsub(u, t, &u);
+	if (zsign(u) < 0)
+	{
+		zlshift(b, k * NBITS, &t);
+		do
+		{
+			zsadd(q1, -1, &q1);
+			zadd(u, t, &u);
+		} while (zsign(u) < 0);
+	}
+	zdiv_nits(u, k, u[0], &t);
+	zdiv_rec(t, b1, q, r);
+	zlshift(*r, k * NBITS, r);
+	zdiv_nits(u, 0, k, &t);
+	zadd(*r, t, r);
+	zmul(*q, b0, &t);
+	zsub(*r, t, r);
+	while (zsign(*r) < 0)
+	{
+		zsadd(*q, -1, q);
+		zadd(*r, b, r);
+	}
+	zlshift(q1, k * NBITS, &q1);
+	zadd(q1, *q, q);
+	zfree(&b0);
+	zfree(&b1);
+	zfree(&q1);
+	zfree(&t);
+	zfree(&u);
+}
+
+static void
+zdiv_dc(
+	verylong a,
+	verylong b,
+	verylong *qq,
+	verylong *rr
+	)
+{	/* zdiv for large a and b, see ZDIV_DC */
+	register long sh;
+	register long n;
+	register long j;
+	long sign = (a[0] < 0 ? 2 : 0) | (b[0] < 0 ? 1 : 0);
+	verylong aa = 0;
+	verylong bb = 0;
+	verylong q = 0;
+	verylong r = 0;
+	verylong t = 0;
+	verylong u = 0;
+
+	zcopy(a, &aa);
+	zcopy(b, &bb);
+	zabs(&aa);
+	zabs(&bb);
+	sh = NBITS - z2logs(bb[bb[0]]);
+	zlshift(aa, sh, &aa);
+	zlshift(bb, sh, &bb);
+	n = bb[0];
+	/* the top part has at most 2n nits, then j more parts of n nits */
+	j = (aa[0] > (n << 1) ? (aa[0] - n - 1) / n : 0);
+	zdiv_nits(aa, j * n, aa[0], &t);
+	zzero(&q);
+	for (;;)
+	{
+		zdiv_rec(t, bb, &u, &r);
+		zlshift(q, n * NBITS, &q);
+		zadd(q, u, &q);
+		if (--j < 0)
+			break;
+		zlshift(r, n * NBITS, &t);
+		zdiv_nits(aa, j * n, n, &u);
+		zadd(t, u, &t);
+	}
+	zrshift(r, sh, &r);
+	zrshift(bb, sh, &bb);
+	if (sign)
+	{
+		if (sign <= 2 && ziszero(r))
+			znegate(&q);
+		else if (sign <= 2)
+		{
+			zsadd(q, 1, &q);
+			znegate(&q);
+			if (sign == 1)
+				zsub(r, bb, &r);
+			else
+				zsub(bb, r, &r);
+		}
+		else
+			znegate(&r);
+	}
+	if (qq)
+		zcopy(q, qq);
+	zcopy(r, rr);
+	zfree(&aa);
+	zfree(&bb);
+	zfree(&q);
+	zfree(&r);
+	zfree(&t);
+	zfree(&u);
+}
+
+#ifndef INT128
+static long
+zdiv_low(
+	verylong c,
+	verylong b
+	)
+{	/* 1 if the b[0] + 1 nits at c are at least b */
+	register long j = b[0];
+
+	if (c[j])
+		return (1);
+	while ((j > 0) && (c[j - 1] == b[j]))
+		j--;
+	return (!j || c[j - 1] > b[j]);
+}
+#endif
+
+/*
+	Division by a fixed divisor with a precomputed reciprocal (Barrett).
+	For a divisor b of n >= RECIP_CROV nits, zrecip_init computes
+	v = RADIX^(2n) / b once, and every part of n nits of the dividend
+	then costs two multiplications by zmul and at most two corrections.
+	Smaller divisors are left to zdiv.
+*/
+
+static void
+zrecip_block(
+	zrecip *m,
+	verylong t,
+	verylong *q,
+	verylong *r
+	)
+{	/* *q = t / m->b, *r = t % m->b, 0 <= t < m->b * RADIX^n */
+	register long n = m->b[0];
+	STATIC verylong w = 0;
+
+	zdiv_nits(t, n - 1, n + 2, q);
+	zmul(*q, m->v, &w);
+	zdiv_nits(w, n + 1, n + 2, q);
+	zmul(*q, m->b, &w);
+	zsub(t, w, r);
+	while (zcompare(*r, m->b) >= 0)
+	{
+		zsub(*r, m->b, r);
+		zsadd(*q, 1, q);
+	}
+	FREESPACE(w);
+}
+
+void
+zrecip_init(
+	zrecip *m,
+	verylong b
+	)
+{
+	STATIC verylong t = 0;
+
+	if (!b || b[0] < 0 || (b[0] == 1 && !b[1]))
+	{
+		zhalt("zero or negative divisor in zrecip_init");
+		return;
+	}
+	zcopy(b, &(m->b));
+	if (b[0] < RECIP_CROV)
+	{
+		zfree(&(m->v));
+		return;
+	}
+	zone(&t);
+	zlshift(t, (b[0] << 1) * NBITS, &t);
+	zdiv(t, b, &(m->v), &t);
+	FREESPACE(t);
+}
+
+void
+zrecip_free(
+	zrecip *m
+	)
+{
+	zfree(&(m->b));
+	zfree(&(m->v));
+}
+
+void
+zdiv_recip(
+	zrecip *m,
+	verylong a,
+	verylong *qq,
+	verylong *rr
+	)
+{
+	register long n;
+	register long j;
+	long neg;
+	STATIC verylong aa = 0;
+	STATIC verylong q = 0;
+	STATIC verylong r = 0;
+	STATIC verylong t = 0;
+	STATIC verylong u = 0;
+
+	if (!m->b)
+	{
+		zhalt("undefined divisor in zdiv_recip");
+		return;
+	}
+	if (!m->v)
+	{
+		if (qq)
+			zdiv(a, m->b, qq, rr);
+		else
+			zmod(a, m->b, rr);
+		return;
+	}
+	if (ALLOCATE && !a)
+	{
+		if (qq)
+			zzero(qq);
+		zzero(rr);
+		return;
+	}
+	zcopy(a, &aa);
+	if ((neg = (aa[0] < 0)))
+		aa[0] = -aa[0];
+	n = m->b[0];
+	/* as in zdiv_dc, a top part of at most 2n nits, then j parts of n */
+	j = (aa[0] > (n << 1) ? (aa[0] - n - 1) / n : 0);
+	zdiv_nits(aa, j * n, aa[0], &t);
+	zzero(&q);
+	for (;;)
+	{
+		zrecip_block(m, t, &u, &r);
+		zlshift(q, n * NBITS, &q);
+		zadd(q, u, &q);
+		if (--j < 0)
+			break;
+		zlshift(r, n * NBITS, &t);
+		zdiv_nits(aa, j * n, n, &u);
+		zadd(t, u, &t);
+	}
+	if (neg)
+	{
+		if (ziszero(r))
+			znegate(&q);
+		else
+		{
+			zsadd(q, 1, &q);
+			znegate(&q);
+			zsub(m->b, r, &r);
+		}
+	}
+	if (qq)
+		zcopy(q, qq);
+	zcopy(r, rr);
+	FREE3SPACE(aa, q, r); FREE2SPACE(t, u);
+}
+
+void
+zmod_recip(
+	zrecip *m,
+	verylong a,
+	verylong *r
+	)
+{
+	zdiv_recip(m, a, (verylong *) 0, r);
+}
+
+
 #ifndef ALPHA50
 void
 zdiv(
@@ -2855,17 +5209,24 @@ zdiv(
 	verylong p;
 	verylong pc;
 	long sign;
-	STATIC verylong a = 0;
-	STATIC verylong b = 0;
-	STATIC verylong c = 0;
-	STATIC verylong d = 0;
+	STATIC_INLINE(a);
+	STATIC_INLINE(b);
+	STATIC_INLINE(c);
+	STATIC_INLINE(d);
 	double btopinv;
 #ifdef ALPHA
 	double btopinv2;
 #endif
+#ifdef INT128
+	long bsh;
+	udlong btop;
+	udlong lnum;
+#else
 	double aux;
+#endif
 	verylong q = *qqq;
 	verylong r = *rrr;
+	ZCOUNT_IN(div, ZCOUNT_LEN(in_a) + ZCOUNT_LEN(in_b));
 
 #ifndef START
 	if (fudge < 0)
@@ -2876,11 +5237,19 @@ zdiv(
 	{
 		zzero(qqq);
 		zzero(rrr);
+		ZCOUNT_OUT(div);
 		return;
 	}
 	if ((!in_b) || (((sb = in_b[0]) == 1) && (!in_b[1])))
 	{
 		zhalt("division by zero in zdiv");
+		ZCOUNT_OUT(div);
+		return;
+	}
+	if (ZDIV_DC(in_a, in_b))
+	{
+		zdiv_dc(in_a, in_b, qqq, rrr);
+		ZCOUNT_OUT(div);
 		return;
 	}
 	zcopy(in_a,&a);
@@ -2906,6 +5275,11 @@ zdiv(
 	else
 	{
 		sq = sa - sb;	/* size of quotient */
+#ifdef INT128
+	/* top nit of b shifted up as far as it goes, for the estimates */
+		bsh = NBITS - z2logs(*p);
+		btop = ((udlong) (*p) << bsh) + (*(p - 1) >> (NBITS - bsh));
+#endif
 		btopinv = (double) (*p) * fradix;
 		if (sb > 1)
 			btopinv += (*(--p));
@@ -2932,6 +5306,13 @@ zdiv(
 		for (i = sq; i >= 0; i--)
 		{
 
+#ifdef INT128
+		/* at most two too big, see Knuth vol. 2, 4.3.1 */
+			lnum = ((((udlong) (*pc) << NBITS) + (*(pc - 1))) << bsh)
+				+ (*(pc - 2) >> (NBITS - bsh));
+			lnum /= btop;
+			qq = (lnum >= RADIX ? RADIX - 1 : (long) lnum);
+#else
 			aux = fradix * (fradix * (*pc) + (*(pc - 1))) + 1.0;
 #ifndef ALPHA
 			if (i > sa)
@@ -2945,9 +5326,11 @@ zdiv(
 		/* is correct, or one too big; on some however it becomes */
 		/* too small. Could change zstart, but +0.5 and a while */
 		/* instead of one single if is safer */
+#endif
 #endif
 			if (qq > 0)
 			{
+#ifndef INT128
 #ifdef ALPHA
 				if (qq > (1L<<48)) {
 					correct(qq,*pc,*(pc-1),(i>sa) ? *(pc-2):0,b[sb],b[sb-1],btopinv);
@@ -2957,6 +5340,7 @@ zdiv(
 #else
 				if (qq >= RADIX)
 					qq = RADIX-1;
+#endif
 #endif
 				zsubmul(qq, &c[i], &b[0]);
 				while (*pc < 0)
@@ -2967,6 +5351,13 @@ zdiv(
 					}
 				}
 			}
+#ifndef INT128
+			while (zdiv_low(&c[i], b))
+			{
+				qq++;
+				zsubmul(1, &c[i], &b[0]);
+			}
+#endif
 			pc--;
 			*p-- = qq;
 		}
@@ -3021,6 +5412,7 @@ done:
 	*qqq = q;
 	*rrr = r;
 	FREE2SPACE(a,b); FREE2SPACE(c,d);
+	ZCOUNT_OUT(div);
 }
 
 
@@ -3034,9 +5426,9 @@ zmod(
 	register long i;
 	register long qq;
 	verylong r = *rr;
-	STATIC verylong a = 0;
-	STATIC verylong b = 0;
-	STATIC verylong c = 0;
+	STATIC_INLINE(a);
+	STATIC_INLINE(b);
+	STATIC_INLINE(c);
 	long sa;
 	long sb;
 	long sq;
@@ -3047,7 +5439,14 @@ zmod(
 #ifdef ALPHA
         double btopinv2;
 #endif
+#ifdef INT128
+	long bsh;
+	udlong btop;
+	udlong lnum;
+#else
 	double aux;
+#endif
+	ZCOUNT_IN(div, ZCOUNT_LEN(in_a) + ZCOUNT_LEN(in_b));
 
 /*printf("in zmod: "); zwrite(in_a); printf(" mod "); zwriteln(in_b); fflush(stdout);
 */
@@ -3058,11 +5457,19 @@ zmod(
 	if (ALLOCATE && !in_a)
 	{
 		zzero(rr);
+		ZCOUNT_OUT(div);
 		return;
 	}
 	if ((!in_b) || (((sb = in_b[0]) == 1) && (!in_b[1])))
 	{
 		zhalt("division by zero in zmod");
+		ZCOUNT_OUT(div);
+		return;
+	}
+	if (ZDIV_DC(in_a, in_b))
+	{
+		zdiv_dc(in_a, in_b, (verylong *) 0, rr);
+		ZCOUNT_OUT(div);
 		return;
 	}
 	zcopy(in_a,&a);
@@ -3083,6 +5490,11 @@ zmod(
 	else
 	{
 		sq = sa - sb;
+#ifdef INT128
+	/* top nit of b shifted up as far as it goes, for the estimates */
+		bsh = NBITS - z2logs(*p);
+		btop = ((udlong) (*p) << bsh) + (*(p - 1) >> (NBITS - bsh));
+#endif
 		btopinv = (double) (*p) * fradix;
 		if (sb > 1)
 			btopinv += (*(--p));
@@ -3106,6 +5518,12 @@ zmod(
 		*pc = 0;
 		for (i = sq; i >= 0; i--)
 		{
+#ifdef INT128
+			lnum = ((((udlong) (*pc) << NBITS) + (*(pc - 1))) << bsh)
+				+ (*(pc - 2) >> (NBITS - bsh));
+			lnum /= btop;
+			qq = (lnum >= RADIX ? RADIX - 1 : (long) lnum);
+#else
 			aux = fradix * (fradix * (*pc) + (*(pc - 1))) + 1.0;
 #ifdef ALPHA
 			qq = (long) (btopinv2 * aux + 0.5);
@@ -3115,9 +5533,11 @@ zmod(
 			qq = (long) (btopinv * aux + 0.5);
 
 		/* see comment in zdiv */
+#endif
 #endif
 			if (qq > 0)
 			{
+#ifndef INT128
 #ifdef ALPHA
 				if (qq > (1L<<48)) {
 					correct(qq,*pc,*(pc-1),(i>sa) ? *(pc-2):0,b[sb],b[sb-1],btopinv);
@@ -3127,6 +5547,7 @@ zmod(
 #else
 				if (qq >= RADIX)
 					qq = RADIX-1;
+#endif
 #endif
 				zsubmul(qq, &c[i], &b[0]);
 				while (*pc < 0)
@@ -3136,6 +5557,10 @@ zmod(
 					}
 				}
 			}
+#ifndef INT128
+			while (zdiv_low(&c[i], b))
+				zsubmul(1, &c[i], &b[0]);
+#endif
 			pc--;
 		}	/* loop on i */
 		sb--;
@@ -3159,176 +5584,808 @@ done:
 				zsub(b, r, &r);
 		}
 		else
-			znegate(&r);	/* negating r==0 doesn't hurt */
+			znegate(&r);	/* negating r==0 doesn't hurt */
+	}
+	*rr = r;
+	FREE2SPACE(a,b); FREESPACE(c);
+
+	ZCOUNT_OUT(div);
+}
+#endif
+
+
+void
+zaddmod(
+	verylong a,
+	verylong b,
+	verylong n,
+	verylong *c
+	)
+{
+	if (ALLOCATE && !n)
+	{
+		zhalt("modulus zero in zaddmod");
+		return;
+	}
+	if (ALLOCATE && !a)
+	{
+		if (b)
+			zcopy(b, c);
+		else
+			zzero(c);
+		return;
+	}
+	if (ALLOCATE && !b)
+	{
+		zcopy(a, c);
+		return;
+	}
+	zadd(a, b, c);
+	if (zcompare(*c, n) >= 0)
+		zsubpos(*c, n, c);
+
+}
+
+void
+zsubmod(
+	verylong a,
+	verylong b,
+	verylong n,
+	verylong *c
+	)
+{
+	if (ALLOCATE && !n)
+	{
+		zhalt("modulus zero in zsubmod");
+		return;
+	}
+	if (ALLOCATE && !b)
+	{
+		if (a)
+			zcopy(a, c);
+		else
+			zzero(c);
+		return;
+	}
+	if (ALLOCATE && !a)
+	{
+		if (b[1] || (b[0] != 1))
+			zsubpos(n, b, c);
+		else
+			zzero(c);
+		return;
+	}
+	zsub(a, b, c);
+	if ((*c)[0] < 0)
+		zadd(*c, n, c);
+}
+
+void
+zsmulmod(
+	verylong a,
+	long d,
+	verylong n,
+	verylong *c
+	)
+{
+	STATIC_INLINE(mem);
+
+	if (ALLOCATE && !n)
+	{
+		zhalt("modulus zero in zsmulmod");
+		return;
+	}
+	if (ALLOCATE && (!a || !d))
+	{
+		zzero(c);
+		return;
+	}
+	zsmul(a, d, &mem);
+	zmod(mem, n, c);
+	FREESPACE(mem);
+}
+
+void
+zmulmod(
+	verylong a,
+	verylong b,
+	verylong n,
+	verylong *c
+	)
+{
+	STATIC_INLINE(mem);
+	zbarrett *m;
+	zspecial *sm;
+
+	if (ALLOCATE && !n)
+	{
+		zhalt("modulus zero in zmulmod");
+		return;
+	}
+	if (ALLOCATE && (!a || !b))
+	{
+		zzero(c);
+		return;
+	}
+	if ((sm = zspecial_last(n)))
+	{
+		zspecial_mulmod(sm, a, b, c);
+		return;
+	}
+	if ((m = zbarrett_last(n)))
+	{
+		zbarrett_mulmod(m, a, b, c);
+		return;
+	}
+	zsetlength(&mem, a[0] + b[0] + 2, "in zmulmod, local");
+	zmul(a, b, &mem);
+	zmod(mem, n, c);
+	FREESPACE(mem);
+}
+
+void
+zmulinmod(
+	verylong a,
+	verylong *b,
+	verylong n
+	)
+{
+	if (ALLOCATE && !n)
+	{
+		zhalt("modulus zero in zmulinmod");
+		return;
+	}
+	if (ALLOCATE && (!a || !(*b)))
+	{
+		zzero(b);
+		return;
+	}
+	zmulin(a, b);
+	zmod(*b, n, b);
+}
+
+void
+zsqmod(
+	verylong a,
+	verylong n,
+	verylong *c
+	)
+{
+	STATIC_INLINE(mem);
+	zbarrett *m;
+	zspecial *sm;
+
+	if (ALLOCATE && !n)
+	{
+		zhalt("modulus zero in zsqmod");
+		return;
+	}
+	if (ALLOCATE && !a)
+	{
+		zzero(c);
+		return;
+	}
+	if ((sm = zspecial_last(n)))
+	{
+		zspecial_sqmod(sm, a, c);
+		return;
+	}
+	if ((m = zbarrett_last(n)))
+	{
+		zbarrett_sqmod(m, a, c);
+		return;
+	}
+	zsetlength(&mem, 2 * a[0] + 2, "in zsqmod, local");
+	zsq(a, &mem);
+	zmod(mem, n, c);
+	FREESPACE(mem);
+}
+
+/*
+	Barrett reduction (HAC 14.42) by a modulus of k nits, with the
+	precomputed v = floor(RADIX^(2k) / n). Unlike Montgomery
+	multiplication it works for even moduli as well, and residues
+	stay in their ordinary representation.
+*/
+
+static TLS zbarrett barrett_cache = {0};
+static TLS verylong barrett_prev = 0;
+
+void
+zbarrett_init(
+	zbarrett *m,
+	verylong n
+	)
+{
+	STATIC verylong t = 0;
+
+	if (!n || n[0] < 0 || (n[0] == 1 && !n[1]))
+	{
+		zhalt("zero or negative modulus in zbarrett_init");
+		return;
+	}
+	zcopy(n, &(m->n));
+	m->k = n[0];
+	zone(&t);
+	zlshift(t, (n[0] << 1) * NBITS, &t);
+	zdiv(t, n, &(m->v), &t);
+	FREESPACE(t);
+}
+
+void
+zbarrett_free(
+	zbarrett *m
+	)
+{
+	zfree(&(m->n));
+	zfree(&(m->v));
+	m->k = 0;
+}
+
+static void
+zbarrett_red(
+	zbarrett *m,
+	verylong x,
+	verylong *rr
+	)
+{
+	/* *rr = x mod m->n for 0 <= x < RADIX^(2k) */
+	register long i;
+	register long j;
+	long k = m->k;
+	long xl = x[0];
+	long vl = m->v[0];
+	long l1;
+	long l3;
+	long carry;
+	verylong nd = m->n;
+	verylong vd = m->v;
+	verylong tp;
+	verylong sp;
+	STATIC verylong t = 0;
+	STATIC verylong r = 0;
+
+	if (xl < k)
+	{
+		zcopy(x, rr);
+		return;
+	}
+	l1 = xl - k + 1;
+	zsetlength(&t, l1 + vl + k + 2, "in zbarrett_red, locals\n");
+	zsetlength(&r, k + 2, "");
+	tp = &t[1];
+	sp = &tp[l1 + vl];
+	/* q3 = (x / RADIX^(k-1)) * v / RADIX^(k+1), products below
+	   position k-1 are left out */
+	for (i = k - 1; i < l1 + vl; i++)
+		tp[i] = 0;
+	for (i = 0; i < l1; i++)
+	{
+		carry = 0;
+		for (j = (i < k - 1 ? k - 1 - i : 0); j < vl; j++)
+			zaddmulp(&tp[i + j], x[k + i], vd[j + 1], &carry);
+		tp[i + vl] = carry;
+	}
+	tp += k + 1;
+	if ((l3 = l1 + vl - k - 1) > k + 1)
+		l3 = k + 1;
+	/* q3 * n mod RADIX^(k+1) */
+	for (i = 0; i <= k; i++)
+		sp[i] = 0;
+	for (i = 0; i < l3; i++)
+	{
+		carry = 0;
+		for (j = 0; j < k && i + j <= k; j++)
+			zaddmulp(&sp[i + j], tp[i], nd[j + 1], &carry);
+		if (!i)
+			sp[k] = carry;
+	}
+	/* x - q3 * n mod RADIX^(k+1), below 4n */
+	carry = 0;
+	for (i = 0; i <= k; i++)
+	{
+		carry += (i < xl ? x[i + 1] : 0) - sp[i];
+		if (carry < 0)
+		{
+			r[i + 1] = carry + RADIX;
+			carry = -1;
+		}
+		else
+		{
+			r[i + 1] = carry;
+			carry = 0;
+		}
 	}
-	*rr = r;
-	FREE2SPACE(a,b); FREESPACE(c);
-
+	i = k + 1;
+	while ((i > 1) && (!(r[i])))
+		i--;
+	r[0] = i;
+	while (zcompare(r, nd) >= 0)
+		zsubpos(r, nd, &r);
+	zcopy(r, rr);
+	FREE2SPACE(t, r);
 }
-#endif
-
 
 void
-zaddmod(
+zbarrett_mod(
+	zbarrett *m,
 	verylong a,
-	verylong b,
-	verylong n,
-	verylong *c
+	verylong *r
 	)
 {
-	if (ALLOCATE && !n)
+	if (!m->v)
 	{
-		zhalt("modulus zero in zaddmod");
+		zhalt("undefined modulus in zbarrett_mod");
 		return;
 	}
 	if (ALLOCATE && !a)
 	{
-		if (b)
-			zcopy(b, c);
-		else
-			zzero(c);
+		zzero(r);
 		return;
 	}
-	if (ALLOCATE && !b)
+	if (a[0] < 0 || a[0] > (m->k << 1) || m->k > BARRETT_CROV)
+		zmod(a, m->n, r);
+	else
+		zbarrett_red(m, a, r);
+}
+
+void
+zbarrett_mulmod(
+	zbarrett *m,
+	verylong a,
+	verylong b,
+	verylong *c
+	)
+{
+	STATIC verylong mem = 0;
+
+	if (ALLOCATE && (!a || !b))
 	{
-		zcopy(a, c);
+		zzero(c);
 		return;
 	}
-	zadd(a, b, c);
-	if (zcompare(*c, n) >= 0)
-		zsubpos(*c, n, c);
-
+	zmul(a, b, &mem);
+	zbarrett_mod(m, mem, c);
+	FREESPACE(mem);
 }
 
 void
-zsubmod(
+zbarrett_sqmod(
+	zbarrett *m,
 	verylong a,
-	verylong b,
-	verylong n,
 	verylong *c
 	)
 {
-	if (ALLOCATE && !n)
+	STATIC verylong mem = 0;
+
+	if (ALLOCATE && !a)
 	{
-		zhalt("modulus zero in zsubmod");
+		zzero(c);
 		return;
 	}
-	if (ALLOCATE && !b)
+	zsq(a, &mem);
+	zbarrett_mod(m, mem, c);
+	FREESPACE(mem);
+}
+
+static zbarrett *
+zbarrett_last(
+	verylong n
+	)
+{
+	/* the cached context for n if n was also the modulus of the
+	   previous call, so that alternating moduli never pay for v */
+	if (n[0] < 2 || n[0] > BARRETT_CROV)
+		return ((zbarrett *) 0);
+	if (barrett_cache.n && !zcompare(barrett_cache.n, n))
+		return (&barrett_cache);
+	if (barrett_prev && !zcompare(barrett_prev, n))
+	{
+		zbarrett_init(&barrett_cache, n);
+		return (&barrett_cache);
+	}
+	zcopy(n, &barrett_prev);
+	return ((zbarrett *) 0);
+}
+
+/*
+	Reduction modulo n = 2^p - c with c < 2^(p/2): the bits of x
+	above p are folded back in as x = (x >> p) * c + x mod 2^p,
+	three times at most for a product of two residues. c is either
+	a single nit, multiplied by zsmul, or a sum of at most
+	ZSPECIAL_TERMS signed powers of two (its non-adjacent form),
+	multiplied by shifts, as for the generalized Mersenne primes of
+	Solinas. The shifts only beat Barrett from SPECIAL_CROV nits on.
+	Everything else is reduced by zmod.
+*/
+
+static TLS zspecial special_cache = {0};
+static TLS verylong slide_pow[1L << 9];
+
+long
+zspecial_init(
+	zspecial *m,
+	verylong n
+	)
+{
+	register long i;
+	register long w = 0;
+	long p;
+	STATIC verylong t = 0;
+
+	if (!n || n[0] < 0 || (n[0] == 1 && !n[1]))
 	{
-		if (a)
-			zcopy(a, c);
+		zhalt("zero or negative modulus in zspecial_init");
+		return (0);
+	}
+	zcopy(n, &(m->n));
+	m->p = 0;
+	m->w = 0;
+	if (n[0] < 2)
+		return (0);
+	p = z2log(n);
+	zone(&t);
+	zlshift(t, p, &t);
+	zsub(t, n, &(m->c));
+	if (z2log(m->c) > (p >> 1))
+	{
+		FREESPACE(t);
+		return (0);
+	}
+	if (m->c[0] > 1)
+	{
+		if (n[0] < SPECIAL_CROV)
+		{
+			FREESPACE(t);
+			return (0);
+		}
+		/* non-adjacent form of c, exponents stored as +-(i+1) */
+		zcopy(m->c, &t);
+		for (i = 0; !ziszero(t); i++)
+		{
+			if (t[1] & 1)
+			{
+				if (w == ZSPECIAL_TERMS)
+				{
+					FREESPACE(t);
+					return (0);
+				}
+				if (t[1] & 2)
+				{
+					m->e[w++] = -(i + 1);
+					zsadd(t, 1, &t);
+				}
+				else
+				{
+					m->e[w++] = i + 1;
+					zsadd(t, -1, &t);
+				}
+			}
+			z2div(t, &t);
+		}
+	}
+	m->w = w;
+	m->p = p;
+	FREESPACE(t);
+	return (1);
+}
+
+void
+zspecial_form(
+	zspecial *m,
+	long p,
+	verylong c
+	)
+{
+	STATIC verylong n = 0;
+
+	zone(&n);
+	zlshift(n, p, &n);
+	zsub(n, c, &n);
+	if (ziszero(c) || c[0] < 0 || !zspecial_init(m, n))
+		zhalt("2^p-c not a special modulus in zspecial_form");
+	FREESPACE(n);
+}
+
+void
+zspecial_free(
+	zspecial *m
+	)
+{
+	zfree(&(m->n));
+	zfree(&(m->c));
+	m->p = 0;
+	m->w = 0;
+}
+
+static void
+zspecial_red(
+	zspecial *m,
+	verylong x,
+	verylong *rr
+	)
+{
+	/* *rr = x mod m->n for x >= 0 */
+	register long i;
+	register long j;
+	STATIC verylong t = 0;
+	STATIC verylong hi = 0;
+	STATIC verylong u = 0;
+
+	zcopy(x, &t);
+	while (z2log(t) > m->p)
+	{
+		zrshift(t, m->p, &hi);
+		zlowbits(t, m->p, &t);
+		if (!m->w)
+		{
+			if (m->c[1] != 1)
+				zsmul(hi, m->c[1], &hi);
+			zadd(t, hi, &t);
+		}
 		else
-			zzero(c);
+			for (i = 0; i < m->w; i++)
+			{
+				if ((j = m->e[i]) > 0)
+				{
+					zlshift(hi, j - 1, &u);
+					zadd(t, u, &t);
+				}
+				else
+				{
+					zlshift(hi, -j - 1, &u);
+					zsub(t, u, &t);
+				}
+			}
+	}
+	if (zcompare(t, m->n) >= 0)
+		zsubpos(t, m->n, &t);
+	zcopy(t, rr);
+	FREE2SPACE(t, hi); FREESPACE(u);
+}
+
+void
+zspecial_mod(
+	zspecial *m,
+	verylong a,
+	verylong *r
+	)
+{
+	if (!m->n)
+	{
+		zhalt("undefined modulus in zspecial_mod");
 		return;
 	}
 	if (ALLOCATE && !a)
 	{
-		if (b[1] || (b[0] != 1))
-			zsubpos(n, b, c);
-		else
-			zzero(c);
+		zzero(r);
 		return;
 	}
-	zsub(a, b, c);
-	if ((*c)[0] < 0)
-		zadd(*c, n, c);
+	if (a[0] < 0 || !m->p)
+		zmod(a, m->n, r);
+	else
+		zspecial_red(m, a, r);
 }
 
 void
-zsmulmod(
+zspecial_mulmod(
+	zspecial *m,
 	verylong a,
-	long d,
-	verylong n,
+	verylong b,
 	verylong *c
 	)
 {
 	STATIC verylong mem = 0;
 
-	if (ALLOCATE && !n)
-	{
-		zhalt("modulus zero in zsmulmod");
-		return;
-	}
-	if (ALLOCATE && (!a || !d))
+	if (ALLOCATE && (!a || !b))
 	{
 		zzero(c);
 		return;
 	}
-	zsmul(a, d, &mem);
-	zmod(mem, n, c);
+	zmul(a, b, &mem);
+	zspecial_mod(m, mem, c);
 	FREESPACE(mem);
 }
 
 void
-zmulmod(
+zspecial_sqmod(
+	zspecial *m,
 	verylong a,
-	verylong b,
-	verylong n,
 	verylong *c
 	)
 {
 	STATIC verylong mem = 0;
 
-	if (ALLOCATE && !n)
+	if (ALLOCATE && !a)
 	{
-		zhalt("modulus zero in zmulmod");
+		zzero(c);
 		return;
 	}
-	if (ALLOCATE && (!a || !b))
+	zsq(a, &mem);
+	zspecial_mod(m, mem, c);
+	FREESPACE(mem);
+}
+
+static zspecial *
+zspecial_last(
+	verylong n
+	)
+{
+	/* the cached context for n if n is 2^p - c with small c; moduli
+	   without a top nit of ones are turned down at once */
+	register long j;
+
+	j = n[n[0]];
+	if (n[0] < 2 || (j & (j + 1)))
+		return ((zspecial *) 0);
+	if (n[0] > 3 && n[n[0] - 1] != RADIXM)
+		return ((zspecial *) 0);
+	if (!special_cache.n || zcompare(special_cache.n, n))
+		zspecial_init(&special_cache, n);
+	return (special_cache.p ? &special_cache : (zspecial *) 0);
+}
+
+static void
+zexpmod_slide(
+	zbarrett *bm,
+	zspecial *sm,
+	verylong x,
+	verylong e,
+	verylong *bb
+	)
+{
+	/* *bb = x^|e| by sliding windows of zdefault_m bits over the odd
+	   powers of x, reducing by sm if given and by bm otherwise */
+	register long i;
+	register long j;
+	register long l;
+	register long u;
+	long w;
+	long first = 1;
+	STATIC verylong b = 0;
+	STATIC verylong sq = 0;
+
+#define SLIDE_MUL(_a, _b, _c) \
+	(sm ? zspecial_mulmod(sm, _a, _b, _c) : zbarrett_mulmod(bm, _a, _b, _c))
+#define SLIDE_SQ(_a, _c) \
+	(sm ? zspecial_sqmod(sm, _a, _c) : zbarrett_sqmod(bm, _a, _c))
+#define SLIDE_MOD(_a, _c) \
+	(sm ? zspecial_mod(sm, _a, _c) : zbarrett_mod(bm, _a, _c))
+
+	if (x[0] == 1)
 	{
-		zzero(c);
+		/* a single nit x, as in primality tests, multiplies by zsmul */
+		zcopy(x, &b);
+		for (i = z2log(e) - 2; i >= 0; i--)
+		{
+			SLIDE_SQ(b, &b);
+			if (zbit(e, i))
+			{
+				zsmul(b, x[1], &b);
+				SLIDE_MOD(b, &b);
+			}
+		}
+		zcopy(b, bb);
+		FREESPACE(b);
 		return;
 	}
-	zsetlength(&mem, a[0] + b[0] + 2, "in zmulmod, local");
-	zmul(a, b, &mem);
-	zmod(mem, n, c);
-	FREESPACE(mem);
+	w = zdefault_m(e[0] < 0 ? -e[0] : e[0]);
+	zcopy(x, &slide_pow[0]);
+	SLIDE_SQ(slide_pow[0], &sq);
+	for (i = 1; i < (1L << (w - 1)); i++)
+		SLIDE_MUL(slide_pow[i - 1], sq, &slide_pow[i]);
+	for (i = z2log(e) - 1; i >= 0; i = j - 1)
+	{
+		if (!zbit(e, i))
+		{
+			SLIDE_SQ(b, &b);
+			j = i;
+			continue;
+		}
+		j = (i >= w ? i - w + 1 : 0);
+		while (!zbit(e, j))
+			j++;
+		for (u = 0, l = i; l >= j; l--)
+		{
+			u = (u << 1) | zbit(e, l);
+			if (!first)
+				SLIDE_SQ(b, &b);
+		}
+		if (first)
+			zcopy(slide_pow[u >> 1], &b);
+		else
+			SLIDE_MUL(b, slide_pow[u >> 1], &b);
+		first = 0;
+	}
+	zcopy(b, bb);
+	FREE2SPACE(b, sq);
+#undef SLIDE_MUL
+#undef SLIDE_SQ
+#undef SLIDE_MOD
 }
 
 void
-zmulinmod(
+zbarrett_expmod(
+	zbarrett *m,
 	verylong a,
-	verylong *b,
-	verylong n
+	verylong e,
+	verylong *bb
 	)
 {
-	if (ALLOCATE && !n)
+	STATIC verylong x = 0;
+
+	if (!m->v)
 	{
-		zhalt("modulus zero in zmulinmod");
+		zhalt("undefined modulus in zbarrett_expmod");
 		return;
 	}
-	if (ALLOCATE && (!a || !(*b)))
+	if (ALLOCATE && !e)
 	{
-		zzero(b);
+		zone(bb);
 		return;
 	}
-	zmulin(a, b);
-	zmod(*b, n, b);
+	if (ALLOCATE && !a)
+	{
+		zzero(bb);
+		return;
+	}
+	if (ziszero(e))
+	{
+		zone(bb);
+		return;
+	}
+	zbarrett_mod(m, a, &x);
+	zexpmod_slide(m, (zspecial *) 0, x, e, &x);
+	if (e[0] < 0)
+	{
+		if (zinv(x, m->n, bb))
+			zhalt("undefined quotient in zbarrett_expmod");
+	}
+	else
+		zcopy(x, bb);
+	FREESPACE(x);
 }
 
 void
-zsqmod(
+zspecial_expmod(
+	zspecial *m,
 	verylong a,
-	verylong n,
-	verylong *c
+	verylong e,
+	verylong *bb
 	)
 {
-	STATIC verylong mem = 0;
+	STATIC verylong x = 0;
 
-	if (ALLOCATE && !n)
+	if (!m->n)
 	{
-		zhalt("modulus zero in zsqmod");
+		zhalt("undefined modulus in zspecial_expmod");
+		return;
+	}
+	if (ALLOCATE && !e)
+	{
+		zone(bb);
 		return;
 	}
 	if (ALLOCATE && !a)
 	{
-		zzero(c);
+		zzero(bb);
 		return;
 	}
-	zsetlength(&mem, 2 * a[0] + 2, "in zsqmod, local");
-	zsq(a, &mem);
-	zmod(mem, n, c);
-	FREESPACE(mem);
+	if (ziszero(e))
+	{
+		zone(bb);
+		return;
+	}
+	zspecial_mod(m, a, &x);
+	zexpmod_slide((zbarrett *) 0, m, x, e, &x);
+	if (e[0] < 0)
+	{
+		if (zinv(x, m->n, bb))
+			zhalt("undefined quotient in zspecial_expmod");
+	}
+	else
+		zcopy(x, bb);
+	FREESPACE(x);
 }
 
 void
@@ -3426,6 +6483,95 @@ zinvmod(
 		zhalt("undefined inverse in zinvmod");
 }
 
+static long
+zinv_batch(
+	verylong *in,
+	long count,
+	verylong n,
+	verylong *out,
+	long mont
+	)
+{
+/*
+	Montgomery's trick: out[i] = in[0] ... in[i] on the way up, one
+	inversion of the product, and two multiplications per element
+	on the way down. With mont, everything is in Montgomery
+	representation modulo zn. Returns 1 with a factor of n in out[0]
+	if some in[i] is not invertible, gcd(in[i], n) for the first one.
+*/
+	register long i;
+	STATIC verylong inv = 0;
+	STATIC verylong t = 0;
+
+	if (count <= 0)
+		return (0);
+	zcopy(in[0], &out[0]);
+	for (i = 1; i < count; i++)
+	{
+		if (mont)
+			zmontmul(out[i - 1], in[i], &out[i]);
+		else
+			zmulmod(out[i - 1], in[i], n, &out[i]);
+	}
+	if (zinv(out[count - 1], n, &inv))
+	{
+		for (i = 0; i < count; i++)
+		{
+			zgcd(in[i], n, &t);
+			if (!zscompare(t, 1))
+				continue;
+			zcopy(t, &out[0]);
+			FREE2SPACE(inv, t);
+			return (1);
+		}
+		/* not reached for n > 1 */
+		zcopy(inv, &out[0]);
+		FREE2SPACE(inv, t);
+		return (1);
+	}
+	if (mont)
+		zmontmul(inv, zrrr, &inv);
+	for (i = count - 1; i > 0; i--)
+	{
+		if (mont)
+		{
+			zmontmul(inv, out[i - 1], &out[i]);
+			zmontmul(inv, in[i], &t);
+		}
+		else
+		{
+			zmulmod(inv, out[i - 1], n, &out[i]);
+			zmulmod(inv, in[i], n, &t);
+		}
+		zswap(&inv, &t);
+	}
+	zcopy(inv, &out[0]);
+	FREE2SPACE(inv, t);
+	return (0);
+}
+
+void
+zinvmod_batch(
+	verylong *in,
+	long count,
+	verylong n,
+	verylong *out
+	)
+{
+	if (ALLOCATE && !n)
+	{
+		zhalt("modulus zero in zinvmod_batch");
+		return;
+	}
+	if (in == out)
+	{
+		zhalt("input and output the same in zinvmod_batch");
+		return;
+	}
+	if (zinv_batch(in, count, n, out, 0))
+		zhalt("undefined inverse in zinvmod_batch");
+}
+
 static void
 zmstartint(
 	verylong n
@@ -3544,53 +6690,621 @@ zmtoz(
 		zzero(bb);
 		return;
 	}
-	zmontmul(a, one, bb);
+	zmontmul(a, one, bb);
+}
+
+void
+zmontadd(
+	verylong a,
+	verylong b,
+	verylong *c
+	)
+{
+	if (!zn)
+	{
+		zhalt("undefined Montgomery modulus in zmontadd");
+		return;
+	}
+	zaddmod(a, b, zn, c);
+}
+
+void
+zmontsub(
+	verylong a,
+	verylong b,
+	verylong *c
+	)
+{
+	if (!zn)
+	{
+		zhalt("undefined Montgomery modulus in zmontsub");
+		return;
+	}
+	zsubmod(a, b, zn, c);
+}
+
+void
+zsmontmul(
+	verylong a,
+	long d,
+	verylong *c
+	)
+{
+	if (!zn)
+	{
+		zhalt("undefined Montgomery modulus in zsmontmul");
+		return;
+	}
+	zsmulmod(a, d, zn, c);
+}
+
+#ifndef NO_MONT_FIXED
+/*
+	Montgomery multiplication and squaring for the common modulus sizes
+	of 256, 512, 1024, 2048, 3072 and 4096 bits. ZMONT_FIXED(B) defines
+	zmontmul_B and zmontsq_B for moduli of exactly ZMF_NITS(B) nits
+	(with zntop == zn[0]): the operands are copied to the stack, all loop
+	bounds are constants so the compiler can unroll them, and the
+	product and the reduction are done without any length checks.
+	zmontmul and zmontsq call them through zmont_fixed.
+*/
+
+#define ZMF_NITS(B)	(((B) + NBITS - 1) / NBITS)
+
+#define zmf_load(_t, _a, _n) \
+{ \
+	register long lmfi; \
+	register long lmfs = (_a)[0]; \
+ \
+	for (lmfi = 0; lmfi < (_n); lmfi++) \
+		(_t)[lmfi] = (lmfi < lmfs ? (_a)[lmfi + 1] : 0); \
+}
+
+/* *cc = x / RADIX^n mod zn, x has 2n+1 nits, inv = -1/zn mod RADIX */
+#define zmf_redc(_x, _n, _inv, _cc) \
+{ \
+	register long lmfi; \
+	register long lmfj; \
+	register long lmfm; \
+	long lmfcarry; \
+	verylong lmfc; \
+ \
+	for (lmfi = 0; lmfi < (_n); lmfi++) \
+	{ \
+		lmfm = (long) (((unsigned long) (_x)[lmfi] * (_inv)) & RADIXM); \
+		lmfcarry = 0; \
+		for (lmfj = 0; lmfj < (_n); lmfj++) \
+			zaddmulp(&((_x)[lmfi + lmfj]), lmfm, zn[lmfj + 1], &lmfcarry); \
+		for (lmfj = lmfi + (_n); lmfcarry; lmfj++) \
+		{ \
+			(_x)[lmfj] += lmfcarry; \
+			lmfcarry = (_x)[lmfj] >> NBITS; \
+			(_x)[lmfj] &= RADIXM; \
+		} \
+	} \
+	zsetlength((_cc), (_n), "in zmontmul, third argument"); \
+	lmfc = *(_cc); \
+	for (lmfi = (_n); lmfi > 0; lmfi--) \
+		lmfc[lmfi] = (_x)[lmfi + (_n) - 1]; \
+	lmfi = (_n); \
+	while ((lmfi > 1) && (!(lmfc[lmfi]))) \
+		lmfi--; \
+	lmfc[0] = lmfi; \
+	if (zcompare(lmfc, zn) >= 0) \
+		zsubpos(lmfc, zn, _cc); \
+}
+
+#define ZMONT_FIXED(B) \
+static void \
+zmontmul_##B( \
+	verylong a, \
+	verylong b, \
+	verylong *cc, \
+	unsigned long inv \
+	) \
+{ \
+	register long i; \
+	register long j; \
+	long carry; \
+	long ta[ZMF_NITS(B)]; \
+	long tb[ZMF_NITS(B)]; \
+	long x[2 * ZMF_NITS(B) + 1]; \
+ \
+	zmf_load(ta, a, ZMF_NITS(B)); \
+	zmf_load(tb, b, ZMF_NITS(B)); \
+	for (i = 0; i <= 2 * ZMF_NITS(B); i++) \
+		x[i] = 0; \
+	for (i = 0; i < ZMF_NITS(B); i++) \
+	{ \
+		carry = 0; \
+		for (j = 0; j < ZMF_NITS(B); j++) \
+			zaddmulp(&x[i + j], ta[i], tb[j], &carry); \
+		x[i + ZMF_NITS(B)] = carry; \
+	} \
+	zmf_redc(x, ZMF_NITS(B), inv, cc); \
+} \
+ \
+static void \
+zmontsq_##B( \
+	verylong a, \
+	verylong *cc, \
+	unsigned long inv \
+	) \
+{ \
+	register long i; \
+	register long j; \
+	long carry; \
+	long ta[ZMF_NITS(B)]; \
+	long x[2 * ZMF_NITS(B) + 1]; \
+ \
+	zmf_load(ta, a, ZMF_NITS(B)); \
+	for (i = 0; i <= 2 * ZMF_NITS(B); i++) \
+		x[i] = 0; \
+	for (i = 0; i < ZMF_NITS(B) - 1; i++) \
+	{ \
+		carry = 0; \
+		for (j = i + 1; j < ZMF_NITS(B); j++) \
+			zaddmulp(&x[i + j], ta[i], ta[j], &carry); \
+		x[i + ZMF_NITS(B)] = carry; \
+	} \
+	carry = 0; \
+	for (i = 0; i < 2 * ZMF_NITS(B); i++) \
+	{ \
+		x[i] = (x[i] << 1) + carry; \
+		carry = x[i] >> NBITS; \
+		x[i] &= RADIXM; \
+	} \
+	carry = 0; \
+	for (i = 0; i < ZMF_NITS(B); i++) \
+	{ \
+		zaddmulp(&x[i << 1], ta[i], ta[i], &carry); \
+		x[(i << 1) + 1] += carry; \
+		carry = x[(i << 1) + 1] >> NBITS; \
+		x[(i << 1) + 1] &= RADIXM; \
+	} \
+	zmf_redc(x, ZMF_NITS(B), inv, cc); \
+}
+
+ZMONT_FIXED(256)
+ZMONT_FIXED(512)
+ZMONT_FIXED(1024)
+ZMONT_FIXED(2048)
+ZMONT_FIXED(3072)
+ZMONT_FIXED(4096)
+
+static long
+zmont_fixed(
+	verylong a,
+	verylong b,
+	verylong *cc
+	)
+{	/* *cc = a * b (a * a if b == 0) if there is a kernel for zn */
+	register unsigned long inv;
+
+	if (zn[0] != zntop || a[0] > zntop || (b && b[0] > zntop))
+		return (0);
+#ifdef PLAIN_OR_KARAT
+	inv = (unsigned long) zninv1 + ((unsigned long) zninv2 << NBITSH);
+#else
+	inv = (unsigned long) zninv;
+#endif
+	switch (zntop)
+	{
+	case ZMF_NITS(256):
+		if (b)
+			zmontmul_256(a, b, cc, inv);
+		else
+			zmontsq_256(a, cc, inv);
+		return (1);
+	case ZMF_NITS(512):
+		if (b)
+			zmontmul_512(a, b, cc, inv);
+		else
+			zmontsq_512(a, cc, inv);
+		return (1);
+	case ZMF_NITS(1024):
+		if (b)
+			zmontmul_1024(a, b, cc, inv);
+		else
+			zmontsq_1024(a, cc, inv);
+		return (1);
+	case ZMF_NITS(2048):
+		if (b)
+			zmontmul_2048(a, b, cc, inv);
+		else
+			zmontsq_2048(a, cc, inv);
+		return (1);
+	case ZMF_NITS(3072):
+		if (b)
+			zmontmul_3072(a, b, cc, inv);
+		else
+			zmontsq_3072(a, cc, inv);
+		return (1);
+	case ZMF_NITS(4096):
+		if (b)
+			zmontmul_4096(a, b, cc, inv);
+		else
+			zmontsq_4096(a, cc, inv);
+		return (1);
+	}
+	return (0);
+}
+
+static long
+zmont_fixed_size(
+	verylong n
+	)
+{	/* 1 if zmstart(n) would give a modulus with a fixed size kernel */
+	register long top = n[0];
+
+	if (top <= 0 || !(n[1] & 1) || n[top] >= (RADIX >> 1))
+		return (0);
+	return (top == ZMF_NITS(256) || top == ZMF_NITS(512)
+		|| top == ZMF_NITS(1024) || top == ZMF_NITS(2048)
+		|| top == ZMF_NITS(3072) || top == ZMF_NITS(4096));
+}
+#endif
+
+#ifdef MONT_SIMD
+/*
+	Vectorized Montgomery multiplication for x86-64, chosen at run time.
+	The vector units work on digits of ZMV_W bits (52 with AVX-512 IFMA,
+	26 with AVX2) in 64-bit lanes, with the carries left in the lanes
+	until the end. To get the same result as with nits, a is multiplied
+	by 2^zmv_s first, where ZMV_W * zmv_m == NBITS * zntop + zmv_s:
+	dividing by 2^(ZMV_W * zmv_m) then is dividing by RADIX^zntop.
+
+	zmv_mul52 does one multiplication with a digit of b and zn in every
+	lane, and is used by zmontmul and zmontsq (IFMA only, AVX2 has no
+	multiplier wide enough to beat the nits). zmv_mul52x8 and zmv_mul26x4
+	do 8 or 4 independent multiplications, one in every lane, for
+	zmontmul_batch and zmontsq_batch.
+*/
+
+#define ZMV_MAXBITS	8192
+#define ZMV_DIGITS	(ZMV_MAXBITS / 26 + 16)
+#define ZMV_MAXV	(ZMV_MAXBITS / 52 / 8 + 3)
+#define ZMV_NONE	1
+#define ZMV_AVX2	4
+#define ZMV_IFMA	8
+#define ZMV_W		(zmv_lanes == ZMV_IFMA ? 52 : 26)
+
+static TLS long zmv_lanes = 0;
+static TLS verylong zmv_n = 0;
+static TLS long zmv_m;
+static TLS long zmv_s;
+static TLS unsigned long zmv_k0;
+static TLS unsigned long zmv_nd[ZMV_DIGITS];
+
+static void
+zmv_split(
+	verylong a,
+	long s,
+	long w,
+	long m,
+	unsigned long *d,
+	long stride
+	)
+{	/* the m digits of a * 2^s in radix 2^w to d[0], d[stride], ... */
+	register long i;
+	register long j = 1;
+	register long bits = s;
+	unsigned __int128 acc = 0;
+
+	for (i = 0; i < m; i++)
+	{
+		while (bits < w && j <= a[0])
+		{
+			acc |= (unsigned __int128) a[j++] << bits;
+			bits += NBITS;
+		}
+		d[i * stride] = (unsigned long) acc & ((1UL << w) - 1);
+		acc >>= w;
+		bits -= w;
+	}
+}
+
+static void
+zmv_join(
+	unsigned long *d,
+	long stride,
+	long w,
+	long m,
+	verylong *cc
+	)
+{	/* *cc = the m digits d[0], d[stride], ... (not normalized) mod zn */
+	register long i;
+	register long k = 0;
+	register long bits = 0;
+	unsigned long carry = 0;
+	unsigned __int128 acc = 0;
+	unsigned __int128 x;
+	verylong c;
+
+	zsetlength(cc, zntop + 2, "in zmontmul, third argument");
+	c = *cc;
+	for (i = 0; i < m || carry; i++)
+	{
+		x = (unsigned __int128) (i < m ? d[i * stride] : 0) + carry;
+		carry = (unsigned long) (x >> w);
+		acc |= (x & ((1UL << w) - 1)) << bits;
+		if ((bits += w) >= NBITS)
+		{
+			c[++k] = (long) acc & RADIXM;
+			acc >>= NBITS;
+			bits -= NBITS;
+		}
+	}
+	if (bits)
+		c[++k] = (long) acc;
+	while ((k > 1) && (!(c[k])))
+		k--;
+	c[0] = k;
+	if (zcompare(c, zn) >= 0)
+		zsubpos(c, zn, cc);
+}
+
+static long
+zmv_cpu(
+	)
+{	/* number of lanes of the vector unit found at run time */
+	if (!zmv_lanes)
+	{
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx512f")
+				&& __builtin_cpu_supports("avx512ifma"))
+			zmv_lanes = ZMV_IFMA;
+		else if (__builtin_cpu_supports("avx2"))
+			zmv_lanes = ZMV_AVX2;
+		else
+			zmv_lanes = ZMV_NONE;
+	}
+	return (zmv_lanes);
+}
+
+static long
+zmv_setup(
+	)
+{	/* 1 if the vector kernels can be used with zn, 0 otherwise */
+	register long i;
+
+	if (zmv_cpu() == ZMV_NONE || zn[0] != zntop
+			|| zntop * NBITS > ZMV_MAXBITS)
+		return (0);
+	if (zmv_n && !zcompare(zmv_n, zn))
+		return (1);
+	zcopy(zn, &zmv_n);
+	zmv_s = (ZMV_W - (NBITS * zntop) % ZMV_W) % ZMV_W;
+	zmv_m = (NBITS * zntop + zmv_s) / ZMV_W;
+	for (i = 0; i < ZMV_DIGITS; i++)
+		zmv_nd[i] = 0;
+	zmv_split(zn, 0, ZMV_W, zmv_m, zmv_nd, 1);
+#ifdef PLAIN_OR_KARAT
+	zmv_k0 = (unsigned long) zninv1 + ((unsigned long) zninv2 << NBITSH);
+#else
+	zmv_k0 = (unsigned long) zninv;
+#endif
+	zmv_k0 &= (1UL << ZMV_W) - 1;
+	return (1);
+}
+
+__attribute__((target("avx512f,avx512ifma")))
+static void
+zmv_mul52(
+	unsigned long *a,
+	unsigned long *b,
+	long m,
+	unsigned long *t
+	)
+{	/* t = a * b / 2^(52 * m) + (multiple of zn) with 52 bit digits */
+	register long i;
+	register long j;
+	register long v = (m + 8) >> 3;
+	unsigned long t0;
+	unsigned long mi;
+	unsigned long mask = (1UL << 52) - 1;
+	__m512i acc[ZMV_MAXV];
+	__m512i vb[ZMV_MAXV];
+	__m512i vn[ZMV_MAXV];
+	__m512i va;
+	__m512i vm;
+
+	for (j = 0; j < v; j++)
+	{
+		acc[j] = _mm512_setzero_si512();
+		vb[j] = _mm512_loadu_si512((void *) &b[j << 3]);
+		vn[j] = _mm512_loadu_si512((void *) &zmv_nd[j << 3]);
+	}
+	for (i = 0; i < m; i++)
+	{
+		t0 = (unsigned long) _mm_cvtsi128_si64(_mm512_castsi512_si128(acc[0]))
+			+ ((a[i] * b[0]) & mask);
+		mi = (t0 * zmv_k0) & mask;
+		t0 = (t0 + ((mi * zmv_nd[0]) & mask)) >> 52;
+		va = _mm512_set1_epi64(a[i]);
+		vm = _mm512_set1_epi64(mi);
+		for (j = 0; j < v; j++)
+		{
+			acc[j] = _mm512_madd52lo_epu64(acc[j], va, vb[j]);
+			acc[j] = _mm512_madd52lo_epu64(acc[j], vm, vn[j]);
+		}
+		for (j = 0; j < v - 1; j++)
+			acc[j] = _mm512_alignr_epi64(acc[j + 1], acc[j], 1);
+		acc[v - 1] = _mm512_alignr_epi64(_mm512_setzero_si512(), acc[v - 1], 1);
+		acc[0] = _mm512_add_epi64(acc[0], _mm512_maskz_set1_epi64(1, t0));
+		for (j = 0; j < v; j++)
+		{
+			acc[j] = _mm512_madd52hi_epu64(acc[j], va, vb[j]);
+			acc[j] = _mm512_madd52hi_epu64(acc[j], vm, vn[j]);
+		}
+	}
+	for (j = 0; j < v; j++)
+		_mm512_storeu_si512((void *) &t[j << 3], acc[j]);
+}
+
+__attribute__((target("avx512f,avx512ifma")))
+static void
+zmv_mul52x8(
+	unsigned long *a,
+	unsigned long *b,
+	long m,
+	unsigned long *t
+	)
+{	/* as zmv_mul52 for 8 products, digit j of lane k at [8 * j + k] */
+	register long i;
+	register long j;
+	__m512i *x = (__m512i *) t;
+	__m512i vk = _mm512_set1_epi64(zmv_k0);
+	__m512i va;
+	__m512i vb;
+	__m512i vn;
+	__m512i vm;
+
+	for (i = 0; i <= (m << 1); i++)
+		_mm512_storeu_si512(&x[i], _mm512_setzero_si512());
+	for (i = 0; i < m; i++)
+	{
+		va = _mm512_loadu_si512((void *) &a[i << 3]);
+		vm = _mm512_madd52lo_epu64(_mm512_loadu_si512(&x[i]), va,
+			_mm512_loadu_si512((void *) &b[0]));
+		vm = _mm512_madd52lo_epu64(_mm512_setzero_si512(), vm, vk);
+		for (j = 0; j < m; j++)
+		{
+			vb = _mm512_loadu_si512((void *) &b[j << 3]);
+			vn = _mm512_set1_epi64(zmv_nd[j]);
+			_mm512_storeu_si512(&x[i + j], _mm512_madd52lo_epu64(
+				_mm512_madd52lo_epu64(_mm512_loadu_si512(&x[i + j]),
+				va, vb), vm, vn));
+			_mm512_storeu_si512(&x[i + j + 1], _mm512_madd52hi_epu64(
+				_mm512_madd52hi_epu64(_mm512_loadu_si512(&x[i + j + 1]),
+				va, vb), vm, vn));
+		}
+		_mm512_storeu_si512(&x[i + 1], _mm512_add_epi64(
+			_mm512_loadu_si512(&x[i + 1]),
+			_mm512_srli_epi64(_mm512_loadu_si512(&x[i]), 52)));
+	}
+}
+
+__attribute__((target("avx2")))
+static void
+zmv_mul26x4(
+	unsigned long *a,
+	unsigned long *b,
+	long m,
+	unsigned long *t
+	)
+{	/* as zmv_mul52x8 for 4 products with 26 bit digits */
+	register long i;
+	register long j;
+	__m256i *x = (__m256i *) t;
+	__m256i vk = _mm256_set1_epi64x(zmv_k0);
+	__m256i mask = _mm256_set1_epi64x((1L << 26) - 1);
+	__m256i va;
+	__m256i vm;
+
+	for (i = 0; i <= (m << 1); i++)
+		_mm256_storeu_si256(&x[i], _mm256_setzero_si256());
+	for (i = 0; i < m; i++)
+	{
+		va = _mm256_loadu_si256((__m256i *) &a[i << 2]);
+		vm = _mm256_add_epi64(_mm256_loadu_si256(&x[i]),
+			_mm256_mul_epu32(va, _mm256_loadu_si256((__m256i *) &b[0])));
+		vm = _mm256_and_si256(_mm256_mul_epu32(
+			_mm256_and_si256(vm, mask), vk), mask);
+		for (j = 0; j < m; j++)
+			_mm256_storeu_si256(&x[i + j], _mm256_add_epi64(
+				_mm256_loadu_si256(&x[i + j]), _mm256_add_epi64(
+				_mm256_mul_epu32(va,
+					_mm256_loadu_si256((__m256i *) &b[j << 2])),
+				_mm256_mul_epu32(vm,
+					_mm256_set1_epi64x(zmv_nd[j])))));
+		_mm256_storeu_si256(&x[i + 1], _mm256_add_epi64(
+			_mm256_loadu_si256(&x[i + 1]),
+			_mm256_srli_epi64(_mm256_loadu_si256(&x[i]), 26)));
+	}
 }
 
-void
-zmontadd(
+static long
+zmont_simd(
 	verylong a,
 	verylong b,
-	verylong *c
+	verylong *cc
 	)
-{
-	if (!zn)
-	{
-		zhalt("undefined Montgomery modulus in zmontadd");
-		return;
-	}
-	zaddmod(a, b, zn, c);
+{	/* *cc = a * b / RADIX^zntop mod zn if zmv_mul52 can do it */
+	unsigned long da[ZMV_DIGITS];
+	unsigned long db[ZMV_DIGITS];
+	unsigned long t[ZMV_DIGITS];
+	register long i;
+
+	if (zntop < MONT_SIMD_CROV || a[0] <= 0 || b[0] <= 0
+			|| a[0] > zntop || b[0] > zntop
+			|| !zmv_setup() || zmv_lanes != ZMV_IFMA)
+		return (0);
+	zmv_split(a, zmv_s, 52, zmv_m, da, 1);
+	zmv_split(b, 0, 52, zmv_m, db, 1);
+	for (i = zmv_m; i < zmv_m + 8; i++)
+		db[i] = 0;
+	zmv_mul52(da, db, zmv_m, t);
+	zmv_join(t, 1, 52, zmv_m, cc);
+	return (1);
 }
 
-void
-zmontsub(
-	verylong a,
-	verylong b,
+static void
+zmont_batch(
+	long k,
+	verylong *a,
+	verylong *b,
 	verylong *c
 	)
-{
-	if (!zn)
+{	/* c[i] = a[i] * b[i] / RADIX^zntop mod zn, a[i] * a[i] if b == 0 */
+	unsigned long da[ZMV_DIGITS * ZMV_IFMA];
+	unsigned long db[ZMV_DIGITS * ZMV_IFMA];
+	unsigned long t[2 * ZMV_DIGITS * ZMV_IFMA];
+	register long i;
+	register long j;
+	register long l;
+	register long vec = zmv_setup()
+		&& (zmv_lanes == ZMV_IFMA || zntop >= MONT_SIMD_CROV);
+	verylong x;
+	verylong y;
+
+	for (l = 0; vec && l < k; l += zmv_lanes)
 	{
-		zhalt("undefined Montgomery modulus in zmontsub");
-		return;
+		for (i = 0; i < zmv_lanes; i++)
+		{
+			x = (l + i < k ? a[l + i] : 0);
+			y = (l + i < k ? (b ? b[l + i] : x) : 0);
+			if (x && y && (x[0] <= 0 || x[0] > zntop
+					|| y[0] <= 0 || y[0] > zntop))
+				break;
+			if (!x || !y)
+			{
+				for (j = 0; j < zmv_m; j++)
+					da[j * zmv_lanes + i] = db[j * zmv_lanes + i] = 0;
+				continue;
+			}
+			zmv_split(x, zmv_s, ZMV_W, zmv_m, &da[i], zmv_lanes);
+			zmv_split(y, 0, ZMV_W, zmv_m, &db[i], zmv_lanes);
+		}
+		if (i < zmv_lanes)
+			break;
+		if (zmv_lanes == ZMV_IFMA)
+			zmv_mul52x8(da, db, zmv_m, t);
+		else
+			zmv_mul26x4(da, db, zmv_m, t);
+		for (i = 0; i < zmv_lanes && l + i < k; i++)
+			zmv_join(&t[zmv_m * zmv_lanes + i], zmv_lanes, ZMV_W,
+				zmv_m + 1, &c[l + i]);
 	}
-	zsubmod(a, b, zn, c);
-}
-
-void
-zsmontmul(
-	verylong a,
-	long d,
-	verylong *c
-	)
-{
-	if (!zn)
+	for (; l < k; l++)
 	{
-		zhalt("undefined Montgomery modulus in zsmontmul");
-		return;
+		if (b)
+			zmontmul(a[l], b[l], &c[l]);
+		else
+			zmontsq(a[l], &c[l]);
 	}
-	zsmulmod(a, d, zn, c);
 }
+#endif
 
 void
 zmontmul(
@@ -3600,37 +7314,47 @@ zmontmul(
 	)
 {
 	register long i;
-	register long j;
 	verylong c = *cc;
 	STATIC verylong x = 0;
 	verylong px;
 	verylong pc;
+	ZCOUNT_IN(montmul, ZCOUNT_LEN(a) + ZCOUNT_LEN(b));
 
 	if (!zn)
 	{
 		zhalt("undefined Montgomery modulus in zmontmul");
+		ZCOUNT_OUT(montmul);
 		return;
 	}
 	if (ALLOCATE && (!a || !b))
 	{
 		zzero(cc);
+		ZCOUNT_OUT(montmul);
+		return;
+	}
+#ifdef MONT_SIMD
+	if (zmont_simd(a, b, cc))
+	{
+		ZCOUNT_OUT(montmul);
+		return;
+	}
+#endif
+#ifndef NO_MONT_FIXED
+	if (zmont_fixed(a, b, cc))
+	{
+		ZCOUNT_OUT(montmul);
 		return;
 	}
+#endif
 	zsetlength(&x, (i = (zntop << 1) + 1), "in zmontmul, local");
 	zsetlength(&c, zntop, "in zmontmul, third argument");
 	if (a == *cc) a = c;
 	if (b == *cc) b = c;
 	*cc = c;
-        if (!kar_mem_initialized)
-        {
-                kar_mem_initialized = 1;
-                for (j = (5 * KAR_DEPTH) - 1; j >= 0; j--)
-                        kar_mem[j] = (verylong) 0;
-        }
 	if (*a <= *b)
-		kar_mul(b, a, &x, (long) 0);
+		kar_mul_top(b, a, &x, &kar_scratch);
 	else
-		kar_mul(a, b, &x, (long) 0);
+		kar_mul_top(a, b, &x, &kar_scratch);
 	for (; i > x[0]; i--)
 		x[i] = (long) 0;
 	px = &x[1];
@@ -3647,6 +7371,7 @@ zmontmul(
 		zsubpos(c, zn, &c);
 	*cc = c;
 	FREESPACE(x);
+	ZCOUNT_OUT(montmul);
 }
 
 void
@@ -3656,33 +7381,43 @@ zmontsq(
 	)
 {
 	register long i;
-	register long j;
 	verylong c = *cc;
 	STATIC verylong x = 0;
 	verylong px;
 	verylong pc;
+	ZCOUNT_IN(montsq, ZCOUNT_LEN(a));
 
 	if (!zn)
 	{
 		zhalt("undefined Montgomery modulus in zmontsq");
+		ZCOUNT_OUT(montsq);
 		return;
 	}
 	if (ALLOCATE && !a)
 	{
 		zzero(cc);
+		ZCOUNT_OUT(montsq);
+		return;
+	}
+#ifdef MONT_SIMD
+	if (zmont_simd(a, a, cc))
+	{
+		ZCOUNT_OUT(montsq);
+		return;
+	}
+#endif
+#ifndef NO_MONT_FIXED
+	if (zmont_fixed(a, (verylong) 0, cc))
+	{
+		ZCOUNT_OUT(montsq);
 		return;
 	}
+#endif
 	zsetlength(&x, (i = (zntop << 1) + 1), "in zmontsq, local");
 	zsetlength(&c, zntop, "in zmontsq, third argument");
 	if (a == *cc) a = c;
 	*cc = c;
-        if (!kar_mem_initialized)
-        {
-                kar_mem_initialized = 1;
-                for (j = (5 * KAR_DEPTH) - 1; j >= 0; j--)
-                        kar_mem[j] = (verylong) 0;
-        }
-	kar_sq(a, &x, (long) 0);
+	kar_sq_top(a, &x, &kar_scratch);
 	for (; i > x[0]; i--)
 		x[i] = (long) 0;
 	px = &x[1];
@@ -3699,6 +7434,67 @@ zmontsq(
 		zsubpos(c, zn, &c);
 	*cc = c;
 	FREESPACE(x);
+	ZCOUNT_OUT(montsq);
+}
+
+void
+zmontmul_batch(
+	long k,
+	verylong *a,
+	verylong *b,
+	verylong *c
+	)
+{
+	if (!zn)
+	{
+		zhalt("undefined Montgomery modulus in zmontmul_batch");
+		return;
+	}
+#ifdef MONT_SIMD
+	zmont_batch(k, a, b, c);
+#else
+	{
+		register long i;
+
+		for (i = 0; i < k; i++)
+			zmontmul(a[i], b[i], &c[i]);
+	}
+#endif
+}
+
+void
+zmontsq_batch(
+	long k,
+	verylong *a,
+	verylong *c
+	)
+{
+	if (!zn)
+	{
+		zhalt("undefined Montgomery modulus in zmontsq_batch");
+		return;
+	}
+#ifdef MONT_SIMD
+	zmont_batch(k, a, (verylong *) 0, c);
+#else
+	{
+		register long i;
+
+		for (i = 0; i < k; i++)
+			zmontsq(a[i], &c[i]);
+	}
+#endif
+}
+
+long
+zmontlanes(
+	)
+{
+#ifdef MONT_SIMD
+	return (zmv_cpu());
+#else
+	return (1);
+#endif
 }
 
 void
@@ -3782,6 +7578,27 @@ zmontinv(
 	zmontmul(*c, zrrr, c);
 }
 
+void
+zmontinv_batch(
+	verylong *in,
+	long count,
+	verylong *out
+	)
+{
+	if (!zn)
+	{
+		zhalt("undefined Montgomery modulus in zmontinv_batch");
+		return;
+	}
+	if (in == out)
+	{
+		zhalt("input and output the same in zmontinv_batch");
+		return;
+	}
+	if (zinv_batch(in, count, zn, out, 1))
+		zhalt("undefined inverse in zmontinv_batch");
+}
+
 
 void
 zrstarts(
@@ -4014,13 +7831,22 @@ zxxeucl(
 	double num;
 	double den;
 	double dirt;
+	ZCOUNT_IN(gcd, ZCOUNT_LEN(ain) + ZCOUNT_LEN(nin));
 
 #ifndef START
 	if (fudge < 0)
 		zstart();
 #endif
-	zsetlength(&a, (e = (ain[-1] > nin[-1] ? ain[-1] : nin[-1])), 
-	           "in zxxeucl, locals\n");
+	if (ain[0] >= HGCD_CROV && nin[0] >= HGCD_CROV)
+	{
+		zgcd_fast(ain, nin, uu, invv);
+		ZCOUNT_OUT(gcd);
+		return (zcompare(*uu, one) != 0);
+	}
+	e = ZCAP(ain);
+	if (ZCAP(nin) > e)
+		e = ZCAP(nin);
+	zsetlength(&a, e, "in zxxeucl, locals\n");
 	zsetlength(&n, e, "");
 	zsetlength(&q, e, "");
 	zsetlength(&w, e, "");
@@ -4174,6 +8000,7 @@ zxxeucl(
 	*invv = inv;
 	*uu = u;
 	FREE2SPACE(a,n); FREE2SPACE(q,w); FREE2SPACE(x,y); FREESPACE(z);
+	ZCOUNT_OUT(gcd);
 	return (e);
 }
 
@@ -4184,7 +8011,7 @@ zinv(
 	verylong *invv
 	)
 {
-	static verylong u = 0;
+	static TLS verylong u = 0;
 
 	if ((!nin) || (!ain) || (ain[0] < 0) || (nin[0] < 0))
 	{
@@ -4430,6 +8257,7 @@ zexpmod(
 	register long j;
 	register long k = 0;
 	verylong b = *bb;
+	zspecial *sm;
 	STATIC verylong loca = 0;
 
 	if (ALLOCATE && !n)
@@ -4451,6 +8279,22 @@ zexpmod(
 		i = (-i);
 	if ((i == 1) && (!(e[1])))
 		zone(&b);
+	else if ((sm = zspecial_last(n)))
+	{
+		zcopy(e, &loca);
+		loca[0] = i;
+		zspecial_expmod(sm, a, loca, &b);
+	}
+	else if (n[0] >= 2)
+	{
+		/* sliding windows with Barrett reduction, which unlike
+		   Montgomery does not need n odd */
+		if (!barrett_cache.n || zcompare(barrett_cache.n, n))
+			zbarrett_init(&barrett_cache, n);
+		zcopy(e, &loca);
+		loca[0] = i;
+		zbarrett_expmod(&barrett_cache, a, loca, &b);
+	}
 	else
 	{
 		zmod(a, n, &loca);
@@ -4828,6 +8672,9 @@ zexpmod_m_ary(
 	register long i;
 	register long ei;
 	STATIC verylong a_sq = 0;
+#ifndef NO_MONT_FIXED
+	static TLS zmont_ctx nctx = {0};
+#endif
 
 	if (ALLOCATE && !n)
 	{
@@ -4851,6 +8698,18 @@ zexpmod_m_ary(
 		zexpmod(a, e, n, bb);
 		return;
 	}
+#ifndef NO_MONT_FIXED
+	if (e[0] > 0 && zmont_fixed_size(n))
+	{
+		/* Montgomery with a fixed size kernel, nctx keeps the last n */
+		zmont_ctx_init(&nctx, n);
+		ztom_ctx(&nctx, a, &a_sq);
+		zmontexp_m_ary_ctx(&nctx, a_sq, e, bb, m);
+		zmtoz_ctx(&nctx, *bb, bb);
+		FREESPACE(a_sq);
+		return;
+	}
+#endif
 	if (!exp_odd_powers)
 	{
 		exp_odd_powers = (verylong **)malloc((size_t)(NBITS * sizeof(verylong *)));
@@ -5651,76 +9510,700 @@ zmontexp_doub2(
 		for (i=1;i<4;i++) if ((i&1) | (j&1))
 			zmontmul(tab[j][0],tab[0][i],&(tab[j][i]));
 	}
-
-	block = z2log(e1)-1;
-	mask = ( 1L<<(block % NBITS) );
-	block = (block / NBITS) +1;
-	bit11 = 1;
-	bit21 = (e2[block]&mask) ? 1 : 0;
+
+	block = z2log(e1)-1;
+	mask = ( 1L<<(block % NBITS) );
+	block = (block / NBITS) +1;
+	bit11 = 1;
+	bit21 = (e2[block]&mask) ? 1 : 0;
+	mask >>= 1;
+	if (!mask) {
+		block --;
+		if (!block) {
+			zcopy(tab[1][bit21],r);
+			FREE2SPACE(e1,e2);
+                        for (i=0; i<4;i++)
+                                for (j=0; j<4; j++)
+                                        FREESPACE(tab[i][j]);
+			return;
+		}
+		mask = ( 1L<<(NBITS-1) );
+	}
+	bit12 = (e1[block]&mask) ? 1 : 0;
+	bit22 = (e2[block]&mask) ? 1 : 0;
+	if (bit12 || bit22) {
+		zcopy(tab[2+bit12][(bit21<<1)+bit22],r);
+	} else {
+		zcopy(tab[bit11][bit21],r);
+		zmontsq(*r,r);
+	}
+
+#define MONT_SECOND \
+	mask >>= 1; \
+	if (!mask) { \
+		block--; \
+		if (!block) { \
+			zmontsq(*r,r); \
+			if (bit11||bit21) \
+				zmontmul(tab[bit11][bit21],*r,r); \
+                        FREE2SPACE(e1,e2); \
+                        for (i=0; i<4;i++) \
+                                for (j=0; j<4; j++) \
+                                        FREESPACE(tab[i][j]); \
+			return; \
+		} \
+		mask = ( 1L<<(NBITS-1) ); \
+	} \
+        bit12 = (e1[block]&mask) ? 1 : 0; \
+        bit22 = (e2[block]&mask) ? 1 : 0;
+
+	MONT_FIRST
+	MONT_SECOND
+	for (;;) {
+		zmontsq(*r,r);
+		if (bit11 || bit21) {
+			if (bit12 || bit22) {
+			  zmontsq(*r,r);
+			  zmontmul(tab[(bit11<<1)+bit12][(bit21<<1)+bit22],*r,r);
+			} else {
+			  zmontmul(tab[bit11][bit21],*r,r);
+			  zmontsq(*r,r);
+			}
+			MONT_FIRST
+		} else {
+			bit11 = bit12;
+			bit21 = bit22;
+		}
+		MONT_SECOND
+	}
+}
+
+void
+zmontexp_doub3(
+	verylong xx1,
+	verylong ee1,
+	verylong xx2,
+	verylong ee2,
+	verylong *r
+	)
+{
+	register long i,j, mask, block;
+	register long bit11, bit12, bit13, bit21, bit22, bit23;
+	STATIC verylong tab[8][8];
+	STATIC long non_ini = 1;
+	STATIC verylong e1 = 0;
+	STATIC verylong e2 = 0;
+        if (!zn)
+        {
+                zhalt("undefined Montgomery modulus in zmontexp_doub3");
+                return;
+        }
+        if ((zscompare(ee1,0)<0) || (zscompare(ee2,0)<0)) {
+                zhalt("negative exponent in zmontexp_doub3");
+                zintoz(0,r);
+                return;
+        }
+	if (non_ini) {
+		for (i=0;i<8;i++) for (j=0;j<8;j++)
+			tab[i][j] = 0;
+		non_ini = 0;
+	}
+
+	MONT_INITPAR
+
+	zmontsq(tab[1][0],&(tab[2][0]));
+	zmontsq(tab[0][1],&(tab[0][2]));
+	for (i=3;i<8;i+=2) zmontmul(tab[2][0],tab[i-2][0],&(tab[i][0]));
+	for (i=3;i<8;i+=2) zmontmul(tab[0][2],tab[0][i-2],&(tab[0][i]));
+	for (i=1;i<8;i++) zmontmul(tab[0][1],tab[1][i-1],&(tab[1][i]));
+        for (i=1;i<8;i+=2) zmontmul(tab[0][i],tab[2][0],&(tab[2][i]));
+        for (i=1;i<8;i++) zmontmul(tab[0][1],tab[3][i-1],&(tab[3][i]));
+	for (j=4;j<8;j++) {
+		zmontmul(tab[1][0],tab[j-1][1],&(tab[j][1]));
+		for (i=3;i<8;i+=2) zmontmul(tab[0][2],tab[j][i-2],&(tab[j][i]));
+		j++;
+		for (i=1;i<8;i++) zmontmul(tab[0][1],tab[j][i-1],&(tab[j][i]));
+	}
+        block = z2log(e1)-1;
+        mask = ( 1L<<(block % NBITS) );
+        block = (block / NBITS) +1;
+        bit11 = 1;
+        bit21 = (e2[block]&mask) ? 1 : 0;
+        mask >>= 1;
+        if (!mask) {
+                block --;
+                if (!block) {
+                        zcopy(tab[1][bit21],r);
+			FREE2SPACE(e1,e2);
+                        for (i=0; i<8;i++)
+                                for (j=0; j<8; j++)
+                                        FREESPACE(tab[i][j]);
+                        return;
+                }
+                mask = ( 1L<<(NBITS-1) );
+        }
+        bit12 = (e1[block]&mask) ? 1 : 0;
+        bit22 = (e2[block]&mask) ? 1 : 0;
 	mask >>= 1;
 	if (!mask) {
 		block --;
 		if (!block) {
-			zcopy(tab[1][bit21],r);
+			if (bit12 || bit22) {
+				zcopy(tab[2+bit12][(bit21<<1)+bit22],r);
+			} else {
+                		zcopy(tab[bit11][bit21],r);
+                		zmontsq(*r,r);
+			}
 			FREE2SPACE(e1,e2);
-                        for (i=0; i<4;i++)
-                                for (j=0; j<4; j++)
+                        for (i=0; i<8;i++)
+                                for (j=0; j<8; j++)
                                         FREESPACE(tab[i][j]);
 			return;
 		}
 		mask = ( 1L<<(NBITS-1) );
 	}
-	bit12 = (e1[block]&mask) ? 1 : 0;
-	bit22 = (e2[block]&mask) ? 1 : 0;
-	if (bit12 || bit22) {
-		zcopy(tab[2+bit12][(bit21<<1)+bit22],r);
+	bit13 = (e1[block]&mask) ? 1 : 0;
+        bit23 = (e2[block]&mask) ? 1 : 0;
+	if (bit13 || bit23) {
+		zcopy(tab[4+(bit12<<1)+bit13][(bit21<<2)+(bit22<<1)+bit23],r);
 	} else {
-		zcopy(tab[bit11][bit21],r);
+		if (bit12 || bit22) {
+			zcopy(tab[2+bit12][(bit21<<1)+bit22],r);
+		} else {
+			zcopy(tab[1][bit21],r);
+			zmontsq(*r,r);
+		}
 		zmontsq(*r,r);
 	}
 
-#define MONT_SECOND \
+#define MONT_THIRD \
 	mask >>= 1; \
 	if (!mask) { \
-		block--; \
-		if (!block) { \
+		block --; \
+                if (!block) { \
 			zmontsq(*r,r); \
-			if (bit11||bit21) \
-				zmontmul(tab[bit11][bit21],*r,r); \
-                        FREE2SPACE(e1,e2); \
-                        for (i=0; i<4;i++) \
-                                for (j=0; j<4; j++) \
+			if (bit11 || bit21) { \
+				if (bit12 || bit22) { \
+				  zmontsq(*r,r); \
+				  zmontmul(tab[(bit11<<1)+bit12][(bit21<<1)+bit22],*r,r); \
+				} else { \
+				  zmontmul(tab[bit11][bit21],*r,r); \
+				  zmontsq(*r,r); \
+				} \
+			} else { \
+				zmontsq(*r,r); \
+				if (bit12 || bit22) { \
+					zmontmul(tab[bit12][bit22],*r,r); \
+				} \
+			} \
+			FREE2SPACE(e1,e2); \
+                        for (i=0; i<8;i++) \
+                                for (j=0; j<8; j++) \
                                         FREESPACE(tab[i][j]); \
 			return; \
 		} \
 		mask = ( 1L<<(NBITS-1) ); \
 	} \
-        bit12 = (e1[block]&mask) ? 1 : 0; \
-        bit22 = (e2[block]&mask) ? 1 : 0;
+	bit13 = (e1[block]&mask) ? 1 : 0; \
+        bit23 = (e2[block]&mask) ? 1 : 0;
 
 	MONT_FIRST
 	MONT_SECOND
+	MONT_THIRD
+
 	for (;;) {
 		zmontsq(*r,r);
 		if (bit11 || bit21) {
-			if (bit12 || bit22) {
-			  zmontsq(*r,r);
-			  zmontmul(tab[(bit11<<1)+bit12][(bit21<<1)+bit22],*r,r);
+			if (bit13 || bit23) {
+				zmontsq(*r,r);
+				zmontsq(*r,r);
+				zmontmul(tab[(bit11<<2)+(bit12<<1)+bit13]
+					    [(bit21<<2)+(bit22<<1)+bit23],*r,r);
 			} else {
-			  zmontmul(tab[bit11][bit21],*r,r);
-			  zmontsq(*r,r);
+				if (bit12 || bit22) {
+					zmontsq(*r,r);
+					zmontmul(tab[(bit11<<1)+bit12]
+						    [(bit21<<1)+bit22],*r,r);
+				} else {
+					zmontmul(tab[bit11][bit21],*r,r);
+					zmontsq(*r,r);
+				}
+				zmontsq(*r,r);
 			}
 			MONT_FIRST
+			MONT_SECOND
 		} else {
 			bit11 = bit12;
 			bit21 = bit22;
+			bit12 = bit13;
+			bit22 = bit23;
+		}
+		MONT_THIRD
+	}
+}
+
+
+void
+zmontexp_doub(
+	verylong xx1,
+	verylong ee1,
+	verylong xx2,
+	verylong ee2,
+	verylong *r
+	)
+{
+        if (!zn)
+        {
+                zhalt("undefined Montgomery modulus in zmontexp_doub");
+                return;
+        }
+        if ((zscompare(ee1,0)<0) || (zscompare(ee2,0)<0)) {
+                zhalt("negative exponent in zmontexp_doub");
+                zintoz(0,r);
+                return;
+        }
+	if (zscompare(ee1,1L<<NBITS)<0 && zscompare(ee2,1L<<NBITS)<0)
+		zmontexp_doub1(xx1,ee1,xx2,ee2,r);
+	else if (ee1[0]<10 && ee2[0]<10)
+		zmontexp_doub2(xx1,ee1,xx2,ee2,r);
+	else
+		zmontexp_doub3(xx1,ee1,xx2,ee2,r);
+}
+
+/*
+	Products of k powers x[0]^e[0] ... x[k-1]^e[k-1] of Montgomery
+	numbers, with one squaring chain for all of them. For fewer than
+	PIPPENGER_CROV bases each base gets its own table of odd powers
+	and sliding windows, interleaved (Straus); for more, the
+	exponents are cut into c-bit digits and, per digit position, the
+	bases are sorted into 2^c - 1 buckets by their digit, which are
+	then combined with 2^(c+1) multiplications (Pippenger).
+*/
+
+static long
+zmulti_bits(
+	verylong e,
+	long p,
+	long c
+	)
+{	/* bits p .. p+c-1 of e >= 0, c < NBITS */
+	register long i = p / NBITS + 1;
+	register long s = p % NBITS;
+	register unsigned long d;
+
+	if (!e || i > e[0])
+		return (0);
+	d = ((unsigned long) e[i]) >> s;
+	if (s + c > NBITS && i < e[0])
+		d |= ((unsigned long) e[i + 1]) << (NBITS - s);
+	return ((long) (d & ((1UL << c) - 1)));
+}
+
+static void
+zmulti_window(
+	verylong e,
+	long w,
+	long *st
+	)
+{	/* st[0] next bit to scan, st[1] end of window or -1, st[2] its value */
+	register long p = st[0];
+	register long lo;
+
+	while (p >= 0 && !zbit(e, p))
+		p--;
+	if (p < 0)
+	{
+		st[1] = -1;
+		return;
+	}
+	if ((lo = p - w + 1) < 0)
+		lo = 0;
+	while (!zbit(e, lo))
+		lo++;
+	st[1] = lo;
+	st[2] = zmulti_bits(e, lo, p - lo + 1);
+	st[0] = lo - 1;
+}
+
+static void
+zmulti_straus(
+	verylong *x,
+	verylong *e,
+	long k,
+	long bits,
+	verylong *rr
+	)
+{
+	register long i;
+	register long j;
+	register long t;
+	long n = 0;
+	long first = 1;
+	long *st;
+	verylong *tab;
+	STATIC verylong sq = 0;
+
+	if (!(st = (long *)malloc((size_t)(k * 5 * sizeof(long)))))
+	{
+		zhalt("allocation failure in zmontexp_multi");
+		return;
+	}
+	for (i = 0; i < k; i++)
+	{
+		st[5 * i + 3] = n;
+		if (ziszero(e[i]))
+		{
+			st[5 * i + 1] = -1;
+			continue;
+		}
+		st[5 * i + 4] = zdefault_m(e[i][0]);
+		n += 1L << (st[5 * i + 4] - 1);
+	}
+	if (!(tab = (verylong *)calloc((size_t)(n ? n : 1), sizeof(verylong))))
+	{
+		free((void *)st);
+		zhalt("allocation failure in zmontexp_multi");
+		return;
+	}
+	for (i = 0; i < k; i++)
+	{
+		if (ziszero(e[i]))
+			continue;
+		t = st[5 * i + 3];
+		zcopy(x[i], &tab[t]);
+		zmontsq(x[i], &sq);
+		for (j = (1L << (st[5 * i + 4] - 1)) - 1; j; j--, t++)
+			zmontmul(tab[t], sq, &tab[t + 1]);
+		st[5 * i] = bits - 1;
+		zmulti_window(e[i], st[5 * i + 4], &st[5 * i]);
+	}
+	for (j = bits - 1; j >= 0; j--)
+	{
+		if (!first)
+			zmontsq(*rr, rr);
+		for (i = 0; i < k; i++)
+		{
+			if (st[5 * i + 1] != j)
+				continue;
+			t = st[5 * i + 3] + (st[5 * i + 2] >> 1);
+			if (first)
+			{
+				zcopy(tab[t], rr);
+				first = 0;
+			}
+			else
+				zmontmul(*rr, tab[t], rr);
+			zmulti_window(e[i], st[5 * i + 4], &st[5 * i]);
+		}
+	}
+	for (t = 0; t < n; t++)
+		zfree(&tab[t]);
+	free((void *)tab);
+	free((void *)st);
+	FREESPACE(sq);
+}
+
+static void
+zmulti_pippenger(
+	verylong *x,
+	verylong *e,
+	long k,
+	long bits,
+	verylong *rr
+	)
+{
+	register long i;
+	register long j;
+	register long d;
+	long c = 1;
+	long t;
+	long nb;
+	long first = 1;
+	long rf;
+	long af;
+	double cost;
+	double best = -1.0;
+	long *used;
+	verylong *bk;
+	STATIC verylong run = 0;
+	STATIC verylong acc = 0;
+
+	for (j = 1; j < 20 && j < NBITS; j++)
+	{
+		cost = (double) ((bits + j - 1) / j) * (double) (k + (2L << j));
+		if (best < 0 || cost < best)
+		{
+			best = cost;
+			c = j;
+		}
+	}
+	nb = 1L << c;
+	used = (long *)malloc((size_t)(nb * sizeof(long)));
+	bk = (verylong *)calloc((size_t)nb, sizeof(verylong));
+	if (!used || !bk)
+	{
+		if (used)
+			free((void *)used);
+		if (bk)
+			free((void *)bk);
+		zhalt("allocation failure in zmontexp_multi");
+		return;
+	}
+	for (t = (bits - 1) / c; t >= 0; t--)
+	{
+		if (!first)
+			for (j = c; j; j--)
+				zmontsq(*rr, rr);
+		for (d = 1; d < nb; d++)
+			used[d] = 0;
+		for (i = 0; i < k; i++)
+		{
+			if (!(d = zmulti_bits(e[i], t * c, c)))
+				continue;
+			if (used[d])
+				zmontmul(bk[d], x[i], &bk[d]);
+			else
+			{
+				zcopy(x[i], &bk[d]);
+				used[d] = 1;
+			}
+		}
+		rf = af = 0;
+		for (d = nb - 1; d; d--)
+		{
+			if (used[d])
+			{
+				if (rf)
+					zmontmul(run, bk[d], &run);
+				else
+					zcopy(bk[d], &run);
+				rf = 1;
+			}
+			if (!rf)
+				continue;
+			if (af)
+				zmontmul(acc, run, &acc);
+			else
+				zcopy(run, &acc);
+			af = 1;
+		}
+		if (!af)
+			continue;
+		if (first)
+		{
+			zcopy(acc, rr);
+			first = 0;
+		}
+		else
+			zmontmul(*rr, acc, rr);
+	}
+	for (d = 0; d < nb; d++)
+		zfree(&bk[d]);
+	free((void *)bk);
+	free((void *)used);
+	FREE2SPACE(run,acc);
+}
+
+void
+zmontexp_multi(
+	verylong *x,
+	verylong *e,
+	long k,
+	verylong *rr
+	)
+{
+	register long i;
+	register long l;
+	long bits = 0;
+	STATIC verylong r = 0;
+
+	if (!zn)
+	{
+		zhalt("undefined Montgomery modulus in zmontexp_multi");
+		return;
+	}
+	for (i = 0; i < k; i++)
+	{
+		if (ziszero(e[i]))
+			continue;
+		if (e[i][0] < 0)
+		{
+			zhalt("negative exponent in zmontexp_multi");
+			zintoz(0, rr);
+			return;
+		}
+		if (ALLOCATE && !x[i])
+		{
+			zzero(rr);
+			return;
 		}
-		MONT_SECOND
+		if ((l = z2log(e[i])) > bits)
+			bits = l;
+	}
+	if (!bits)
+	{
+		zcopy(zr, rr);
+		return;
 	}
+	if (k < PIPPENGER_CROV)
+		zmulti_straus(x, e, k, bits, &r);
+	else
+		zmulti_pippenger(x, e, k, bits, &r);
+	zcopy(r, rr);
+	FREESPACE(r);
+}
+
+/*
+	Montgomery contexts. zmont_swap exchanges the contents of *m with
+	the current Montgomery state (zn, zr, ...), so a _ctx function
+	swaps m in, calls the ordinary function and swaps back, which
+	costs a few assignments instead of a zmstart. Anything the
+	ordinary function reallocates ends up back in *m.
+*/
+
+static void
+zmont_swap(
+	zmont_ctx *m
+	)
+{
+	verylong t;
+	long l;
+
+	t = zn;
+	zn = m->n;
+	m->n = t;
+	t = zr;
+	zr = m->r;
+	m->r = t;
+	t = zrr;
+	zrr = m->rr;
+	m->rr = t;
+	t = zrrr;
+	zrrr = m->rrr;
+	m->rrr = t;
+	t = znm;
+	znm = m->nm;
+	m->nm = t;
+	l = zntop;
+	zntop = m->top;
+	m->top = l;
+#ifdef PLAIN_OR_KARAT
+	l = zninv1;
+	zninv1 = m->inv1;
+	m->inv1 = l;
+	l = zninv2;
+	zninv2 = m->inv2;
+	m->inv2 = l;
+#else
+	l = zninv;
+	zninv = m->inv1;
+	m->inv1 = l;
+#endif
 }
 
 void
-zmontexp_doub3(
+zmont_ctx_init(
+	zmont_ctx *m,
+	verylong n
+	)
+{
+	zmont_swap(m);
+	zmstartint(n);
+	zmont_swap(m);
+}
+
+void
+zmont_ctx_free(
+	zmont_ctx *m
+	)
+{
+	zfree(&(m->n));
+	zfree(&(m->r));
+	zfree(&(m->rr));
+	zfree(&(m->rrr));
+	zfree(&(m->nm));
+	m->top = 0;
+}
+
+void
+ztom_ctx(
+	zmont_ctx *m,
+	verylong a,
+	verylong *b
+	)
+{
+	zmont_swap(m);
+	ztom(a, b);
+	zmont_swap(m);
+}
+
+void
+zmtoz_ctx(
+	zmont_ctx *m,
+	verylong a,
+	verylong *b
+	)
+{
+	zmont_swap(m);
+	zmtoz(a, b);
+	zmont_swap(m);
+}
+
+void
+zmontmul_ctx(
+	zmont_ctx *m,
+	verylong a,
+	verylong b,
+	verylong *c
+	)
+{
+	zmont_swap(m);
+	zmontmul(a, b, c);
+	zmont_swap(m);
+}
+
+void
+zmontsq_ctx(
+	zmont_ctx *m,
+	verylong a,
+	verylong *c
+	)
+{
+	zmont_swap(m);
+	zmontsq(a, c);
+	zmont_swap(m);
+}
+
+void
+zmontexp_ctx(
+	zmont_ctx *m,
+	verylong a,
+	verylong e,
+	verylong *b
+	)
+{
+	zmont_swap(m);
+	zmontexp(a, e, b);
+	zmont_swap(m);
+}
+
+void
+zmontexp_m_ary_ctx(
+	zmont_ctx *m,
+	verylong a,
+	verylong e,
+	verylong *b,
+	long k
+	)
+{
+	zmont_swap(m);
+	zmontexp_m_ary(a, e, b, k);
+	zmont_swap(m);
+}
+
+void
+zmontexp_doub_ctx(
+	zmont_ctx *m,
 	verylong xx1,
 	verylong ee1,
 	verylong xx2,
@@ -5728,187 +10211,247 @@ zmontexp_doub3(
 	verylong *r
 	)
 {
-	register long i,j, mask, block;
-	register long bit11, bit12, bit13, bit21, bit22, bit23;
-	STATIC verylong tab[8][8];
-	STATIC long non_ini = 1;
-	STATIC verylong e1 = 0;
-	STATIC verylong e2 = 0;
-        if (!zn)
-        {
-                zhalt("undefined Montgomery modulus in zmontexp_doub3");
-                return;
-        }
-        if ((zscompare(ee1,0)<0) || (zscompare(ee2,0)<0)) {
-                zhalt("negative exponent in zmontexp_doub3");
-                zintoz(0,r);
-                return;
-        }
-	if (non_ini) {
-		for (i=0;i<8;i++) for (j=0;j<8;j++)
-			tab[i][j] = 0;
-		non_ini = 0;
-	}
+	zmont_swap(m);
+	zmontexp_doub(xx1, ee1, xx2, ee2, r);
+	zmont_swap(m);
+}
 
-	MONT_INITPAR
+void
+zmontexp_multi_ctx(
+	zmont_ctx *m,
+	verylong *x,
+	verylong *e,
+	long k,
+	verylong *r
+	)
+{
+	zmont_swap(m);
+	zmontexp_multi(x, e, k, r);
+	zmont_swap(m);
+}
 
-	zmontsq(tab[1][0],&(tab[2][0]));
-	zmontsq(tab[0][1],&(tab[0][2]));
-	for (i=3;i<8;i+=2) zmontmul(tab[2][0],tab[i-2][0],&(tab[i][0]));
-	for (i=3;i<8;i+=2) zmontmul(tab[0][2],tab[0][i-2],&(tab[0][i]));
-	for (i=1;i<8;i++) zmontmul(tab[0][1],tab[1][i-1],&(tab[1][i]));
-        for (i=1;i<8;i+=2) zmontmul(tab[0][i],tab[2][0],&(tab[2][i]));
-        for (i=1;i<8;i++) zmontmul(tab[0][1],tab[3][i-1],&(tab[3][i]));
-	for (j=4;j<8;j++) {
-		zmontmul(tab[1][0],tab[j-1][1],&(tab[j][1]));
-		for (i=3;i<8;i+=2) zmontmul(tab[0][2],tab[j][i-2],&(tab[j][i]));
-		j++;
-		for (i=1;i<8;i++) zmontmul(tab[0][1],tab[j][i-1],&(tab[j][i]));
+/*
+	Fixed-base exponentiation. Row j of the table holds g^(d 2^(w j))
+	for 0 < d < 2^w in Montgomery representation modulo f->m, so g^e
+	is the product of one entry per w-bit digit of e, without
+	squarings. Exponent bits above w*rows are done by zmontexp_m_ary
+	of f->top = g^(2^(w rows)).
+*/
+
+#define FIXBASE_MAGIC	0x6669786cL
+
+void
+zfixbase_init(
+	zfixbase *f,
+	verylong g,
+	verylong n,
+	long bits,
+	long w
+	)
+{
+	register long i;
+	register long j;
+	register long d;
+	verylong *t;
+
+	if ((ALLOCATE && !n) || zscompare(n, 1) <= 0 || !zodd(n))
+	{
+		zhalt("zero, or even, or negative modulus in zfixbase_init");
+		return;
 	}
-        block = z2log(e1)-1;
-        mask = ( 1L<<(block % NBITS) );
-        block = (block / NBITS) +1;
-        bit11 = 1;
-        bit21 = (e2[block]&mask) ? 1 : 0;
-        mask >>= 1;
-        if (!mask) {
-                block --;
-                if (!block) {
-                        zcopy(tab[1][bit21],r);
-			FREE2SPACE(e1,e2);
-                        for (i=0; i<8;i++)
-                                for (j=0; j<8; j++)
-                                        FREESPACE(tab[i][j]);
-                        return;
-                }
-                mask = ( 1L<<(NBITS-1) );
-        }
-        bit12 = (e1[block]&mask) ? 1 : 0;
-        bit22 = (e2[block]&mask) ? 1 : 0;
-	mask >>= 1;
-	if (!mask) {
-		block --;
-		if (!block) {
-			if (bit12 || bit22) {
-				zcopy(tab[2+bit12][(bit21<<1)+bit22],r);
-			} else {
-                		zcopy(tab[bit11][bit21],r);
-                		zmontsq(*r,r);
-			}
-			FREE2SPACE(e1,e2);
-                        for (i=0; i<8;i++)
-                                for (j=0; j<8; j++)
-                                        FREESPACE(tab[i][j]);
-			return;
-		}
-		mask = ( 1L<<(NBITS-1) );
+	zfixbase_free(f);
+	if (bits < 1)
+		bits = z2log(n);
+	if (w < 1)
+	{
+		for (w = 8; w > 1; w--)
+			if (((bits + w - 1) / w) * ((1L << w) - 1) <= 8 * bits)
+				break;
 	}
-	bit13 = (e1[block]&mask) ? 1 : 0;
-        bit23 = (e2[block]&mask) ? 1 : 0;
-	if (bit13 || bit23) {
-		zcopy(tab[4+(bit12<<1)+bit13][(bit21<<2)+(bit22<<1)+bit23],r);
-	} else {
-		if (bit12 || bit22) {
-			zcopy(tab[2+bit12][(bit21<<1)+bit22],r);
-		} else {
-			zcopy(tab[1][bit21],r);
-			zmontsq(*r,r);
-		}
-		zmontsq(*r,r);
+	else if (w > 16)
+		w = 16;
+	d = (1L << w) - 1;
+	f->w = w;
+	f->rows = (bits + w - 1) / w;
+	if (!(t = (verylong *)calloc((size_t)(f->rows * d), sizeof(verylong))))
+	{
+		zhalt("allocation failure in zfixbase_init");
+		return;
 	}
+	f->t = t;
+	zmont_ctx_init(&(f->m), n);
+	zmont_swap(&(f->m));
+	zmod(g, zn, &(f->top));
+	ztom(f->top, &(f->top));
+	for (i = 0; i < f->rows; i++)
+	{
+		zcopy(f->top, &t[0]);
+		for (j = 1; j < d; j++)
+			zmontmul(t[j - 1], f->top, &t[j]);
+		zmontmul(t[d - 1], f->top, &(f->top));
+		t += d;
+	}
+	zmont_swap(&(f->m));
+}
 
-#define MONT_THIRD \
-	mask >>= 1; \
-	if (!mask) { \
-		block --; \
-                if (!block) { \
-			zmontsq(*r,r); \
-			if (bit11 || bit21) { \
-				if (bit12 || bit22) { \
-				  zmontsq(*r,r); \
-				  zmontmul(tab[(bit11<<1)+bit12][(bit21<<1)+bit22],*r,r); \
-				} else { \
-				  zmontmul(tab[bit11][bit21],*r,r); \
-				  zmontsq(*r,r); \
-				} \
-			} else { \
-				zmontsq(*r,r); \
-				if (bit12 || bit22) { \
-					zmontmul(tab[bit12][bit22],*r,r); \
-				} \
-			} \
-			FREE2SPACE(e1,e2); \
-                        for (i=0; i<8;i++) \
-                                for (j=0; j<8; j++) \
-                                        FREESPACE(tab[i][j]); \
-			return; \
-		} \
-		mask = ( 1L<<(NBITS-1) ); \
-	} \
-	bit13 = (e1[block]&mask) ? 1 : 0; \
-        bit23 = (e2[block]&mask) ? 1 : 0;
-
-	MONT_FIRST
-	MONT_SECOND
-	MONT_THIRD
+void
+zfixbase_free(
+	zfixbase *f
+	)
+{
+	register long i;
 
-	for (;;) {
-		zmontsq(*r,r);
-		if (bit11 || bit21) {
-			if (bit13 || bit23) {
-				zmontsq(*r,r);
-				zmontsq(*r,r);
-				zmontmul(tab[(bit11<<2)+(bit12<<1)+bit13]
-					    [(bit21<<2)+(bit22<<1)+bit23],*r,r);
-			} else {
-				if (bit12 || bit22) {
-					zmontsq(*r,r);
-					zmontmul(tab[(bit11<<1)+bit12]
-						    [(bit21<<1)+bit22],*r,r);
-				} else {
-					zmontmul(tab[bit11][bit21],*r,r);
-					zmontsq(*r,r);
-				}
-				zmontsq(*r,r);
-			}
-			MONT_FIRST
-			MONT_SECOND
-		} else {
-			bit11 = bit12;
-			bit21 = bit22;
-			bit12 = bit13;
-			bit22 = bit23;
+	if (f->t)
+	{
+		for (i = f->rows * ((1L << f->w) - 1); i--;)
+			zfree(&(f->t[i]));
+		free((void *)f->t);
+	}
+	f->t = 0;
+	f->w = f->rows = 0;
+	zfree(&(f->top));
+	zmont_ctx_free(&(f->m));
+}
+
+void
+zfixbase_exp(
+	zfixbase *f,
+	verylong e,
+	verylong *bb
+	)
+{
+	register long i;
+	register long d;
+	register long dl;
+	long first = 1;
+	long neg = 0;
+	STATIC verylong b = 0;
+	STATIC verylong hi = 0;
+	STATIC verylong x = 0;
+
+	if (!f->t)
+	{
+		zhalt("undefined table in zfixbase_exp");
+		return;
+	}
+	if (zsign(e) < 0)
+	{
+		zcopy(e, &x);
+		zabs(&x);
+		e = x;
+		neg = 1;
+	}
+	zmont_swap(&(f->m));
+	dl = (1L << f->w) - 1;
+	if (z2log(e) > f->w * f->rows)
+	{
+		zrshift(e, f->w * f->rows, &hi);
+		zmontexp_m_ary(f->top, hi, &b, 0);
+		first = 0;
+	}
+	for (i = 0; i < f->rows; i++)
+	{
+		if (!(d = zmulti_bits(e, i * f->w, f->w)))
+			continue;
+		if (first)
+		{
+			zcopy(f->t[i * dl + d - 1], &b);
+			first = 0;
 		}
-		MONT_THIRD
+		else
+			zmontmul(b, f->t[i * dl + d - 1], &b);
+	}
+	if (first)
+		zcopy(zr, &b);
+	zmtoz(b, &b);
+	if (neg)
+	{
+		if (zinv(b, zn, &hi))
+		{
+			zmont_swap(&(f->m));
+			zhalt("undefined quotient in zfixbase_exp");
+			zcopy(hi, bb);
+			FREE3SPACE(b,hi,x);
+			return;
+		}
+		zswap(&b, &hi);
 	}
+	zmont_swap(&(f->m));
+	zcopy(b, bb);
+	FREE3SPACE(b,hi,x);
 }
 
+long
+zfixbase_write(
+	FILE *fn,
+	zfixbase *f
+	)
+{
+	register long i;
+	long head[4];
 
-void
-zmontexp_doub(
-	verylong xx1,
-	verylong ee1,
-	verylong xx2,
-	verylong ee2,
-	verylong *r
+	if (!f->t)
+		return (0);
+	head[0] = FIXBASE_MAGIC;
+	head[1] = NBITS;
+	head[2] = f->w;
+	head[3] = f->rows;
+	if ((long)fwrite((void *)head, sizeof(long), 4, fn) < 4)
+		return (0);
+	if (!zbfwrite(fn, f->m.n) || !zbfwrite(fn, f->top))
+		return (0);
+	for (i = 0; i < f->rows * ((1L << f->w) - 1); i++)
+		if (!zbfwrite(fn, f->t[i]))
+			return (0);
+	return (1);
+}
+
+long
+zfixbase_read(
+	FILE *fn,
+	zfixbase *f
 	)
 {
-        if (!zn)
-        {
-                zhalt("undefined Montgomery modulus in zmontexp_doub");
-                return;
-        }
-        if ((zscompare(ee1,0)<0) || (zscompare(ee2,0)<0)) {
-                zhalt("negative exponent in zmontexp_doub");
-                zintoz(0,r);
-                return;
-        }
-	if (zscompare(ee1,1L<<NBITS)<0 && zscompare(ee2,1L<<NBITS)<0)
-		zmontexp_doub1(xx1,ee1,xx2,ee2,r);
-	else if (ee1[0]<10 && ee2[0]<10)
-		zmontexp_doub2(xx1,ee1,xx2,ee2,r);
-	else
-		zmontexp_doub3(xx1,ee1,xx2,ee2,r);
+	register long i;
+	long k;
+	long head[4];
+	verylong *t;
+	verylong *p;
+	STATIC verylong n = 0;
+
+	zfixbase_free(f);
+	if ((long)fread((void *)head, sizeof(long), 4, fn) < 4
+		|| head[0] != FIXBASE_MAGIC || head[1] != NBITS
+		|| head[2] < 1 || head[2] > 16 || head[3] < 1
+		|| !zbfread(fn, &n) || zscompare(n, 1) <= 0 || !zodd(n))
+	{
+		FREESPACE(n);
+		return (0);
+	}
+	k = head[3] * ((1L << head[2]) - 1);
+	if (!(t = (verylong *)calloc((size_t)k, sizeof(verylong))))
+	{
+		FREESPACE(n);
+		zhalt("allocation failure in zfixbase_read");
+		return (0);
+	}
+	f->t = t;
+	f->w = head[2];
+	f->rows = head[3];
+	zmont_ctx_init(&(f->m), n);
+	FREESPACE(n);
+	for (i = -1; i < k; i++)
+	{
+		p = (i < 0 ? &(f->top) : &t[i]);
+		if (!zbfread(fn, p) || zsign(*p) < 0 || zcompare(*p, f->m.n) >= 0)
+			break;
+	}
+	if (i < k)
+	{
+		zfixbase_free(f);
+		return (0);
+	}
+	return (1);
 }
 
 void
@@ -6167,29 +10710,228 @@ zmakeodd(
 	shift = NBITS * (shift - 1);
 	while (!(i & 1))
 	{
-		shift++;
-		i >>= 1;
+		shift++;
+		i >>= 1;
+	}
+	zrshift(n, shift, &n);
+	return (shift);
+}
+
+long 
+zcomposite(
+	verylong *mm,
+	long t,
+	long firstbase
+	)
+{
+	register long sm = 0;
+	register long i;
+	register long j;
+	register long s;
+	register long loc_rand;
+	verylong m = *mm;
+	STATIC verylong u = 0;
+	STATIC verylong m1 = 0;
+	STATIC verylong a = 0;
+
+	if (!m || m[0] < 0)
+		return (1);
+	if ((m[0] == 1) && (m[1] <= RADIXROOT))
+	{
+		sm = m[1];
+		if (sm < 2)
+			return (1);
+		if (sm == 2)
+			return (0);
+		if (!(sm & 1))
+			return (1);
+		i = 3;
+		while (i * i <= sm)
+		{
+			if (!(sm % i))
+				return (1);
+			i++;
+			i++;
+		}
+		return (0);
+	}
+	if (!(m[1] & 1))
+		return (1);
+	zsetlength(&u, (i = m[0]), "in zcomposite, locals\n");
+	zsetlength(&m1, i, "");
+	zsetlength(&a, i, "");
+	zsubpos(m, one, &m1);
+	zcopy(m1, &u);
+	s = zmakeodd(&u);
+	if (firstbase < 0)
+		firstbase = -firstbase;
+	if (!firstbase && (sm = (m[1]-3)) <= (RADIXROOT-3))
+		sm = RADIXM - 3;
+	if (t < 0)
+		i = -t;
+	else
+		i = t;
+	for (; i > 0; i--)
+	{
+		if (sm)
+		{
+			zintoz((loc_rand = (3 + zrandom(sm)) & RADIXM), &a);
+			zexpmod(a, u, m, &a);
+		}
+		else
+		{
+			if (firstbase == 2)
+				z2expmod(u, m, &a);
+			else
+			{
+				zintoz(firstbase, &a);
+				zexpmod(a, u, m, &a);
+			}
+			loc_rand=firstbase;
+			if ((sm = (m[1]-3)) <= (RADIXROOT-3))
+				sm = RADIXM - 3;
+		}
+		if ((a[0] != 1 || a[1] != 1) && zcompare(m1, a))
+		{
+			for (j = s; j; j--)
+			{
+				zsqmod(a, m, &a);
+				if (!zcompare(a, m1))
+					goto nexti;
+				if (!zscompare(a,1L)) {
+					long k;
+
+					if (t > 0) {
+						FREE2SPACE(u,m1);
+						FREESPACE(a);
+						return 1;
+					}
+					zintoz(loc_rand,&a);
+					zexpmod(a, u, m, &a);
+					for (k=s; k>j; k--)
+						zsqmod(a, m, &a);
+					zsadd(a,-1, &a);
+					zgcd(a,m,&u);
+					if (!zscompare(u,1L) || !zcompare(u,m)) {
+						zhalt("wrong factor in zcomposite   BUG");
+						goto nexti;
+					}
+
+				zcopy(u,&m);
+				FREE2SPACE(u,m1);
+				FREESPACE(a);
+				return -1;
+				}
+			}
+			if (t > 0) {	
+				FREE2SPACE(u,m1);
+				FREESPACE(a);
+				return (1);
+			}
+			zsadd(a,-1,&a);
+			zintoz(loc_rand,&u);
+			zmulmod(a,u,m,&a);
+			zgcd(a, m, &u);
+			if (u[1] == 1 && u[0] == 1)
+					return (1);
+			zcopy(u, &m);
+			FREE2SPACE(u,m1);
+			FREESPACE(a);
+			return (-1);
+		}
+nexti:		;
+	}
+	return (0);
+}
+
+long 
+zprime(
+	verylong n,
+	long t,
+	long firstbase
+	)
+{
+	if (t < 0)
+		t = -t;
+	return (1 - zcomposite(&n, t, firstbase));
+}
+
+static void
+zsmexp(
+	long a,
+	verylong e,
+	verylong *bb
+	)
+{
+/* mixed arithmetic exponentiation, only for in zmcomposite */
+ /* with mixed montgomery and ordinary arithmetic */
+	register long i;
+	register long j;
+	register long k = 0;
+	verylong b = *bb;
+
+	if (ALLOCATE && !zn)
+	{
+		zhalt("wrong call to zsmexp, you are using an incorrect version of LIP");
+		return;
+	}
+	if (ALLOCATE && !e)
+	{
+		zcopy(zr, bb);
+		return;
+	}
+	if (ALLOCATE && !a)
+	{
+		zzero(bb);
+		return;
 	}
-	zrshift(n, shift, &n);
-	return (shift);
+	if ((i = e[0]) < 0)
+		i = (-i);	/* negative exponent made positive ... */
+	if ((i == 1) && (!(e[1])))
+		zcopy(zr, &b);
+	else
+	{
+		zintoz(a, &b);
+		ztom(b, &b);
+		for (; i; i--)
+		{
+			j = e[i];
+			if (!k)
+			{
+				k = 1;
+				while ((k << 1) <= j)
+					k <<= 1;
+			}
+			while (k >>= 1)
+			{
+				zmontsq(b, &b);
+				if (j & k)
+				{
+					zsmul(b, a, &b);
+					zmod(b, zn, &b);
+				}
+			}
+			k = RADIX;
+		}
+	}
+	*bb = b;
 }
 
 long 
-zcomposite(
-	verylong *mm,
-	long t,
-	long firstbase
+zmcomposite(
+	verylong m,
+	long t
 	)
 {
 	register long sm = 0;
 	register long i;
 	register long j;
 	register long s;
-	register long loc_rand;
-	verylong m = *mm;
 	STATIC verylong u = 0;
 	STATIC verylong m1 = 0;
 	STATIC verylong a = 0;
+	static TLS zspecial mctx = {0};
+	zspecial *sp;
 
 	if (!m || m[0] < 0)
 		return (1);
@@ -6214,511 +10956,1379 @@ zcomposite(
 	}
 	if (!(m[1] & 1))
 		return (1);
-	zsetlength(&u, (i = m[0]), "in zcomposite, locals\n");
+	zsetlength(&u, (i = m[0]), "in zmcomposite, locals\n");
 	zsetlength(&m1, i, "");
 	zsetlength(&a, i, "");
-	zsubpos(m, one, &m1);
-	zcopy(m1, &u);
-	s = zmakeodd(&u);
-	if (firstbase < 0)
-		firstbase = -firstbase;
-	if (!firstbase && (sm = (m[1]-3)) <= (RADIXROOT-3))
+	sp = zspecial_last(m);
+#ifdef MONT_SIMD
+	/* the IFMA Montgomery kernel squares faster than zsq */
+	if (zmv_cpu() == ZMV_IFMA && m[0] >= MONT_SIMD_CROV
+			&& m[0] * NBITS <= ZMV_MAXBITS)
+		sp = (zspecial *) 0;
+#endif
+	if (sp)
+	{
+		/* ordinary residues for 2^p-c, in mctx since zrandom
+		   may replace the cached modulus */
+		sp = &mctx;
+		if (!mctx.n || zcompare(mctx.n, m))
+			zspecial_init(&mctx, m);
+		zsubpos(m, one, &m1);
+	}
+	else
+	{
+		zmkeep(m);
+		zsubpos(m, zr, &m1);	/* zr is montgomery-one, m1 is
+					 * montgomery-(n-1) */
+	}
+	zsubpos(m, one, &u);
+	s = zmakeodd(&u) - 1;
+	if ((sm = (m[1]-3)) <= (RADIXROOT-3))
 		sm = RADIXM - 3;
 	if (t < 0)
-		i = -t;
-	else
-		i = t;
-	for (; i > 0; i--)
+		t = -t;
+	for (i = t; i > 0; i--)
 	{
-		if (sm)
+		if (sp)
 		{
-			zintoz((loc_rand = (3 + zrandom(sm)) & RADIXM), &a);
-			zexpmod(a, u, m, &a);
+			zintoz((3 + zrandom(sm)) & RADIXM, &a);
+			zspecial_expmod(sp, a, u, &a);
 		}
 		else
+			zsmexp((3 + zrandom(sm)) & RADIXM, u, &a);
+		if (zcompare(sp ? one : zr, a) && zcompare(m1, a))
 		{
-			if (firstbase == 2)
-				z2expmod(u, m, &a);
-			else
+			for (j = s; j; j--)
 			{
-				zintoz(firstbase, &a);
-				zexpmod(a, u, m, &a);
+				if (sp)
+					zspecial_sqmod(sp, a, &a);
+				else
+					zmontsq(a, &a);
+				if (!zcompare(a, m1))
+					goto nexti;
 			}
-			loc_rand=firstbase;
-			if ((sm = (m[1]-3)) <= (RADIXROOT-3))
-				sm = RADIXM - 3;
+			if (!sp)
+				zmback();
+			FREESPACE(u);
+			FREE2SPACE(m1,a);
+			return (1);
+		}
+nexti:		;
+	}
+	if (!sp)
+		zmback();
+	FREESPACE(u);
+	FREE2SPACE(m1,a);
+	return (0);
+}
+
+/*
+	Strong Lucas test with the parameters of Selfridge (method A):
+	the first D of 5, -7, 9, -11, ... with J(D, m) = -1, P = 1 and
+	Q = (1 - D) / 4. With m + 1 = d * 2^s, m is a strong Lucas
+	probable prime if U_d = 0 or V_(d*2^r) = 0 mod m for some r < s.
+	Only V and Q^k are computed, by the ladder on (V_k, V_(k+1)):
+	V_2k = V_k^2 - 2 Q^k, V_(2k+1) = V_k V_(k+1) - P Q^k, and
+	U_d = (2 V_(d+1) - P V_d) / D, in Montgomery representation.
+	For Q = -1 (D = 5) Q^k is +-1, which saves a third of the work.
+*/
+
+long
+zlcomposite(
+	verylong m
+	)
+{
+	register long i;
+	register long j;
+	register long k;
+	long d;
+	long q;
+	long s;
+	long jac;
+	STATIC verylong e = 0;
+	STATIC verylong t = 0;
+	STATIC verylong u = 0;
+	STATIC verylong v0 = 0;
+	STATIC verylong v1 = 0;
+	STATIC verylong qk = 0;
+	static TLS zmont_ctx lctx = {0};
+
+	if (!m || m[0] < 0)
+		return (1);
+	if ((m[0] == 1) && (m[1] <= RADIXROOT))
+	{
+		d = m[1];
+		if (d < 2)
+			return (1);
+		if (d == 2)
+			return (0);
+		if (!(d & 1))
+			return (1);
+		i = 3;
+		while (i * i <= d)
+		{
+			if (!(d % i))
+				return (1);
+			i++;
+			i++;
+		}
+		return (0);
+	}
+	if (!(m[1] & 1))
+		return (1);
+	for (d = 5;; d = (d > 0 ? -d - 2 : 2 - d))
+	{
+		zintoz(d, &t);
+		if (d < 0)
+			zadd(t, m, &t);
+		if ((jac = zjacobi(t, m)) < 0)
+			break;
+		if (!jac || (d == 13 && zsqrt(m, &t, &e)))
+		{	/* a factor of D, or a square, which has no such D */
+			FREE2SPACE(e,t);
+			return (1);
+		}
+	}
+	q = (1 - d) / 4;
+	zmont_ctx_init(&lctx, m);
+	zsadd(m, 1, &e);
+	s = zmakeodd(&e);
+	zintoz(2, &t);
+	ztom_ctx(&lctx, t, &v0);
+	zcopy(lctx.r, &v1);
+	zcopy(lctx.r, &qk);
+	for (i = e[0]; i; i--)
+	{	/* bits of d, from the top */
+		for (k = RADIX >> 1; k; k >>= 1)
+		{
+			zmontmul_ctx(&lctx, v0, v1, &t);
+			zsubmod(t, qk, m, &t);
+			if (e[i] & k)
+			{	/* V_(2k+1), V_(2k+2), Q^(2k+1) */
+				zsmulmod(qk, q, m, &u);
+				zmontsq_ctx(&lctx, v1, &v1);
+				zsubmod(v1, u, m, &v1);
+				zsubmod(v1, u, m, &v1);
+				if (q == -1)
+					zsub(m, lctx.r, &qk);
+				else
+					zmontmul_ctx(&lctx, qk, u, &qk);
+				zcopy(t, &v0);
+			}
+			else
+			{	/* V_2k, V_(2k+1), Q^2k */
+				zmontsq_ctx(&lctx, v0, &v0);
+				zsubmod(v0, qk, m, &v0);
+				zsubmod(v0, qk, m, &v0);
+				if (q == -1)
+					zcopy(lctx.r, &qk);
+				else
+					zmontsq_ctx(&lctx, qk, &qk);
+				zcopy(t, &v1);
+			}
+		}
+	}
+	zaddmod(v1, v1, m, &t);
+	if (!zcompare(t, v0))
+		goto probable;
+	for (j = s; j; j--)
+	{	/* V_(d*2^r), r = s - j */
+		if (ziszero(v0))
+			goto probable;
+		if (j > 1)
+		{
+			zmontsq_ctx(&lctx, v0, &v0);
+			zsubmod(v0, qk, m, &v0);
+			zsubmod(v0, qk, m, &v0);
+			if (q == -1)
+				zcopy(lctx.r, &qk);
+			else
+				zmontsq_ctx(&lctx, qk, &qk);
+		}
+	}
+	FREE3SPACE(e,t,u); FREE3SPACE(v0,v1,qk);
+	return (1);
+probable:
+	FREE3SPACE(e,t,u); FREE3SPACE(v0,v1,qk);
+	return (0);
+}
+
+static long
+zmlcomposite(
+	verylong m,
+	long t
+	)
+{	/* zmcomposite, or for t < 0 zlcomposite and -t - 1 more */
+	if (t >= 0)
+		return (zmcomposite(m, t));
+	if (zlcomposite(m))
+		return (1);
+	return (t < -1 ? zmcomposite(m, -t - 1) : 0);
+}
+
+long 
+zsqrts(
+	long n
+	)
+{
+	register long a;
+	register long ndiva;
+	register long newa;
+	STATIC verylong ln=0;
+	STATIC verylong rr=0;
+	STATIC verylong dif=0;
+
+	if (n <= 0)
+		return (0);
+	if (n <= 3)
+		return (1);
+	if (n <= 8)
+		return (2);
+	if (n >= RADIX)
+	{
+		long ret;
+
+		zintoz(n,&ln);
+		zsqrt(ln,&rr,&dif);
+		ret = ztoint(rr);
+		FREE2SPACE(rr,dif); FREESPACE(ln);
+		return ret;
+	}
+	FREE2SPACE(rr,dif); FREESPACE(ln);
+	newa = 3L << (2 * (NBITSH - 1));
+	a = 1L << NBITSH;
+	while (!(n & newa))
+	{
+		newa >>= 2;
+		a >>= 1;
+	}
+	while (1)
+	{
+		newa = ((ndiva = n / a) + a) / 2;
+		if (newa - ndiva <= 1)
+		{
+			if (newa * newa <= n)
+				return (newa);
+			else
+				return (ndiva);
+		}
+		a = newa;
+	}
+}
+
+long 
+zsqrt(
+	verylong n_in,
+	verylong *rr,
+	verylong *ddif
+	)
+{
+	STATIC verylong n = 0;
+	STATIC verylong a = 0;
+	STATIC verylong ndiva = 0;
+	STATIC verylong diff = 0;
+	register long i;
+	verylong dif = *ddif;
+	verylong r = *rr;
+
+	if (ALLOCATE && !n_in)
+	{
+		zzero(rr);
+		zzero(ddif);
+		return (1);
+	}
+	if ((i = n_in[0]) < 0)
+	{
+		zhalt("negative argument in zsqrt");
+		return (0);
+	}
+	zcopy(n_in,&n);
+	zsetlength(&a, i, "in zsqrt, locals\n");
+	zsetlength(&ndiva, i, "");
+	zsetlength(&diff, i, "");
+	if (i == 1)
+	{
+		zintoz(i = zsqrts(n[1]), &r);
+		zintoz(i * i, &diff);
+		goto done;
+	}
+	a[(a[0] = (i + 1) / 2)] = zsqrts(n[i]) + 1;
+	if (!(i & 1))
+		a[a[0]] <<= NBITSH;
+	if (a[a[0]] & RADIX)
+	{
+		a[a[0]] = 0;
+		a[0]++;
+		a[a[0]] = 1;
+	}
+	for (i = a[0] - 1; i; i--)
+		a[i] = 0;
+	while (1)
+	{
+		zdiv(n, a, &ndiva, &r);
+		zadd(a, ndiva, &r);
+		zrshift(r, (long) 1, &r);
+		if (zcompare(r, ndiva) <= 0)
+		{
+			zsq(r, &diff);
+			goto done;
 		}
-		if ((a[0] != 1 || a[1] != 1) && zcompare(m1, a))
+		zsubpos(r, ndiva, &diff);
+		if ((diff[0] == 1) && (diff[1] <= 1))
 		{
-			for (j = s; j; j--)
+			zsq(r, &diff);
+			if (zcompare(diff, n) > 0)
 			{
-				zsqmod(a, m, &a);
-				if (!zcompare(a, m1))
-					goto nexti;
-				if (!zscompare(a,1L)) {
-					long k;
-
-					if (t > 0) {
-						FREE2SPACE(u,m1);
-						FREESPACE(a);
-						return 1;
-					}
-					zintoz(loc_rand,&a);
-					zexpmod(a, u, m, &a);
-					for (k=s; k>j; k--)
-						zsqmod(a, m, &a);
-					zsadd(a,-1, &a);
-					zgcd(a,m,&u);
-					if (!zscompare(u,1L) || !zcompare(u,m)) {
-						zhalt("wrong factor in zcomposite   BUG");
-						goto nexti;
-					}
-
-				zcopy(u,&m);
-				FREE2SPACE(u,m1);
-				FREESPACE(a);
-				return -1;
-				}
-			}
-			if (t > 0) {	
-				FREE2SPACE(u,m1);
-				FREESPACE(a);
-				return (1);
+				zcopy(ndiva, &r);
+				zsq(r, &diff);
 			}
-			zsadd(a,-1,&a);
-			zintoz(loc_rand,&u);
-			zmulmod(a,u,m,&a);
-			zgcd(a, m, &u);
-			if (u[1] == 1 && u[0] == 1)
-					return (1);
-			zcopy(u, &m);
-			FREE2SPACE(u,m1);
-			FREESPACE(a);
-			return (-1);
+			goto done;
 		}
-nexti:		;
+		zcopy(r, &a);
 	}
+done:
+	*rr = r;
+	zsubpos(n, diff, &dif);
+	*ddif = dif;
+	FREESPACE(n); FREESPACE(a); FREESPACE(ndiva); FREESPACE(diff);
+	if (!(dif[1]) && (dif[0] == 1))
+		return (1);
 	return (0);
 }
 
-long 
-zprime(
-	verylong n,
-	long t,
-	long firstbase
+/*
+	The primes from 7 on are sieved in segments of PRIM_SEG bytes. A
+	byte stands for the 30 numbers from 30 * k on, and its bits for the
+	8 of them that are prime to 30 (zpres), so one bit per candidate.
+	The base primes p >= 7 with p * p below the end of the segment
+	cross off their multiples: for each bit c, 30 * (k + j) + zpres[c]
+	is a multiple of p for j = -(k + zpres[c] / 30) modulo p, where
+	zpbase_inv holds 1 / 30 modulo p, and every p-th byte from there.
+	zpbase_init computes the base primes below 2 * PRIM_BND + 3, and
+	zpbase_grow extends them, by the same sieve, when a segment needs
+	more. The iterators walk zpbase_p itself (zpiter.base is the index)
+	and only sieve segments above zpbase_max.
+*/
+
+static const long zpres[8] = {1, 7, 11, 13, 17, 19, 23, 29};
+
+static void
+zpbase_add(
+	long p
 	)
 {
-	if (t < 0)
-		t = -t;
-	return (1 - zcomposite(&n, t, firstbase));
+	register long q;
+	register long t;
+	long r0 = 30 % p;
+	long r1 = p;
+	long x0 = 1;
+	long x1 = 0;
+
+	while (r1)
+	{	/* x0 = 1 / 30 mod p */
+		q = r0 / r1;
+		t = r0 - q * r1;
+		r0 = r1;
+		r1 = t;
+		t = x0 - q * x1;
+		x0 = x1;
+		x1 = t;
+	}
+	if (x0 < 0)
+		x0 += p;
+	if (zpbase_n == zpbase_size)
+	{
+		zpbase_size = (zpbase_size ? 2 * zpbase_size : 4096);
+		zpbase_p = (unsigned int *)realloc((void *)zpbase_p,
+			(size_t)zpbase_size * sizeof(unsigned int));
+		zpbase_inv = (unsigned int *)realloc((void *)zpbase_inv,
+			(size_t)zpbase_size * sizeof(unsigned int));
+		if (!zpbase_p || !zpbase_inv)
+		{
+			zhalt("allocation failure in zpnext");
+			return;
+		}
+	}
+	zpbase_p[zpbase_n] = (unsigned int) p;
+	zpbase_inv[zpbase_n] = (unsigned int) x0;
+	zpbase_n++;
 }
 
 static void
-zsmexp(
-	long a,
-	verylong e,
-	verylong *bb
+zpbase_init(
+	void
 	)
-{
-/* mixed arithmetic exponentiation, only for in zmcomposite */
- /* with mixed montgomery and ordinary arithmetic */
+{	/* the base primes below 2 * PRIM_BND + 3 */
 	register long i;
 	register long j;
-	register long k = 0;
-	verylong b = *bb;
+	register long p;
+	char *s;
 
-	if (ALLOCATE && !zn)
+	if (!(s = (char *)calloc((size_t)PRIM_BND, sizeof(char))))
 	{
-		zhalt("wrong call to zsmexp, you are using an incorrect version of LIP");
+		zhalt("allocation failure in zpnext");
 		return;
 	}
-	if (ALLOCATE && !e)
-	{
-		zcopy(zr, bb);
-		return;
+	for (i = 0; i < PRIM_BND; i++)
+	{	/* s[i] for 2 * i + 3 */
+		if (s[i])
+			continue;
+		if ((p = 2 * i + 3) >= 7)
+			zpbase_add(p);
+		for (j = p * p; j < 2 * PRIM_BND + 3; j += 2 * p)
+			s[(j - 3) / 2] = 1;
 	}
-	if (ALLOCATE && !a)
+	zpbase_max = 2 * PRIM_BND + 3;
+	free((void *)s);
+}
+
+static void
+zpbase_grow(
+	long n
+	)
+{	/* makes the base primes cover the numbers below n */
+	register long i;
+	register long b;
+	long k;
+	unsigned char *s;
+
+	if (!zpbase_max)
+		zpbase_init();
+	while (zpbase_max <= (n - 1) / zpbase_max)
 	{
-		zzero(bb);
-		return;
+		if (!(s = (unsigned char *)malloc((size_t)PRIM_SEG)))
+		{
+			zhalt("allocation failure in zpnext");
+			return;
+		}
+		k = zpbase_max / 30;
+		zpsieve(s, k, PRIM_SEG);
+		for (i = 0; i < PRIM_SEG; i++)
+			for (b = 0; b < 8; b++)
+				if ((s[i] >> b) & 1 && 30 * (k + i) + zpres[b] >= zpbase_max)
+					zpbase_add(30 * (k + i) + zpres[b]);
+		zpbase_max = 30 * (k + PRIM_SEG);
+		free((void *)s);
 	}
-	if ((i = e[0]) < 0)
-		i = (-i);	/* negative exponent made positive ... */
-	if ((i == 1) && (!(e[1])))
-		zcopy(zr, &b);
-	else
+}
+
+static void
+zpcross(
+	const unsigned int *bp,
+	const unsigned int *binv,
+	long bn,
+	unsigned char *s,
+	long k,
+	long len
+	)
+{	/* bits of s[0..len-1] for 30 * k up to 30 * (k + len) */
+	register long i;
+	register long j;
+	register long p;
+	register long c;
+	register unsigned char m;
+	long km;
+	long r;
+	long d2;
+	long d4;
+	long d6;
+	long hi = 30 * (k + len);
+
+	for (i = 0; i < len; i++)
+		s[i] = 0xff;
+	if (!k)
+		s[0] = 0xfe;
+	for (i = 0; i < bn; i++)
 	{
-		zintoz(a, &b);
-		ztom(b, &b);
-		for (; i; i--)
-		{
-			j = e[i];
-			if (!k)
-			{
-				k = 1;
-				while ((k << 1) <= j)
-					k <<= 1;
-			}
-			while (k >>= 1)
+		p = bp[i];
+		if (p > (hi - 1) / p)
+			break;
+		km = k % p;
+		r = binv[i];
+		d2 = (r << 1 >= p ? (r << 1) - p : r << 1);
+		d4 = (d2 << 1 >= p ? (d2 << 1) - p : d2 << 1);
+		d6 = (d2 + d4 >= p ? d2 + d4 - p : d2 + d4);
+		r = p - r;
+		for (c = 0; c < 8; c++)
+		{	/* r = -zpres[c] / 30 mod p, without branches */
+			if (c)
 			{
-				zmontsq(b, &b);
-				if (j & k)
-				{
-					zsmul(b, a, &b);
-					zmod(b, zn, &b);
-				}
+				r -= (c == 1 || c == 7 ? d6 : (c & 1 ? d2 : d4));
+				r = (r < 0 ? r + p : r);
 			}
-			k = RADIX;
+			j = r - km;
+			j = (j < 0 ? j + p : j);
+			while (30 * (k + j) + zpres[c] < p * p)
+				j += p;
+			m = (unsigned char) ~(1 << c);
+			for (; j < len; j += p)
+				s[j] &= m;
 		}
 	}
-	*bb = b;
 }
 
-long 
-zmcomposite(
-	verylong m,
-	long t
+static void
+zpsieve(
+	unsigned char *s,
+	long k,
+	long len
 	)
 {
-	register long sm = 0;
-	register long i;
-	register long j;
-	register long s;
-	STATIC verylong u = 0;
-	STATIC verylong m1 = 0;
-	STATIC verylong a = 0;
+	zpbase_grow(30 * (k + len));
+	zpcross(zpbase_p, zpbase_inv, zpbase_n, s, k, len);
+}
 
-	if (!m || m[0] < 0)
-		return (1);
-	if ((m[0] == 1) && (m[1] <= RADIXROOT))
+void
+zpiter_start(
+	zpiter *c
+	)
+{
+	c->seg = 0;
+	c->k = 0;
+	c->len = 0;
+	c->i = 0;
+	c->b = 0;
+	c->small = 2;
+	c->last = 0;
+	c->base = -1;
+}
+
+long
+zpiter_nextb(
+	zpiter *c,
+	long b
+	)
+{
+	if (b >= PRIM_UP)
+		return (0);
+	c->last = 0;
+	if (b <= 5)
 	{
-		sm = m[1];
-		if (sm < 2)
-			return (1);
-		if (sm == 2)
+		c->small = (b <= 2 ? 2 : (b <= 3 ? 3 : 5));
+		return (zpiter_next(c));
+	}
+	if (!zpbase_max)
+		zpbase_init();
+	if (b < zpbase_max)
+	{	/* the first base prime >= b */
+		register long lo = 0;
+		register long hi = zpbase_n;
+		register long mid;
+
+		while (lo < hi)
+		{
+			mid = (lo + hi) >> 1;
+			if ((long) zpbase_p[mid] < b)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		if (lo < zpbase_n)
+		{
+			c->small = 0;
+			c->base = lo;
+			return (zpiter_next(c));
+		}
+	}
+	if (!c->seg && !(c->seg = (unsigned char *)malloc((size_t)PRIM_SEG)))
+	{
+		zhalt("allocation failure in zpiter_nextb");
+		return (0);
+	}
+	c->small = 0;
+	c->base = -1;
+	c->k = b / 30;
+	c->len = PRIM_SEG / 32;    /* short, as the next prime is near, */
+	                           /* and doubled up to PRIM_SEG after */
+	zpsieve(c->seg, c->k, c->len);
+	c->i = 0;
+	for (c->b = 0; 30 * c->k + zpres[c->b] < b; c->b++)
+		;
+	return (zpiter_next(c));
+}
+
+long
+zpiter_last(
+	zpiter *c
+	)
+{
+	return (c->last);
+}
+
+void
+zpiter_free(
+	zpiter *c
+	)
+{
+	if (c->seg)
+		free((void *)c->seg);
+	zpiter_start(c);
+}
+
+long
+zpiter_next(
+	zpiter *c
+	)
+{
+	register long b;
+	register long v;
+
+	if (c->small)
+	{
+		c->last = c->small;
+		c->small = (c->last == 2 ? 3 : (c->last == 3 ? 5 : 0));
+		if (!c->small)
+		{	/* the base primes from 7 on next */
+			if (!zpbase_max)
+				zpbase_init();
+			c->base = 0;
+		}
+		return (c->last);
+	}
+	if (c->base >= 0)
+	{	/* sieve on from the end of the base primes */
+		if (c->base < zpbase_n)
+			return (c->last = zpbase_p[c->base++]);
+		return (zpiter_nextb(c, c->last + 1));
+	}
+	for (;;)
+	{
+		for (; c->i < c->len; c->i++, c->b = 0)
+		{
+			if (!(v = c->seg[c->i] >> c->b))
+				continue;
+			for (b = c->b; !(v & 1); b++)
+				v >>= 1;
+			c->b = b + 1;
+			if ((c->last = 30 * (c->k + c->i) + zpres[b]) >= PRIM_UP)
+				goto wrap;
+			return (c->last);
+		}
+		if (30 * (c->k += c->len) >= PRIM_UP)
+			goto wrap;
+		if (!c->seg && !(c->seg = (unsigned char *)malloc((size_t)PRIM_SEG)))
+		{
+			zhalt("allocation failure in zpiter_next");
 			return (0);
-		if (!(sm & 1))
-			return (1);
-		i = 3;
-		while (i * i <= sm)
+		}
+		c->len = (2 * c->len < PRIM_SEG ? 2 * c->len : PRIM_SEG);
+		zpsieve(c->seg, c->k, c->len);
+		c->i = 0;
+		c->b = 0;
+	}
+wrap:
+	/* start again, as after zpstart */
+	c->small = 3;
+	c->len = 0;
+	return (c->last = 2);
+}
+
+void
+zpstart()
+{
+	zpglobal.small = 3;
+	zpglobal.last = 0;
+}
+
+void
+zpstart2()
+{
+	zpglobal.small = 2;
+	zpglobal.last = 0;
+}
+
+long 
+zpnext()
+{
+	return (zpiter_next(&zpglobal));
+}
+
+long 
+zp()
+{
+	return (zpglobal.last);
+}
+
+long
+zpnextb(
+	long b
+	)
+{
+	return (zpiter_nextb(&zpglobal, b));
+}
+
+/*
+	zprange sieves the segments of [lo, hi) in nthreads worker threads,
+	into a ring of 2 * nthreads slots, and the calling thread takes them
+	from the ring in order. Each worker also lists the primes of its
+	segment, so the caller only adds and reports them. The workers use
+	a copy of the base primes they need: f may use zpnext, which could
+	move the table.
+*/
+
+static const long zpsmall[3] = {2, 3, 5};
+
+static void
+zprange_seg(
+	zprange_job *job,
+	long j
+	)
+{	/* sieves segment j into slot j % nslot */
+	register long i;
+	register long b;
+	register long v;
+	long t = j % job->nslot;
+	long k = job->k + j * PRIM_SEG;
+	long len = (job->kend - k < PRIM_SEG ? job->kend - k : PRIM_SEG);
+	long n = 0;
+	unsigned char *s = job->seg + t * PRIM_SEG;
+	unsigned int *o;
+
+	zpcross(job->bp, job->binv, job->bn, s, k, len);
+	for (i = 0; i < len; i++)
+	{
+		for (v = s[i], b = 0; v; v >>= 1, b++)
 		{
-			if (!(sm % i))
-				return (1);
-			i++;
-			i++;
+			if (!(v & 1))
+				continue;
+			if (n == job->size[t])
+			{
+				if (!(o = (unsigned int *)realloc((void *)job->off[t],
+					(size_t)(2 * n) * sizeof(unsigned int))))
+				{
+					job->cnt[t] = -1;
+					return;
+				}
+				job->off[t] = o;
+				job->size[t] = 2 * n;
+			}
+			job->off[t][n++] = (unsigned int) (30 * i + zpres[b]);
 		}
-		return (0);
 	}
-	if (!(m[1] & 1))
-		return (1);
-	zsetlength(&u, (i = m[0]), "in zmcomposite, locals\n");
-	zsetlength(&m1, i, "");
-	zsetlength(&a, i, "");
-	zmkeep(m);
-	zsubpos(m, zr, &m1);	/* zr is montgomery-one, m1 is
-				 * montgomery-(n-1) */
-	zsubpos(m, one, &u);
-	s = zmakeodd(&u) - 1;
-	if ((sm = (m[1]-3)) <= (RADIXROOT-3))
-		sm = RADIXM - 3;
-	if (t < 0)
-		t = -t;
-	for (i = t; i > 0; i--)
+	job->cnt[t] = n;
+}
+
+static long
+zprange_put(
+	long p,
+	void (*f) (long, void *),
+	void *arg,
+	long **a,
+	long *count,
+	long *asize
+	)
+{	/* reports p, returns 0 if out of memory */
+	long *na;
+
+	if (f)
+		f(p, arg);
+	if (a)
 	{
-		zsmexp((3 + zrandom(sm)) & RADIXM, u, &a);
-		if (zcompare(zr, a) && zcompare(m1, a))
+		if (*count == *asize)
 		{
-			for (j = s; j; j--)
-			{
-				zmontsq(a, &a);
-				if (!zcompare(a, m1))
-					goto nexti;
-			}
-			zmback();
-			FREESPACE(u);
-			FREE2SPACE(m1,a);
-			return (1);
+			*asize = (*asize ? 2 * *asize : 1024);
+			if (!(na = (long *)realloc((void *)*a, (size_t)*asize * sizeof(long))))
+				return (0);
+			*a = na;
 		}
-nexti:		;
+		(*a)[*count] = p;
 	}
-	zmback();
-	FREESPACE(u);
-	FREE2SPACE(m1,a);
-	return (0);
+	(*count)++;
+	return (1);
 }
 
-long 
-zsqrts(
-	long n
+#ifdef THREADS
+static void *
+zprange_work(
+	void *arg
 	)
 {
-	register long a;
-	register long ndiva;
-	register long newa;
-	STATIC verylong ln=0;
-	STATIC verylong rr=0;
-	STATIC verylong dif=0;
-
-	if (n <= 0)
-		return (0);
-	if (n <= 3)
-		return (1);
-	if (n <= 8)
-		return (2);
-	if (n >= RADIX)
-	{
-		long ret;
+	zprange_job *job = (zprange_job *)arg;
+	long j;
 
-		zintoz(n,&ln);
-		zsqrt(ln,&rr,&dif);
-		ret = ztoint(rr);
-		FREE2SPACE(rr,dif); FREESPACE(ln);
-		return ret;
-	}
-	FREE2SPACE(rr,dif); FREESPACE(ln);
-	newa = 3L << (2 * (NBITSH - 1));
-	a = 1L << NBITSH;
-	while (!(n & newa))
-	{
-		newa >>= 2;
-		a >>= 1;
-	}
-	while (1)
+	pthread_mutex_lock(&job->lock);
+	while ((j = job->next) < job->nseg)
 	{
-		newa = ((ndiva = n / a) + a) / 2;
-		if (newa - ndiva <= 1)
-		{
-			if (newa * newa <= n)
-				return (newa);
-			else
-				return (ndiva);
+		if (j >= job->used + job->nslot)
+		{	/* slot j % nslot still in use */
+			pthread_cond_wait(&job->cond, &job->lock);
+			continue;
 		}
-		a = newa;
-	}
+		job->next++;
+		pthread_mutex_unlock(&job->lock);
+		zprange_seg(job, j);
+		pthread_mutex_lock(&job->lock);
+		job->ready[j % job->nslot] = j;
+		pthread_cond_broadcast(&job->cond);
+	}
+	pthread_mutex_unlock(&job->lock);
+	return (0);
 }
+#endif
 
-long 
-zsqrt(
-	verylong n_in,
-	verylong *rr,
-	verylong *ddif
+static long
+zprange_run(
+	long lo,
+	long hi,
+	long nthreads,
+	void (*f) (long, void *),
+	void *arg,
+	long **a
 	)
 {
-	STATIC verylong n = 0;
-	STATIC verylong a = 0;
-	STATIC verylong ndiva = 0;
-	STATIC verylong diff = 0;
 	register long i;
-	verylong dif = *ddif;
-	verylong r = *rr;
+	register long p;
+	long j;
+	long t;
+	long base;
+	long count = 0;
+	long asize = 0;
+	long failed = 0;
+	zprange_job job;
+#ifdef THREADS
+	long started = 0;
+	pthread_t *tid = 0;
+#endif
 
-	if (ALLOCATE && !n_in)
+	if (a)
+		*a = 0;
+	if (hi > PRIM_UP)
 	{
-		zzero(rr);
-		zzero(ddif);
-		return (1);
+		zhalt("upper bound too large in zprange");
+		return (0);
 	}
-	if ((i = n_in[0]) < 0)
-	{
-		zhalt("negative argument in zsqrt");
+	if (lo < 0)
+		lo = 0;
+	if (lo >= hi)
 		return (0);
+	job.k = lo / 30;
+	job.kend = (hi + 29) / 30;
+	job.nseg = (job.kend - job.k + PRIM_SEG - 1) / PRIM_SEG;
+	zpbase_grow(30 * job.kend);
+	for (job.bn = 0; job.bn < zpbase_n; job.bn++)
+	{
+		p = zpbase_p[job.bn];
+		if (p > (30 * job.kend - 1) / p)
+			break;
 	}
-	zcopy(n_in,&n);
-	zsetlength(&a, i, "in zsqrt, locals\n");
-	zsetlength(&ndiva, i, "");
-	zsetlength(&diff, i, "");
-	if (i == 1)
-	{
-		zintoz(i = zsqrts(n[1]), &r);
-		zintoz(i * i, &diff);
+#ifdef THREADS
+	if (nthreads > job.nseg)
+		nthreads = job.nseg;
+#else
+	nthreads = 1;
+#endif
+	job.nslot = (nthreads > 1 ? 2 * nthreads : 1);
+	job.bp = (unsigned int *)malloc((size_t)(job.bn + 1) * sizeof(unsigned int));
+	job.binv = (unsigned int *)malloc((size_t)(job.bn + 1) * sizeof(unsigned int));
+	job.seg = (unsigned char *)malloc((size_t)(job.nslot * PRIM_SEG));
+	job.off = (unsigned int **)calloc((size_t)job.nslot, sizeof(unsigned int *));
+	job.cnt = (long *)calloc((size_t)(4 * job.nslot), sizeof(long));
+	if (!job.bp || !job.binv || !job.seg || !job.off || !job.cnt)
+	{
+		failed = 1;
 		goto done;
 	}
-	a[(a[0] = (i + 1) / 2)] = zsqrts(n[i]) + 1;
-	if (!(i & 1))
-		a[a[0]] <<= NBITSH;
-	if (a[a[0]] & RADIX)
+	memcpy((void *)job.bp, (void *)zpbase_p, (size_t)job.bn * sizeof(unsigned int));
+	memcpy((void *)job.binv, (void *)zpbase_inv, (size_t)job.bn * sizeof(unsigned int));
+	job.size = job.cnt + job.nslot;
+	job.ready = job.size + job.nslot;
+	for (t = 0; t < job.nslot; t++)
 	{
-		a[a[0]] = 0;
-		a[0]++;
-		a[a[0]] = 1;
+		if (!(job.off[t] = (unsigned int *)malloc((size_t)PRIM_SEG * sizeof(unsigned int))))
+		{
+			failed = 1;
+			goto done;
+		}
+		job.size[t] = PRIM_SEG;
+		job.ready[t] = -1;
 	}
-	for (i = a[0] - 1; i; i--)
-		a[i] = 0;
-	while (1)
+	job.next = 0;
+	job.used = 0;
+#ifdef THREADS
+	if (nthreads > 1 && (tid = (pthread_t *)malloc((size_t)nthreads * sizeof(pthread_t))))
 	{
-		zdiv(n, a, &ndiva, &r);
-		zadd(a, ndiva, &r);
-		zrshift(r, (long) 1, &r);
-		if (zcompare(r, ndiva) <= 0)
+		pthread_mutex_init(&job.lock, 0);
+		pthread_cond_init(&job.cond, 0);
+		while (started < nthreads
+			&& !pthread_create(&tid[started], 0, zprange_work, (void *)&job))
+			started++;
+	}
+#endif
+	for (i = 0; i < 3 && !failed; i++)
+		if (zpsmall[i] >= lo && zpsmall[i] < hi)
+			failed = !zprange_put(zpsmall[i], f, arg, a, &count, &asize);
+	for (j = 0; j < job.nseg && !failed; j++)
+	{
+		t = j % job.nslot;
+#ifdef THREADS
+		if (started)
 		{
-			zsq(r, &diff);
-			goto done;
+			pthread_mutex_lock(&job.lock);
+			while (job.ready[t] != j)
+				pthread_cond_wait(&job.cond, &job.lock);
+			pthread_mutex_unlock(&job.lock);
 		}
-		zsubpos(r, ndiva, &diff);
-		if ((diff[0] == 1) && (diff[1] <= 1))
+		else
+#endif
+			zprange_seg(&job, j);
+		if (job.cnt[t] < 0)
+			failed = 1;
+		base = 30 * (job.k + j * PRIM_SEG);
+		for (i = 0; i < job.cnt[t]; i++)
 		{
-			zsq(r, &diff);
-			if (zcompare(diff, n) > 0)
+			if ((p = base + job.off[t][i]) < lo)
+				continue;
+			if (p >= hi)
+				break;
+			if (!zprange_put(p, f, arg, a, &count, &asize))
 			{
-				zcopy(ndiva, &r);
-				zsq(r, &diff);
+				failed = 1;
+				break;
 			}
-			goto done;
 		}
-		zcopy(r, &a);
+#ifdef THREADS
+		if (started)
+		{
+			pthread_mutex_lock(&job.lock);
+			job.used = j + 1;
+			pthread_cond_broadcast(&job.cond);
+			pthread_mutex_unlock(&job.lock);
+		}
+#endif
 	}
 done:
-	*rr = r;
-	zsubpos(n, diff, &dif);
-	*ddif = dif;
-	FREESPACE(n); FREESPACE(a); FREESPACE(ndiva); FREESPACE(diff);
-	if (!(dif[1]) && (dif[0] == 1))
-		return (1);
-	return (0);
+#ifdef THREADS
+	if (started)
+	{
+		pthread_mutex_lock(&job.lock);
+		job.next = job.nseg;
+		pthread_cond_broadcast(&job.cond);
+		pthread_mutex_unlock(&job.lock);
+		for (t = 0; t < started; t++)
+			pthread_join(tid[t], 0);
+	}
+	if (tid)
+	{
+		pthread_mutex_destroy(&job.lock);
+		pthread_cond_destroy(&job.cond);
+		free((void *)tid);
+	}
+#endif
+	if (job.off)
+		for (t = 0; t < job.nslot; t++)
+			free((void *)job.off[t]);
+	free((void *)job.off);
+	free((void *)job.cnt);
+	free((void *)job.seg);
+	free((void *)job.binv);
+	free((void *)job.bp);
+	if (failed)
+	{
+		zhalt("allocation failure in zprange");
+		return (0);
+	}
+	return (count);
 }
 
-void
-zpstart()
+long
+zprange(
+	long lo,
+	long hi,
+	long nthreads,
+	void (*f) (long, void *),
+	void *arg
+	)
 {
-	register long i;
-	register long j;
-	register long jstep;
-	register long jstart;
-	register long ibnd;
-	register short int *p;
+	return (zprange_run(lo, hi, nthreads, f, arg, (long **)0));
+}
+
+long
+zprange_array(
+	long lo,
+	long hi,
+	long nthreads,
+	long **a
+	)
+{
+	return (zprange_run(lo, hi, nthreads, (void (*) (long, void *))0, (void *)0, a));
+}
 
-	if (!lowsieve)
+/*
+	Fast gcd. Lehmer steps (Knuth 4.5.2 algorithm L) take the
+	quotients of a whole nit of leading bits at once and apply them
+	with zsmul. Above HGCD_CROV nits the half gcd of Schoenhage and
+	Moeller takes over: the quotient sequence of the top halves of a
+	and b, gathered recursively in a 2 by 2 matrix, is applied to a
+	and b with zmul. A matrix m of non-negative entries, with
+	determinant det = +-1, keeps (a, b) of the input equal to
+	m (a, b) of now; a first row m[0] that is null is not kept.
+*/
+
+static long
+zgcd_top(
+	verylong a,
+	long h
+	)
+{	/* bits h to h + NBITS - 1 of a >= 0 */
+	register long i = h / NBITS + 1;
+	register long r = h % NBITS;
+	register long v;
+
+	if (i > a[0])
+		return (0);
+	v = a[i] >> r;
+	if (r && i < a[0])
+		v |= (a[i + 1] << (NBITS - r)) & RADIXM;
+	return (v);
+}
+
+static long
+zgcd_step(
+	verylong *a,
+	verylong *b,
+	verylong *m,
+	long *det,
+	long s
+	)
+{	/* (a, b) = (b, a mod b) unless a mod b has s nits or less */
+	STATIC verylong q = 0;
+	STATIC verylong r = 0;
+	STATIC verylong t = 0;
+	verylong x;
+
+	zdiv(*a, *b, &q, &r);
+	if (s && r[0] <= s)
+	{
+		FREE2SPACE(q, r);
+		return (0);
+	}
+	if (m)
 	{
-		lowsieve = (short int *)calloc((size_t)PRIM_BND, sizeof(short int));
-		p = &lowsieve[0];
-		for (i = PRIM_BND; i; i--)
-			*p++ = 1;
-		jstep = 1;
-		jstart = -1;
-		ibnd = (zsqrts((long) (2 * PRIM_BND + 1)) - 3) / 2;
-		for (i = 0; i <= ibnd; i++)
+		if (m[0])
 		{
-			jstart += 2 * ((jstep += 2) - 1);
-			if (lowsieve[i])
-				for (j = jstart; j < PRIM_BND; j += jstep)
-					lowsieve[j] = 0;
+			zmul(q, m[0], &t);
+			zadd(t, m[1], &m[1]);
+			x = m[0]; m[0] = m[1]; m[1] = x;
 		}
+		zmul(q, m[2], &t);
+		zadd(t, m[3], &m[3]);
+		x = m[2]; m[2] = m[3]; m[3] = x;
+		*det = -*det;
 	}
-	lastp = 0;
-	pshift = 0;
-	pindex = -1;
+	x = *a; *a = *b; *b = r; r = x;
+	FREE2SPACE(q, r); FREESPACE(t);
+	return (1);
 }
 
-void
-zpstart2()
-{
-	lastp = 0;
-	pshift = -1;
+static long
+zgcd_lehmer(
+	verylong *a,
+	verylong *b,
+	verylong *m,
+	long *det,
+	long s
+	)
+{	/* Lehmer step on a >= b unless b gets s nits or less */
+	register long q;
+	register long t;
+	long h;
+	long x;
+	long y;
+	long k = 0;
+	long aa = 1;
+	long ab = 0;
+	long ba = 0;
+	long bb = 1;
+	STATIC verylong u = 0;
+	STATIC verylong v = 0;
+	STATIC verylong w = 0;
+	verylong z;
+
+	if ((*a)[0] < 3)
+		return (0);
+	h = z2log(*a) - NBITS;
+	x = zgcd_top(*a, h);
+	y = zgcd_top(*b, h);
+	while (y + ba > 0 && y + bb > 0)
+	{
+		q = (x + aa) / (y + ba);
+		if (q != (x + ab) / (y + bb))
+			break;
+		t = aa - q * ba; aa = ba; ba = t;
+		t = ab - q * bb; ab = bb; bb = t;
+		t = x - q * y; x = y; y = t;
+		k++;
+	}
+	if (!ab)
+		return (0);
+	zsmul(*a, aa, &u);
+	zsmul(*b, ab, &w);
+	zadd(u, w, &u);
+	zsmul(*a, ba, &v);
+	zsmul(*b, bb, &w);
+	zadd(v, w, &v);
+	if (zsign(u) < 0 || zsign(v) < 0 || (s && v[0] <= s))
+	{
+		FREE2SPACE(u, v); FREESPACE(w);
+		return (0);
+	}
+	z = *a; *a = u; u = z;
+	z = *b; *b = v; v = z;
+	if (m)
+	{
+		/* m = m (aa ab, ba bb)^-1 = m (|bb| |ab|, |ba| |aa|) */
+		if (aa < 0) aa = -aa;
+		if (ab < 0) ab = -ab;
+		if (ba < 0) ba = -ba;
+		if (bb < 0) bb = -bb;
+		for (t = (m[0] ? 0 : 2); t < 4; t += 2)
+		{
+			zsmul(m[t], bb, &u);
+			zsmul(m[t + 1], ba, &w);
+			zadd(u, w, &u);
+			zsmul(m[t], ab, &v);
+			zsmul(m[t + 1], aa, &w);
+			zadd(v, w, &m[t + 1]);
+			z = m[t]; m[t] = u; u = z;
+		}
+		if (k & 1)
+			*det = -*det;
+	}
+	FREE2SPACE(u, v); FREESPACE(w);
+	return (1);
 }
 
 static void
-zpshift()
-{
-/* auxiliary routine for prime generator */
+zhgcd_mul(
+	verylong *m,
+	verylong *n
+	)
+{	/* m = m n */
 	register long i;
-	register long j;
-	register long jstep;
-	register long jstart;
-	register long ibound;
-	register short *p;
-	register short *pi;
+	verylong t0 = 0;
+	verylong t1 = 0;
+	verylong u = 0;
+
+	for (i = (m[0] ? 0 : 2); i < 4; i += 2)
+	{
+		zmul(m[i], n[0], &t0);
+		zmul(m[i + 1], n[2], &u);
+		zadd(t0, u, &t0);
+		zmul(m[i], n[1], &t1);
+		zmul(m[i + 1], n[3], &u);
+		zadd(t1, u, &t1);
+		zcopy(t0, &m[i]);
+		zcopy(t1, &m[i + 1]);
+	}
+	zfree(&t0);
+	zfree(&t1);
+	zfree(&u);
+}
 
-	if (!movesieve)
-		movesieve = (short int *)calloc((size_t)PRIM_BND, sizeof(short int));
-	pi = &movesieve[0];
-	if (!pshift)
-	{
-		p = &lowsieve[0];
-		for (i = PRIM_BND; i; i--)
-			*pi++ = *p++;
-	}
-	else
-	{
-		for (i = PRIM_BND; i; i--)
-			*pi++ = 1;
-		jstep = 3;
-		ibound = pshift + 2 * PRIM_BND + 1;
-		for (i = 0; jstep * jstep <= ibound; i++)
+static long
+zhgcd_adjust(
+	verylong *a,
+	verylong *b,
+	long p,
+	verylong a1,
+	verylong b1,
+	verylong *m,
+	long *det
+	)
+{	/* (a, b) = m^-1 (a, b), where (a1, b1) = m^-1 (a, b) / RADIX^p;
+	   0 if that makes a or b negative */
+	register long ok;
+	verylong x = 0;
+	verylong y = 0;
+	verylong t = 0;
+	verylong lo = 0;
+
+	zdiv_nits(*a, 0, p, &lo);
+	zmul(m[3], lo, &x);
+	zmul(m[2], lo, &y);
+	zdiv_nits(*b, 0, p, &lo);
+	zmul(m[1], lo, &t);
+	zsub(x, t, &x);
+	zmul(m[0], lo, &t);
+	zsub(t, y, &y);
+	if (*det < 0)
+	{
+		znegate(&x);
+		znegate(&y);
+	}
+	zlshift(a1, p * NBITS, &t);
+	zadd(x, t, &x);
+	zlshift(b1, p * NBITS, &t);
+	zadd(y, t, &y);
+	if ((ok = (zsign(x) >= 0 && zsign(y) >= 0)))
+	{
+		if (zcompare(x, y) >= 0)
+		{
+			zcopy(x, a);
+			zcopy(y, b);
+		}
+		else
 		{
-			if (lowsieve[i])
-			{
-				if (!((jstart = (pshift + 2) / jstep + 1) & 1))
-					jstart++;
-				if (jstart <= jstep)
-					jstart = jstep;
-				jstart = (jstart * jstep - pshift - 3) / 2;
-				for (j = jstart; j < PRIM_BND; j += jstep)
-					movesieve[j] = 0;
-			}
-			jstep += 2;
+			/* swap the columns of m too */
+			zcopy(y, a);
+			zcopy(x, b);
+			zswap(&m[0], &m[1]);
+			zswap(&m[2], &m[3]);
+			*det = -*det;
 		}
 	}
+	zfree(&x);
+	zfree(&y);
+	zfree(&t);
+	zfree(&lo);
+	return (ok);
 }
 
-long 
-zpnext()
-{
-	if (pshift < 0)
-	{
-		zpstart();
-		return (lastp = 2);
-	}
-	if (pindex < 0)
-	{
-		pindex = 0;
-		zpshift();
-		return (lastp = 3);
-	}
-	for (;;)
-	{
-		while ((++pindex) < PRIM_BND)
+static void
+zhgcd(
+	verylong *a,
+	verylong *b,
+	verylong *m,
+	long *det
+	)
+{	/* reduces a >= b by m of about a[0]/2 nits, to a and b of more
+	   than s = a[0]/2 + 1 nits */
+	register long n = (*a)[0];
+	register long s = (n >> 1) + 1;
+	register long p;
+	long d1;
+	verylong m1[4];
+	verylong a1 = 0;
+	verylong b1 = 0;
+
+	zone(&m[0]);
+	zzero(&m[1]);
+	zzero(&m[2]);
+	zone(&m[3]);
+	*det = 1;
+	if ((*b)[0] <= s)
+		return;
+	if (n >= HGCD_CROV)
+	{
+		m1[0] = m1[1] = m1[2] = m1[3] = 0;
+		p = n >> 1;
+		zdiv_nits(*a, p, n, &a1);
+		zdiv_nits(*b, p, n, &b1);
+		zhgcd(&a1, &b1, m1, &d1);
+		if (zhgcd_adjust(a, b, p, a1, b1, m1, &d1))
 		{
-			if (movesieve[pindex])
-				return (lastp = pshift + 2 * pindex + 3);
+			zhgcd_mul(m, m1);
+			*det = d1;
 		}
-		if ((pshift += 2 * PRIM_BND) > 2 * PRIM_BND * (2 * PRIM_BND + 1))
+		while ((*a)[0] > s + (n >> 2) && (*b)[0] > s
+		       && (zgcd_lehmer(a, b, m, det, s) || zgcd_step(a, b, m, det, s)))
+			;
+		if ((*b)[0] > s && (*a)[0] <= s + (n >> 2))
 		{
-			zpstart();
-			return (lastp = 2);
+			p = (s << 1) - (*a)[0];
+			zdiv_nits(*a, p, (*a)[0], &a1);
+			zdiv_nits(*b, p, (*a)[0], &b1);
+			zhgcd(&a1, &b1, m1, &d1);
+			if (zhgcd_adjust(a, b, p, a1, b1, m1, &d1))
+			{
+				zhgcd_mul(m, m1);
+				*det *= d1;
+			}
 		}
-		zpshift();
-		pindex = -1;
-	}
-}
-
-long 
-zp()
-{
-	return (lastp);
+		for (p = 0; p < 4; p++)
+			zfree(&m1[p]);
+		zfree(&a1);
+		zfree(&b1);
+	}
+	while ((*b)[0] > s
+	       && (zgcd_lehmer(a, b, m, det, s) || zgcd_step(a, b, m, det, s)))
+		;
 }
 
-long
-zpnextb(
-	long b
+static void
+zgcd_fast(
+	verylong a,
+	verylong b,
+	verylong *g,
+	verylong *xa
 	)
-{
-	if (b >= PRIM_UP)
-		return(0);
-	zpstart();
-	if (b < (2*PRIM_BND))
-	{
-		zpstart2();
-		while (zpnext() < b);
-		return(lastp);
+{	/* *g = gcd(|a|, |b|), and if xa, *xa = x with 0 <= x < |b| and
+	   x a = *g mod b; a, b not zero */
+	register long i;
+	long det = 1;
+	long d1;
+	verylong m[4];
+	verylong m1[4];
+	verylong x = 0;
+	verylong y = 0;
+	verylong t = 0;
+
+	for (i = 0; i < 4; i++)
+		m[i] = m1[i] = 0;
+	zcopy(a, &x);
+	zabs(&x);
+	zcopy(b, &y);
+	zabs(&y);
+	/* only the second row of m is needed for xa */
+	zzero(&m[2]);
+	zone(&m[3]);
+	if (zcompare(x, y) < 0)
+	{
+		/* m swaps, so that x >= y */
+		t = x; x = y; y = t; t = 0;
+		zswap(&m[2], &m[3]);
+		det = -1;
+	}
+	while (!ziszero(y) && (!xa || y[0] >= HGCD_CROV))
+	{
+		if (y[0] >= HGCD_CROV && (x[0] - y[0]) < (y[0] >> 2))
+		{
+			zhgcd(&x, &y, m1, &d1);
+			if (!zcompare(m1[0], one) && ziszero(m1[1]))
+				zgcd_step(&x, &y, xa ? m : (verylong *) 0, &det, 0);
+			else if (xa)
+			{
+				zhgcd_mul(m, m1);
+				det *= d1;
+			}
+		}
+		else if (!zgcd_lehmer(&x, &y, xa ? m : (verylong *) 0, &det, 0))
+			zgcd_step(&x, &y, xa ? m : (verylong *) 0, &det, 0);
 	}
-	pshift = (b / (2*PRIM_BND)) * (2*PRIM_BND);
-	pindex = 0;
-	zpshift();
-	while (zpnext() < b);
-	return(lastp);
+	if (xa)
+	{
+		if (ziszero(y))
+			zcopy(m[3], &t);
+		else
+		{
+			/* finish with zxxeucl, g = u x + v y */
+			zxxeucl(x, y, &m1[0], &m1[1]);
+			zmul(m1[0], x, &t);
+			zsub(m1[1], t, &t);
+			zdiv(t, y, &m1[2], &m1[3]);
+			zcopy(m1[1], &x);
+			zmul(m1[0], m[3], &t);
+			zmul(m1[2], m[2], &m1[3]);
+			zsub(t, m1[3], &t);
+		}
+		/* the cofactor of a is det (u m[3] - v m[2]) */
+		if ((det < 0) != (zsign(a) < 0))
+			znegate(&t);
+		zcopy(b, &y);
+		zabs(&y);
+		zmod(t, y, xa);
+	}
+	zcopy(x, g);
+	for (i = 0; i < 4; i++)
+	{
+		zfree(&m[i]);
+		zfree(&m1[i]);
+	}
+	zfree(&x);
+	zfree(&y);
+	zfree(&t);
 }
 
-
 void
 zgcd(
 	verylong mm1,
@@ -6737,12 +12347,14 @@ zgcd(
 	verylong d;
 	long m1negative;
 	long m2negative;
+	ZCOUNT_IN(gcd, ZCOUNT_LEN(mm1) + ZCOUNT_LEN(mm2));
 
 	if (!mm1)
 	{
 		if (mm2 != *rres)
 			zcopy(mm2,rres);
 		zabs(rres);
+		ZCOUNT_OUT(gcd);
 		return;
 	}
 	if (!mm2)
@@ -6750,6 +12362,7 @@ zgcd(
 		if (mm1 != *rres)
 			zcopy(mm1,rres);
 		zabs(rres);
+		ZCOUNT_OUT(gcd);
 		return;
 	}
 	if (mm1 == mm2)
@@ -6757,6 +12370,14 @@ zgcd(
 		if (mm1 != *rres)
 			zcopy(mm1, rres);
 		zabs(rres);
+		ZCOUNT_OUT(gcd);
+		return;
+	}
+	if ((mm1[0] >= LEHMER_CROV || mm1[0] <= -LEHMER_CROV)
+	    && (mm2[0] >= LEHMER_CROV || mm2[0] <= -LEHMER_CROV))
+	{
+		zgcd_fast(mm1, mm2, rres, (verylong *) 0);
+		ZCOUNT_OUT(gcd);
 		return;
 	}
 	if (m1negative = (mm1[0] < 0))
@@ -6851,6 +12472,7 @@ done:
 		mm2[0] = -mm2[0];
 	zcopy(a, rres);
 	FREESPACE(aa); FREE2SPACE(bb,cc);
+	ZCOUNT_OUT(gcd);
 }
 
 void
@@ -6888,6 +12510,12 @@ zgcdeucl(
 		zabs(rres);
 		return;
 	}
+	if ((mm1[0] >= LEHMER_CROV || mm1[0] <= -LEHMER_CROV)
+	    && (mm2[0] >= LEHMER_CROV || mm2[0] <= -LEHMER_CROV))
+	{
+		zgcd_fast(mm1, mm2, rres, (verylong *) 0);
+		return;
+	}
 	if (m1negative = (mm1[0] < 0))
 		mm1[0] = -mm1[0];
 	if (m2negative = (mm2[0] < 0))
@@ -6946,7 +12574,7 @@ zpollardrho(
 	verylong res = *rres;
 	verylong cof = *ccof;
 	verylong adder = &glosho[1];
-	static long start=0;
+	static TLS long start=0;
 
 	start++;
 	if (ALLOCATE && !n)
@@ -7062,25 +12690,37 @@ ztridiv(
         long b2
         )
 {
-        long last = zp();
         long try;
+	zpiter it;
+	long r[TRIDIV_BLOCK];
+	zsrecip m[TRIDIV_BLOCK];
+	register long i;
+	register long k;
 
 	if ((b1 < 0) || (b1 > b2) || (b2 >= RADIX))
 		return(0);
 
-	try = zpnextb(b1);
+	zpiter_start(&it);
+	try = zpiter_nextb(&it, b1);
 
         while (try <= b2)
         {
-                if (!zsdiv(n, try, cof))
-                        goto done;
-                try = zpnext();
+		for (k = 0; k < TRIDIV_BLOCK && try <= b2; k++)
+		{
+			zsrecip_init(&m[k], try);
+			try = zpiter_next(&it);
+		}
+		zsmod_block(m, k, n, r);
+		for (i = 0; i < k; i++)
+			if (!r[i])
+			{
+				try = m[i].d;
+				zsdiv(n, try, cof);
+				goto done;
+			}
         }
         done:
-        if (last)
-                zpnextb(last);
-        else
-                zpstart2();
+	zpiter_free(&it);
         return (try);
 }
 
@@ -7091,17 +12731,16 @@ zfread(
 	)
 {
  /* return 1 if success, 0 if not */
-	static char *inmem = 0;
+	static TLS char *inmem = 0;
 	char *in;
+	char *digs = 0;
 	register long d = 0;
+	register long nd = 0;
 	register long anegative = 0;
 	register long return_value = 1;
 	verylong a = *aa;
 	verylong digit = &glosho[1];
-	extern double log();
 
-	if (log10rad < 0)
-		log10rad = log((double)RADIX) / log((double)10);
 	if (!inmem)
 		inmem = (char *)calloc((size_t)IN_LINE, sizeof(char));
 	if (fscanf(f, "%s", inmem) == EOF)
@@ -7113,9 +12752,6 @@ zfread(
 	}
 	else
 		in = inmem;
-	zsetlength(&a, (long) (strlen(in) / log10rad), "in zfread, second argument");
-	a[0] = 1;
-	a[1] = 0;
 	while (in[d] != '\0')
 	{
 		if (in[d] == IN_LINE_BREAK)
@@ -7123,23 +12759,25 @@ zfread(
 			if (fscanf(f, "%s", in) == EOF)
 				return (0);
 			d = 0;
-			if (strlen(in) > log10rad * (a[-1] - a[0]))
-			{
-			/* to avoid multiple reallocations */
-				zsetlength(&a, (long) (a[0] + 3 + strlen(in) / log10rad), 
-				           "in zfread, second argument");
-			}
 		}
 		else
+		{
+			if (in[d] < '0' || in[d] > '9')
+				return_value = 0;
+			digs = zradix_buf(nd + 1);
+			digs[nd++] = in[d++];
+		}
+	}
+	if (return_value && nd)
+		zradix_scan(digs, nd, 10, &a);
+	else
+	{
+		zzero(&a);
+		for (d = 0; d < nd; d++)
 		{
 			zsmul(a, (long) 10, &a);
-			digit[1] = (long) (in[d++] - '0');
-                        if (digit[1] < 0) {
-                                digit[1] = 0;
-                                return_value = 0;
-                        } else if (digit[1] > 9) {
-                                return_value = 0;
-                        }
+			if ((digit[1] = (long) (digs[d] - '0')) < 0)
+				digit[1] = 0;
 			zadd(a, digit, &a);
 		}
 	}
@@ -7168,19 +12806,16 @@ zfwrite_c(
 {
 	STATIC verylong out = 0;
 	STATIC verylong ca = 0;
-	static long outsize = 0;
-	static long div = 0;
-	static long ldiv;
+	STATIC verylong vdiv = 0;
+	static TLS long outsize = 0;
+	static TLS long div = 0;
+	static TLS long ldiv;
 	register long i;
 	long sa;
 	long result;
 	long zeros;
 	long strlen1 = strlen(str1);
 	long strlen2 = strlen(str2);
-	extern double log();
-
-	if (log10rad < 0)
-		log10rad = log((double)RADIX) / log((double)10);
 
 	if (ALLOCATE && !a)
 	{
@@ -7209,30 +12844,21 @@ zfwrite_c(
 	}
 	else
 		fprintf(f, "%s", str1);
-	if (ldiv * outsize < log10rad * sa)
+	zsetlength(&ca, sa, "in zfwrite_c, local");
+	for (i = (ca[0] = sa); i; i--)
+		ca[i] = a[i];
+	zintoz(div, &vdiv);
+	if ((i = zradix_len(ca, vdiv)) > outsize)
 	{
 		free((void*)out);
-		if (!(out = (verylong)calloc((size_t)(outsize = (log10rad * sa) / ldiv + 2), (size_t)SIZEOFLONG))) {
+		if (!(out = (verylong)calloc((size_t)(outsize = i), (size_t)SIZEOFLONG))) {
 			zhalt("allocation failure in zfwrite_c");
 			return (0);
 		}
 	}
-	zsetlength(&ca, sa, "in zfwrite_c, local");
-	for (i = (ca[0] = sa); i; i--)
-		ca[i] = a[i];
-	i = -1;
-	do
-	{
-		if ((++i) >= outsize)
-		{
-			if (!(out = (verylong)realloc((void*)out, (size_t)((outsize += SIZE) * SIZEOFLONG))))
-			{
-				zhalt("reallocation failure in zfwrite_c");
-				return (0);
-			}
-		}
-		out[i] = zsdiv(ca, div, &ca);
-	} while (ca[1] || ca[0] != 1);
+	zradix_split(ca, div, vdiv, out, i, zradix_leaf(vdiv));
+	while (--i && !out[i])
+		;
 	sa = 0;
 	result = out[i];
 	do
@@ -7268,7 +12894,7 @@ zfwrite_c(
 /* need to free space differently for out */
 #ifdef FREE
 	free((void*)out);
-	FREESPACE(ca);
+	FREE2SPACE(ca,vdiv);
 #endif
 	return (result);
 }
@@ -7378,32 +13004,48 @@ zhfwrite(
 	verylong a
 	)
 {
-	static char *b = 0;
-	static bl = 0;
-	STATIC verylong aa = 0;
+	static TLS char *b = 0;
+	static TLS long bl = 0;
 	register long i;
-	register long cnt = 0;
+	register long j;
+	register long r;
+	register long v;
+	register long sa;
+	register long cnt;
 	register long mb = 0;
 	register long lab = 0;
 
 	if (!a)
+	{
 		fprintf(fn, "0");
-	zcopy(a, &aa);
-	if (aa[0] < 0)
+		return;
+	}
+	if ((sa = a[0]) < 0)
 	{
-		aa[0] = -aa[0];
+		sa = -sa;
 		fprintf(fn, "-");
 	}
-	if (!b)
-		b = (char *)malloc((size_t)(bl = (aa[0] << 3)));
-	else if (bl < (aa[0] << 3))
-		b = (char *)realloc((void*)b, (size_t)((bl = (aa[0] << 3)) * sizeof(char)));
-	do
+	/* hex digits straight from the nits */
+	if ((cnt = (NBITS * (sa - 1) + z2logs(a[sa]) + 3) >> 2) < 1)
+		cnt = 1;
+	if (bl < cnt)
+	{
+		if (!(b = (char *)realloc((void*)b, (size_t)((bl = cnt) * sizeof(char)))))
+		{
+			bl = 0;
+			zhalt("allocation failure in zhfwrite");
+			return;
+		}
+	}
+	for (i = 0; i < cnt; i++)
 	{
-		b[cnt] = eulav(aa[1] & 15);
-		cnt++;
-		zrshift(aa, (long) 4, &aa);
-	} while ((aa[1] != 0) || (aa[0] != 1));
+		j = (i << 2) / NBITS + 1;
+		r = (i << 2) % NBITS;
+		v = a[j] >> r;
+		if (r > NBITS - 4 && j < sa)
+			v |= a[j + 1] << (NBITS - r);
+		b[i] = eulav(v & 15);
+	}
 	for (i = cnt; i--;)
 	{
 		fprintf(fn, "%c", b[i]);
@@ -7425,85 +13067,356 @@ zhfwrite(
 			}
 		}
 	}
-	FREESPACE(aa);
-
-}
-
-void
-zhfwriteln(
-        FILE *f,
-        verylong a
-        )
-{
-        zhfwrite(f, a);
-        fprintf(f, "\n");
 }
 
-void
-zhwrite(
-	verylong a
+void
+zhfwriteln(
+        FILE *f,
+        verylong a
+        )
+{
+        zhfwrite(f, a);
+        fprintf(f, "\n");
+}
+
+void
+zhwrite(
+	verylong a
+	)
+{
+	zhfwrite(stdout, a);
+}
+
+void
+zhwriteln(
+	verylong a
+	)
+{
+	zhfwrite(stdout, a);
+	printf("\n");
+}
+
+long 
+value(
+	char c
+	)
+{
+	switch (c)
+	{
+		case '0':
+			return (0);
+		case '1':
+			return (1);
+		case '2':
+			return (2);
+		case '3':
+			return (3);
+		case '4':
+			return (4);
+		case '5':
+			return (5);
+		case '6':
+			return (6);
+		case '7':
+			return (7);
+		case '8':
+			return (8);
+		case '9':
+			return (9);
+		case 'A':
+		case 'a':
+			return (10);
+		case 'B':
+		case 'b':
+			return (11);
+		case 'C':
+		case 'c':
+			return (12);
+		case 'D':
+		case 'd':
+			return (13);
+		case 'E':
+		case 'e':
+			return (14);
+		case 'F':
+		case 'f':
+			return (15);
+		default:
+			return(0);
+	}
+}
+
+/*
+	Radix conversion by divide and conquer: digits in base b are
+	split off or put together on the powers b^(2^k), so that
+	conversion costs a log factor more than zmul and zdiv. The
+	powers are kept for the last base used. Pieces of less than
+	about RADIX_CROV nits go one digit at a time.
+*/
+
+static TLS verylong radix_base = 0;
+static TLS verylong radix_pow[NBITS];
+static TLS long radix_npow = 0;
+
+static verylong
+zradix_pow(
+	verylong b,
+	long k
+	)
+{	/* b^(2^k) */
+	if (!radix_base || zcompare(b, radix_base))
+	{
+		zcopy(b, &radix_base);
+		zcopy(b, &radix_pow[0]);
+		radix_npow = 1;
+	}
+	for (; radix_npow <= k; radix_npow++)
+		zsq(radix_pow[radix_npow - 1], &radix_pow[radix_npow]);
+	return (radix_pow[k]);
+}
+
+static long
+zradix_leaf(
+	verylong b
+	)
+{	/* digits of RADIX_CROV nits */
+	return ((RADIX_CROV * NBITS) / (z2log(b) - 1) + 1);
+}
+
+static long
+zradix_len(
+	verylong a,
+	verylong b
+	)
+{	/* n with 0 <= a < b^n, b > 1 */
+	if (ziszero(a))
+		return (1);
+	return ((long) (zln(a) / zln(b)) + 2);
+}
+
+static void
+zradix_split(
+	verylong a,
+	long b,
+	verylong vb,
+	long *row,
+	long n,
+	long leaf
+	)
+{	/* row[0..n-1] = digits of 0 <= a < b^n, vb = b */
+	register long h;
+	register long k;
+	verylong q = 0;
+	verylong r = 0;
+
+	if (n <= leaf)
+	{
+		zcopy(a, &q);
+		for (h = 0; h < n; h++)
+			row[h] = zsdiv(q, b, &q);
+		zfree(&q);
+		return;
+	}
+	for (k = 0, h = 1; (h << 1) < n; k++)
+		h <<= 1;
+	zdiv(a, zradix_pow(vb, k), &q, &r);
+	zradix_split(r, b, vb, row, h, leaf);
+	zradix_split(q, b, vb, row + h, n - h, leaf);
+	zfree(&q);
+	zfree(&r);
+}
+
+static void
+zradix_vsplit(
+	verylong a,
+	verylong b,
+	verylong *row,
+	long n,
+	long leaf
+	)
+{	/* row[0..n-1] = digits of 0 <= a < b^n */
+	register long h;
+	register long k;
+	verylong q = 0;
+	verylong r = 0;
+
+	if (n <= leaf)
+	{
+		zcopy(a, &q);
+		for (h = 0; h < n; h++)
+		{
+			zdiv(q, b, &r, &row[h]);
+			zswap(&q, &r);
+		}
+		zfree(&q);
+		zfree(&r);
+		return;
+	}
+	for (k = 0, h = 1; (h << 1) < n; k++)
+		h <<= 1;
+	zdiv(a, zradix_pow(b, k), &q, &r);
+	zradix_vsplit(r, b, row, h, leaf);
+	zradix_vsplit(q, b, row + h, n - h, leaf);
+	zfree(&q);
+	zfree(&r);
+}
+
+static void
+zradix_join(
+	long *row,
+	long n,
+	long b,
+	verylong vb,
+	long leaf,
+	verylong *a
+	)
+{	/* *a = sum of row[i] b^i for 0 <= i < n, vb = b */
+	register long h;
+	register long k;
+	verylong hi = 0;
+	verylong lo = 0;
+
+	if (n <= leaf)
+	{
+		zintoz(row[n - 1], a);
+		for (h = n - 1; h--;)
+		{
+			zsmul(*a, b, a);
+			zsadd(*a, row[h], a);
+		}
+		return;
+	}
+	for (k = 0, h = 1; (h << 1) < n; k++)
+		h <<= 1;
+	zradix_join(row + h, n - h, b, vb, leaf, &lo);
+	zmul(lo, zradix_pow(vb, k), &hi);
+	zradix_join(row, h, b, vb, leaf, &lo);
+	zadd(hi, lo, a);
+	zfree(&hi);
+	zfree(&lo);
+}
+
+static void
+zradix_vjoin(
+	verylong *row,
+	long n,
+	verylong b,
+	long leaf,
+	verylong *a
+	)
+{	/* *a = sum of row[i] b^i for 0 <= i < n */
+	register long h;
+	register long k;
+	verylong hi = 0;
+	verylong lo = 0;
+
+	if (n <= leaf)
+	{
+		zcopy(row[n - 1], a);
+		for (h = n - 1; h--;)
+		{
+			zmulin(b, a);
+			zadd(*a, row[h], a);
+		}
+		return;
+	}
+	for (k = 0, h = 1; (h << 1) < n; k++)
+		h <<= 1;
+	zradix_vjoin(row + h, n - h, b, leaf, &lo);
+	zmul(lo, zradix_pow(b, k), &hi);
+	zradix_vjoin(row, h, b, leaf, &lo);
+	zadd(hi, lo, a);
+	zfree(&hi);
+	zfree(&lo);
+}
+
+static char *
+zradix_buf(
+	long n
 	)
-{
-	zhfwrite(stdout, a);
+{	/* digit buffer of at least n characters */
+	static TLS char *buf = 0;
+	static TLS long size = 0;
+
+	if (n > size)
+	{
+		if (!(buf = (char *)realloc((void*)buf, (size_t)(size = (n << 1) + IN_LINE))))
+		{
+			size = 0;
+			zhalt("allocation failure in zradix_buf");
+		}
+	}
+	return (buf);
 }
 
-void
-zhwriteln(
-	verylong a
+static void
+zradix_scan(
+	char *s,
+	long len,
+	long b,
+	verylong *a
 	)
-{
-	zhfwrite(stdout, a);
-	printf("\n");
+{	/* *a = value of the len digits in s, base 1 < b <= 16 */
+	register long i;
+	register long j;
+	register long d;
+	long bb = b;
+	long g = 1;
+	long n;
+	long *row;
+	STATIC verylong vb = 0;
+
+	while (bb * b < RADIXROOT)
+	{
+		bb *= b;
+		g++;
+	}
+	n = (len + g - 1) / g;
+	if (!(row = (long *)malloc((size_t)(n * sizeof(long)))))
+	{
+		zhalt("allocation failure in zradix_scan");
+		return;
+	}
+	for (i = 0, j = len; i < n; i++, j -= g)
+	{
+		row[i] = 0;
+		for (d = (j > g ? j - g : 0); d < j; d++)
+			row[i] = row[i] * b + value(s[d]);
+	}
+	zintoz(bb, &vb);
+	zradix_join(row, n, bb, vb, zradix_leaf(vb), a);
+	free((void *)row);
+	FREESPACE(vb);
 }
 
-long 
-value(
-	char c
+static void
+zradix_hex(
+	char *s,
+	long len,
+	verylong *a
 	)
-{
-	switch (c)
+{	/* *a = value of the len hex digits in s */
+	register long i;
+	register long j;
+	register long r;
+	register long v;
+	long sa = (len << 2) / NBITS + 1;
+
+	zsetlength(a, sa, "in zradix_hex, third argument");
+	for (i = sa; i > 0; i--)
+		(*a)[i] = 0;
+	for (i = 0; i < len; i++)
 	{
-		case '0':
-			return (0);
-		case '1':
-			return (1);
-		case '2':
-			return (2);
-		case '3':
-			return (3);
-		case '4':
-			return (4);
-		case '5':
-			return (5);
-		case '6':
-			return (6);
-		case '7':
-			return (7);
-		case '8':
-			return (8);
-		case '9':
-			return (9);
-		case 'A':
-		case 'a':
-			return (10);
-		case 'B':
-		case 'b':
-			return (11);
-		case 'C':
-		case 'c':
-			return (12);
-		case 'D':
-		case 'd':
-			return (13);
-		case 'E':
-		case 'e':
-			return (14);
-		case 'F':
-		case 'f':
-			return (15);
-		default:
-			return(0);
+		v = value(s[len - 1 - i]);
+		j = (i << 2) / NBITS + 1;
+		r = (i << 2) % NBITS;
+		(*a)[j] |= (v << r) & RADIXM;
+		if (r > NBITS - 4)
+			(*a)[j + 1] |= v >> (NBITS - r);
 	}
+	while (sa > 1 && !(*a)[sa])
+		sa--;
+	(*a)[0] = sa;
 }
 
 long
@@ -7515,6 +13428,7 @@ zstrtozbas(
 {
         register long v;
         register long cnt = 0;
+        register long start;
         register long negative = 0;
         register char c;
 
@@ -7529,15 +13443,14 @@ zstrtozbas(
         }
         zintoz(0,n);
 
+        start = cnt;
         c = s[cnt++];
         while (((v = value(c)) < base) && ((v) || (c == '0')) )
-        {
-                zsmul(*n,base,n);
-                zsadd(*n,v,n);
                 c = s[cnt++];
-        }
 
         cnt --;
+        if (cnt > start && base > 1)
+                zradix_scan(s + start, cnt - start, base, n);
         if (negative)
         {
                 znegate(n);
@@ -7563,9 +13476,10 @@ zhfread(
 {
 	char prev;
 	char c;
+	char *digs = 0;
+	long nd = 0;
 	long anegative = 0;
 
-	zintoz((long) 0, a);
 	do
 	{
 		prev = ' ';
@@ -7584,13 +13498,14 @@ zhfread(
 			fscanf(fn, "%c", &c);
 			if ((prev != IN_LINE_BREAK) && (prev != ' '))
 			{
-				zlshift(*a, (long) 4, a);
-				zsadd(*a, value(prev), a);
+				digs = zradix_buf(nd + 1);
+				digs[nd++] = prev;
 			}
 		}
 		if (!anegative)
 			anegative = -1;
 	} while (prev == IN_LINE_BREAK);
+	zradix_hex(digs, nd, a);
 	if (anegative > 0)
 		if (((*a)[1]) || ((*a)[0] != 1))
 			(*a)[0] = -((*a)[0]);
@@ -7610,15 +13525,13 @@ zhsread(
 	verylong *aa
 	)
 {
-	static char *inmem = 0;
+	static TLS char *inmem = 0;
 	char *in;
+	char *digs = 0;
 	register long d = 0;
+	register long nd = 0;
 	register long anegative = 0;
 	verylong a = *aa;
-	extern double log();
-
-	if (log16rad < 0)
-		log16rad = log((double)RADIX) / log((double)16);
 
 	if (!inmem)
 		inmem = (char *)calloc((size_t)IN_LINE, sizeof(char));
@@ -7631,9 +13544,6 @@ zhsread(
 	}
 	else
 		in = inmem;
-	zsetlength(&a, (long) (strlen(in) / log16rad), "in zhsread, second argument");
-	a[0] = 1;
-	a[1] = 0;
 	while (in[d] != '\0')
 	{
 		if (in[d] == IN_LINE_BREAK)
@@ -7641,18 +13551,14 @@ zhsread(
 			if (sscanf(str, "%s", in) == EOF)
 				return;
 			d = 0;
-			if (strlen(in) > log16rad * (a[-1] - a[0]))
-			{
-				zsetlength(&a, (long) (a[0] + 3 + strlen(in) / log16rad), 
-				           "in zhsread, second argument");
-			}
 		}
 		else
 		{
-			zlshift(a, (long) 4, &a);
-			zsadd(a,value(in[d++]),&a);
+			digs = zradix_buf(nd + 1);
+			digs[nd++] = in[d++];
 		}
 	}
+	zradix_hex(digs, nd, &a);
 	if (anegative)
 		znegate(&a);
 	*aa = a;
@@ -7664,17 +13570,15 @@ zsread(
 	verylong *aa
 	)
 {
-	static char *inmem = 0;
+	static TLS char *inmem = 0;
 	char *in;
+	char *digs = 0;
 	register long d = 0;
+	register long nd = 0;
 	register long anegative = 0;
 	register long return_value = 1;
 	verylong a = *aa;
 	verylong digit = &glosho[1];
-	extern double log();
-
-	if (log10rad < 0)
-		log10rad = log((double)RADIX) / log((double)10);
 
 	if (!inmem)
 		inmem = (char *)calloc((size_t)IN_LINE, sizeof(char));
@@ -7687,9 +13591,6 @@ zsread(
 	}
 	else
 		in = inmem;
-	zsetlength(&a, (long) (strlen(in) / log10rad), "in zsread, second argument");
-	a[0] = 1;
-	a[1] = 0;
 	while (in[d] != '\0')
 	{
 		if (in[d] == IN_LINE_BREAK)
@@ -7697,24 +13598,27 @@ zsread(
 			if (sscanf(str, "%s", in) == EOF)
 				return (0);
 			d = 0;
-			if (strlen(in) > log10rad * (a[-1] - a[0]))
-			{
-				zsetlength(&a, (long) (a[0] + 3 + strlen(in) / log10rad), 
-				           "in zsread, second argument");
-			}
 		}
 		else
+		{
+			if (in[d] < '0' || in[d] > '9')
+				return_value = 0;
+			digs = zradix_buf(nd + 1);
+			digs[nd++] = in[d++];
+		}
+	}
+	if (return_value && nd)
+		zradix_scan(digs, nd, 10, &a);
+	else
+	{
+		zzero(&a);
+		for (d = 0; d < nd; d++)
 		{
 			zsmul(a, (long) 10, &a);
-			digit[1] = (long) (in[d++] - '0');
-			if (digit[1] < 0) {
+			if ((digit[1] = (long) (digs[d] - '0')) < 0)
 				digit[1] = 0;
-				return_value = 0;
-			} else if (digit[1] > 9) {
-				return_value = 0;
-			}
 			zadd(a, digit, &a);
-		};
+		}
 	}
 	if (anegative)
 		znegate(&a);
@@ -7730,18 +13634,15 @@ zswrite(
 {
 	STATIC verylong out = 0;
 	STATIC verylong ca = 0;
-	static long outsize = 0;
-	static long div = 0;
-	static long ldiv;
+	STATIC verylong vdiv = 0;
+	static TLS long outsize = 0;
+	static TLS long div = 0;
+	static TLS long ldiv;
 	register long i;
 	register long j;
 	long sa;
 	long result;
 	long zeros;
-	extern double log();
-
-	if (log10rad < 0)
-		log10rad = log((double)RADIX) / log((double)10);
 
 	if (ALLOCATE && !a)
 	{
@@ -7768,30 +13669,21 @@ zswrite(
 	}
 	else
 		j = 0;
-	if (ldiv * outsize < log10rad * sa)
+	zsetlength(&ca, sa, "in zswrite, local");
+	for (i = (ca[0] = sa); i; i--)
+		ca[i] = a[i];
+	zintoz(div, &vdiv);
+	if ((i = zradix_len(ca, vdiv)) > outsize)
 	{
 		free((void*)out);
-		if (!(out = (verylong)calloc((size_t)(outsize = (log10rad * sa) / ldiv + 2), (size_t)SIZEOFLONG))) {
+		if (!(out = (verylong)calloc((size_t)(outsize = i), (size_t)SIZEOFLONG))) {
 			zhalt("allocation failure in zswrite");
 			return (0);
 		}
 	}
-	zsetlength(&ca, sa, "in zswrite, local");
-	for (i = (ca[0] = sa); i; i--)
-		ca[i] = a[i];
-	i = -1;
-	do
-	{
-		if ((++i) >= outsize)
-		{
-			if (!(out = (verylong)realloc((void*)out, (size_t)((outsize += SIZE) * SIZEOFLONG))))
-			{
-				zhalt("reallocation failure in zswrite");
-				return (0);
-			}
-		}
-		out[i] = zsdiv(ca, div, &ca);
-	} while (ca[1] || ca[0] != 1);
+	zradix_split(ca, div, vdiv, out, i, zradix_leaf(vdiv));
+	while (--i && !out[i])
+		;
 	sa = 0;
 	result = out[i];
 	do
@@ -7818,11 +13710,11 @@ zswrite(
 		}
 		sprintf(str + j, "%ld", out[i]);
 		sa += ldiv;
-		j = sa;
+		j = sa + (a[0] < 0);
 	}
-#ifdef STATIC
+#ifdef FREE
 	free((void*)out);
-	FREESPACE(ca);
+	FREE2SPACE(ca,vdiv);
 #endif
 	return (result);
 }
@@ -7899,9 +13791,9 @@ zfwrite_b(
 	)
 {
 	register long i;
-	static long sl = 0;
-	static long ll = 0;
-	static long *s;
+	static TLS long sl = 0;
+	static TLS long ll = 0;
+	static TLS long *s;
 	STATIC verylong *l;
 	STATIC verylong a =0;
 	STATIC verylong out_base = 0;
@@ -8323,7 +14215,7 @@ zln(
 	)
 {
 	extern double log();
-	static double log_2 = -1.0;
+	static TLS double log_2 = -1.0;
 	register long sa;
 
 	if ((!a) || (a[0] <= 0))
@@ -8921,7 +14813,7 @@ zjacobi(
 {
 	long unit;
 	long i;
-	verylong temp = 0;
+	ZINLINE(temp, INLINE_SIZE);
 
 	if (!n || zsign(n) <= 0)
 	{
@@ -8950,7 +14842,10 @@ zjacobi(
 		i = zmakeodd(&temp);
 		i = (i > 3 ? 8 : 1L << i);
 		if (a[1] % i != 1)
+		{
+			zfree(&temp);
 			return (-1);
+		}
 		i = zjacobi(a, temp);
 		zfree(&temp);
 		return(i);
@@ -9219,13 +15114,17 @@ zprobprime(
 		if ((a[1] == 3) || (a[1] == 5) || (a[1] == 7) || (a[1] == 11) )
 			return (1);
 		if (a[1] < 13) return (0);
-		result = zsqrts(a[1]);
+		if ((result = zsqrts(a[1])) > 5 * NBITS)
+			result = 5 * NBITS;
 		if (ztridiv(a, &cofactor_a, (long) 3, result) <= result) {
 			FREESPACE(cofactor_a);
 			return (0);
 		}
 		FREESPACE(cofactor_a);
-		return (1);
+		if (zsqrts(a[1]) <= result)
+			return (1);
+		/* Baillie-PSW, which has no pseudo primes below 2^64 */
+		return (!zcomposite(&a, (long) 1, (long) 2) && !zlcomposite(a));
 	}
 	result = a[0] * 5 * NBITS;
 	if (ztridiv(a, &cofactor_a, (long) 3, result) <= result) {
@@ -9236,7 +15135,7 @@ zprobprime(
 		FREESPACE(cofactor_a);
 		return (0);
 	}
-	result = !zmcomposite(a, number_of_tests);
+	result = !zmlcomposite(a, number_of_tests);
  /*
   * if (!result) { printf("composite, but pseudo prime to the base 2:\n");
   * zwriteln(a); }
@@ -9308,6 +15207,56 @@ zrandoml(
 	FREESPACE(b);
 }
 
+static void
+zpwindow(
+	verylong a,
+	verylong d,
+	long n,
+	long bound,
+	unsigned char *s
+	)
+{	/* s[i] = 1 if a + i d has a prime factor 3 <= p <= bound, 0 <= i < n */
+	zpiter it;
+	long ra[TRIDIV_BLOCK];
+	long rd[TRIDIV_BLOCK];
+	zsrecip m[TRIDIV_BLOCK];
+	register long p;
+	register long i;
+	register long j;
+	register long k;
+
+	if (bound > RADIXROOT)
+		bound = RADIXROOT;
+	if (a[0] == 1 && a[1] <= bound)
+		bound = a[1] - 1;
+	zpiter_start(&it);
+	p = zpiter_nextb(&it, 3);
+	while (p <= bound)
+	{
+		for (k = 0; k < TRIDIV_BLOCK && p <= bound; k++)
+		{
+			zsrecip_init(&m[k], p);
+			p = zpiter_next(&it);
+		}
+		zsmod_block(m, k, a, ra);
+		zsmod_block(m, k, d, rd);
+		for (j = 0; j < k; j++)
+		{
+			register long q = m[j].d;
+
+			if (rd[j])
+				i = ((q - ra[j]) * zinvodds(rd[j], q)) % q;
+			else if (!ra[j])
+				i = 0, q = 1;
+			else
+				continue;
+			for (; i < n; i += q)
+				s[i] = 1;
+		}
+	}
+	zpiter_free(&it);
+}
+
 long 
 zrandomprime(
 	long bitlength,
@@ -9318,8 +15267,12 @@ zrandomprime(
 {
 	STATIC verylong t = 0;
 	STATIC verylong bnd = 0;
+	STATIC verylong d = 0;
 	register long adder = 2;
+	register long i;
+	register long j;
 	long three_mod_four = 0;
+	unsigned char s[PRIME_WINDOW];
 
 	if (bitlength < 0)
 	{
@@ -9344,6 +15297,7 @@ zrandomprime(
 	}
 	zintoz((long) 1, &bnd);
 	zlshift(bnd, bitlength, &bnd);
+	zintoz(adder, &d);
 	while (1)
 	{
 		if (three_mod_four)
@@ -9360,12 +15314,26 @@ zrandomprime(
 		}
 		while (zcompare(*a, bnd) < 0)
 		{
-			if (zprobprime(*a, nbtests))
-				return (1);
-			zsadd(*a, adder, a);
+			memset(s, 0, PRIME_WINDOW);
+			zpwindow(*a, d, PRIME_WINDOW, PRIME_WINDOW_BND, s);
+			for (i = j = 0; i < PRIME_WINDOW; i++)
+			{
+				if (s[i])
+					continue;
+				zsadd(*a, (i - j) * adder, a);
+				j = i;
+				if (zcompare(*a, bnd) >= 0)
+					break;
+				if (zprobprime(*a, nbtests))
+				{
+					FREE3SPACE(t,bnd,d);
+					return (1);
+				}
+			}
+			zsadd(*a, (PRIME_WINDOW - j) * adder, a);
 		}
 	}
-	FREE2SPACE(t,bnd);
+	FREE3SPACE(t,bnd,d);
 }
 
 long
@@ -9382,11 +15350,16 @@ zrandomqprime(
 	register long oddq = 1;
 	register long cnt = 2 * lp;
 	register long escape = 1;
+	register long i;
+	register long j;
+	register long n;
 	STATIC verylong tpsizem = 0;
 	STATIC verylong tpsize = 0;
 	STATIC verylong lown = 0;
 	STATIC verylong upn = 0;
 	STATIC verylong twoq = 0;
+	STATIC verylong aux = 0;
+	unsigned char s[PRIME_WINDOW];
 
 	if (lq < 0)
 	{
@@ -9426,13 +15399,13 @@ zrandomqprime(
 	zdiv(tpsizem, twoq, &lown, frac);
 	zdiv(tpsize, twoq, &upn, frac);
 	zsub(upn, lown, &upn);
-	do
+	for (;;)
 	{
 		cnt--;
 		if (!cnt)
 		{
 			if (zscompare(upn, lp) <= 0) {
-				FREE2SPACE(tpsizem,tpsize);
+				FREE3SPACE(tpsizem,tpsize,aux);
 				FREE3SPACE(lown,upn,twoq);
 				return (0);
 			}
@@ -9441,12 +15414,32 @@ zrandomqprime(
 		if (ziszero(*p))
 			zsadd(*p,escape++,p);
 		zadd(lown, *p, frac);
+		/* sieve the window frac, frac+1, ... below lown+upn */
+		zsub(upn, *p, &aux);
+		if (zscompare(aux, PRIME_WINDOW) >= 0)
+			n = PRIME_WINDOW;
+		else if ((n = ztoint(aux)) < 1)
+			n = 1;
 		zmul(twoq, *frac, p);
 		zsadd(*p, (long) 1, p);
-	} while (!zprobprime(*p, nbtests));
+		memset(s, 0, n);
+		zpwindow(*p, twoq, n, PRIME_WINDOW_BND, s);
+		for (i = j = 0; i < n; i++)
+		{
+			if (s[i])
+				continue;
+			zsmul(twoq, i - j, &aux);
+			zadd(*p, aux, p);
+			zsadd(*frac, i - j, frac);
+			j = i;
+			if (zprobprime(*p, nbtests))
+				goto found;
+		}
+	}
+found:
 	if (oddq)
 		zlshift(*frac, (long) 1, frac);
-	FREE2SPACE(tpsizem,tpsize); FREE3SPACE(lown,upn,twoq);
+	FREE3SPACE(tpsizem,tpsize,aux); FREE3SPACE(lown,upn,twoq);
 	return (1);
 }
 
@@ -9460,12 +15453,11 @@ zrandomfprime(
 	void (*generator) (verylong, verylong*)
 	)
 {
-	register long pp;
-	register long qmp;
-	register long bound;
-	register long small_frac = 0;
-	register long last = zp();
+	register long i;
+	register long j;
+	unsigned char s[PRIME_WINDOW];
 
+	STATIC verylong two = 0;
 	STATIC verylong aux = 0;
 
 	if ((zscompare(frac,2)<0) || (frac[1]&1))
@@ -9483,43 +15475,39 @@ zrandomfprime(
         	return (1);
 	}
 
-	if (zscompare(frac,RADIXROOT) <= 0)
-		small_frac = ztoint(frac);
-	if ((bound = (z2log(frac)+length)*5) > RADIXROOT)
-		bound = RADIXROOT;
+	zintoz(2,&two);
 	for (;;)
 	{
 		zrandoml(length-1,q,generator);
 		zlshift(*q,1,q);
 		zsadd(*q,1,q);
-		zpstart();
-		while ((pp=zpnext()) <= bound) 
-		{
-			if (!(qmp = zsdiv(*q,pp,&aux)))
-				goto next_try;
-			if (small_frac)
-				qmp *= small_frac;
-			else
-				qmp *= zsdiv(frac,pp,&aux);
-			if (!((qmp+1)%pp))
-				goto next_try;
-		}
-		if (zcomposite(q,1,2))
-			goto next_try;
+		/* sieve q, q+2, ... and p = frac*q+1 in steps of 2*frac */
 		zmul(*q,frac,p);
 		zsadd(*p,1,p);
-		if (zcomposite(p,1,2) || zmcomposite(*q,nbtests)
-			|| zmcomposite(*p,nbtests))
-			goto next_try;
-		if (last)
-			zpnextb(last);
-		else
-			zpstart2();
-		FREESPACE(aux);
-		return (1);
-		next_try:;
+		zlshift(frac,1,&aux);
+		memset(s, 0, PRIME_WINDOW);
+		zpwindow(*q, two, PRIME_WINDOW, PRIME_WINDOW_BND, s);
+		zpwindow(*p, aux, PRIME_WINDOW, PRIME_WINDOW_BND, s);
+		for (i = j = 0; i < PRIME_WINDOW; i++)
+		{
+			if (s[i])
+				continue;
+			zsadd(*q,2*(i-j),q);
+			j = i;
+			if (z2log(*q) > length)
+				break;
+			if (zcomposite(q,1,2))
+				continue;
+			zmul(*q,frac,p);
+			zsadd(*p,1,p);
+			if (zcomposite(p,1,2) || zmlcomposite(*q,nbtests)
+				|| zmlcomposite(*p,nbtests))
+				continue;
+			FREE2SPACE(two,aux);
+			return (1);
+		}
 	}
-	FREESPACE(aux);
+	FREE2SPACE(two,aux);
 }
 
 long
@@ -9593,11 +15581,13 @@ zrandomgprime(
 
 #define	ECM_MAXR		(1L << ECM_MAXT)
 
-static verylong ecm_tex[ECM_MAXE+1];
-static verylong ecm_tey[ECM_MAXE+1];
-static verylong ecm_coef[ECM_MAXR];
-static verylong ecm_power[ECM_MAXT];
-static verylong ecm_eval[ECM_MAXT];
+static TLS verylong ecm_tex[ECM_MAXE+1];
+static TLS verylong ecm_tey[ECM_MAXE+1];
+static TLS verylong ecm_coef[ECM_MAXR];
+static TLS verylong ecm_power[ECM_MAXT];
+static TLS verylong ecm_eval[ECM_MAXT];
+static TLS verylong ecm_den[ECM_MAXE];
+static TLS verylong ecm_inv[ECM_MAXE];
 
 static long 
 ph1set(
@@ -9855,12 +15845,12 @@ ph1(
 	register long q;
 	register long mp;
 	register long iter_cnt = 0;
-	register long last = zp();
 	register long return_value = 1;
+	zpiter it;
 
-	zpstart2();
+	zpiter_start(&it);
 	zintoz(1L,&e);
-	while ((p = zpnext()) <= m)
+	while ((p = zpiter_next(&it)) <= m)
 	{
 		mp = m / p;
 		q = p;
@@ -9890,10 +15880,7 @@ ph1(
 #endif
 	return_value = 0;
 done:
-	if (last)
-		zpnextb(last);
-	else
-		zpstart2();
+	zpiter_free(&it);
 	FREESPACE(e);
 	return(return_value);
 }
@@ -10213,6 +16200,60 @@ ph2exp(
 	return (0);
 }
 
+static long 
+ph2next(
+	verylong n,
+	long te,
+	verylong ra,
+	verylong *f
+	)
+{
+ /* (tex[k],tey[k])=(tex[k],tey[k])*(tex[k+1],tey[k+1]) for k<te	 */
+ /* with one inversion for all te additions			 */
+ /* if 0, success						 */
+ /* if 1, n factored, factor in f				 */
+	STATIC verylong t = 0;
+	STATIC verylong x3 = 0;
+	register long k;
+
+	for (k = 0; k < te; k++)
+	{
+		if (ecm_tex[k][0] < 0 || ecm_tex[k + 1][0] < 0
+		    || !zcompare(ecm_tex[k], ecm_tex[k + 1]))
+			break;
+		zsubmod(ecm_tex[k], ecm_tex[k + 1], n, &(ecm_den[k]));
+	}
+	if (k < te)
+	{
+		/* infinity or doubling somewhere, one at a time */
+		for (k = 0; k < te; k++)
+		{
+			if (ph2mul(n, ecm_tex[k], ecm_tey[k], ecm_tex[k + 1], ecm_tey[k + 1], &(ecm_tex[k]), &(ecm_tey[k]), ra, f))
+				return (1L);
+		}
+		return (0L);
+	}
+	if (zinv_batch(ecm_den, te, n, ecm_inv, 1))
+	{
+		zcopy(ecm_inv[0], f);
+		return (1L);
+	}
+	for (k = 0; k < te; k++)
+	{
+		zsubmod(ecm_tey[k], ecm_tey[k + 1], n, &t);
+		zmontmul(t, ecm_inv[k], &t);
+		zmontsq(t, &x3);
+		zsubmod(x3, ecm_tex[k], n, &x3);
+		zsubmod(x3, ecm_tex[k + 1], n, &x3);
+		zsubmod(ecm_tex[k], x3, n, &(ecm_tex[k]));
+		zmontmul(t, ecm_tex[k], &(ecm_tex[k]));
+		zsubmod(ecm_tex[k], ecm_tey[k], n, &(ecm_tey[k]));
+		zswap(&(ecm_tex[k]), &x3);
+	}
+	FREE2SPACE(t,x3);
+	return (0L);
+}
+
 static long 
 ph2set(
 	verylong n,
@@ -10333,7 +16374,7 @@ ph2(
  /* does second phase for m 		 */
  /* if 0, no factor found		 */
  /* if 1, n factored, factor in f	 */
-	static long non_initialized = 1;
+	static TLS long non_initialized = 1;
 	STATIC verylong x = 0;
 	STATIC verylong y = 0;
 	STATIC verylong x1 = 0;
@@ -10356,6 +16397,8 @@ ph2(
 			ecm_power[j] = 0;
 		for (j = 0; j < ECM_MAXT; j++)
 			ecm_eval[j] = 0;
+		for (j = 0; j < ECM_MAXE; j++)
+			ecm_den[j] = ecm_inv[j] = 0;
 		non_initialized = 0;
 	}
 	zcopy(inx, &x);
@@ -10387,12 +16430,9 @@ ph2(
 	zcopy(zr, (&(ecm_coef[0])));
 	for (j = 1; j <= r; j++)
 	{
-		for (k = 0; k < te; k++)
-		{
-			if (ph2mul(n, ecm_tex[k], ecm_tey[k], ecm_tex[k + 1], ecm_tey[k + 1], &(ecm_tex[k]), &(ecm_tey[k]), ra, f)) {
-				FREE2SPACE(x,y);
-				return (1L);
-			}
+		if (ph2next(n, te, ra, f)) {
+			FREE2SPACE(x,y);
+			return (1L);
 		}
 		zsubmod(n, ecm_tex[0], n, &x1);
 		zcopy(ecm_coef[j - 1], &ecm_coef[j]);
@@ -10411,12 +16451,9 @@ ph2(
 	zone(&prod);
 	for (j = s; j > 0; j--)
 	{
-		for (k = 0; k < te; k++)
-		{
-			if (ph2mul(n, ecm_tex[k], ecm_tey[k], ecm_tex[k + 1], ecm_tey[k + 1], &(ecm_tex[k]), &(ecm_tey[k]), ra, f)) {
-				FREE2SPACE(x,y); FREE3SPACE(x1,x2,prod);
-				return (1L);
-			}
+		if (ph2next(n, te, ra, f)) {
+			FREE2SPACE(x,y); FREE3SPACE(x1,x2,prod);
+			return (1L);
 		}
 		zcopy(ecm_tex[0], &(ecm_power[0]));
 		for (k = 0; k < ind; k++)
@@ -10464,7 +16501,7 @@ zecm_trial(
 	STATIC verylong alpha = 0;
 	STATIC verylong mu = 0;
 	STATIC verylong ra = 0;
-	static long te;
+	static TLS long te;
 	double tcnt = gettime();
 
 	if (ph1set(n, &rap, &alpha, &mu, &x, f) > 0) {
@@ -10770,7 +16807,7 @@ zfecm(
 	FILE *fp
 	)
 {
-	static long message = 0;
+	static TLS long message = 0;
 	if (!message)
 	{
 		fprintf(stderr,
@@ -10793,7 +16830,7 @@ zecm(
         long info
         )
 {
-	static long message = 0;
+	static TLS long message = 0;
 	if (!message)
 	{
 		fprintf(stderr,
@@ -10815,6 +16852,7 @@ zispower(
 {
 
 	register long p,l,c,r=0;
+	zpiter it;
 	STATIC verylong temp=0,a=0,t2=0;
 
 	if (zscompare(in_a,1L) <= 0)	/* assume a > 1 */
@@ -10827,13 +16865,14 @@ zispower(
 		else r*=2;
 		zcopy(temp,&a);
 	}
-	zpstart();
+	zpiter_start(&it);
+	zpiter_nextb(&it, 2);
 
 	l=z2log(a);
 	while (1) {
 		register long j,q;
 
-		p = zpnext();
+		p = zpiter_next(&it);
 		if (p * (z2logs(p)-1) > l)
 			goto stage2;
 samep:
@@ -10929,6 +16968,7 @@ stage2:
 		}
 		if (!c) {
 			zintoz(p,f);
+			zpiter_free(&it);
 			FREE3SPACE(temp,a,t2);
 			if (!r) return e;
 			return r*e;
@@ -10937,6 +16977,7 @@ stage2:
 done:
 	if (r)
 		zcopy(a,f);
+	zpiter_free(&it);
 	FREE3SPACE(temp,a,t2);
 	return r;
 }
@@ -10952,8 +16993,8 @@ is_sq(long n)
 
    Optimized for case where most arguments will be non-squares.
 */
-   static int first = 1;
-   static unsigned char squtab[667]; /* Quadratic residues for primes <= 53 */
+   static TLS int first = 1;
+   static TLS unsigned char squtab[667]; /* Quadratic residues for primes <= 53 */
    register long nn = n;
 #define MSK371 1
 #define MSK517 2
@@ -10999,7 +17040,8 @@ is_sq(long n)
 
 long zsquf(verylong n,verylong *f1,verylong *f2) {
 #define MSD	30
-	verylong  t1=0, t2=0;
+	ZINLINE(t1, INLINE_SIZE);
+	ZINLINE(t2, INLINE_SIZE);
 	register long iter, nsqroot, Qprev, Qnow, Pnow, iterbnd=50000;
 	register long den_bound, nsmallden=0, donethat=0;
 	long smalldens[MSD+1];
@@ -11201,14 +17243,15 @@ zdiv(
 	verylong p;
 	verylong pc;
 	long sign;
-	STATIC verylong a = 0;
-	STATIC verylong b = 0;
-	STATIC verylong c = 0;
-	STATIC verylong d = 0;
+	STATIC_INLINE(a);
+	STATIC_INLINE(b);
+	STATIC_INLINE(c);
+	STATIC_INLINE(d);
 	double btopinv;
 	double aux;
 	verylong q = *qqq;
 	verylong r = *rrr;
+	ZCOUNT_IN(div, ZCOUNT_LEN(in_a) + ZCOUNT_LEN(in_b));
 
 /*printf("zdiv: "); zwrite(in_a); printf(" div "); zwriteln(in_b);*/
 #ifndef START
@@ -11226,6 +17269,11 @@ zdiv(
 	        zhalt("division by zero in zdiv");
 	        return;
 	}
+	if (ZDIV_DC(in_a, in_b))
+	{
+	        zdiv_dc(in_a, in_b, qqq, rrr);
+	        return;
+	}
 
 	sign = (*in_a < 0 ? 2 : 0) | (*in_b < 0 ? 1 : 0);
 	if (*in_a < 0)
@@ -11346,6 +17394,7 @@ zdiv(
 done:	;
 
 	FREE2SPACE(a,b); FREE2SPACE(c,d);
+	ZCOUNT_OUT(div);
 }
 
 
@@ -11359,9 +17408,9 @@ zmod(
 	register long i;
 	register long qq;
 	verylong r = *rr;
-	STATIC verylong a = 0;
-	STATIC verylong b = 0;
-	STATIC verylong c = 0;
+	STATIC_INLINE(a);
+	STATIC_INLINE(b);
+	STATIC_INLINE(c);
 	long sa;
 	long sb;
 	long sq;
@@ -11370,6 +17419,7 @@ zmod(
 	long sign;
 	double btopinv;
 	double aux;
+	ZCOUNT_IN(div, ZCOUNT_LEN(in_a) + ZCOUNT_LEN(in_b));
 
 #ifndef START
 	if (fudge < 0)
@@ -11385,6 +17435,11 @@ zmod(
 	        zhalt("division by zero in zmod");
 	        return;
 	}
+	if (ZDIV_DC(in_a, in_b))
+	{
+	        zdiv_dc(in_a, in_b, (verylong *) 0, rr);
+	        return;
+	}
 
 	sign = (*in_a < 0 ? 2 : 0) | (*in_b < 0 ? 1 : 0);
 	if (*in_a < 0)
@@ -11474,6 +17529,7 @@ zmod(
 	*rr = r;
 done:	;
 	FREE2SPACE(a,b); FREESPACE(c);
+	ZCOUNT_OUT(div);
 }
 
 
@@ -11531,8 +17587,8 @@ zsdiv(
 
 	if ((d >= ALPHA50RADIX) || (d <= -ALPHA50RADIX))
 	{
-	        static verylong zd = 0;
-	        static verylong zb = 0;
+	        static TLS verylong zd = 0;
+	        static TLS verylong zb = 0;
 
 	        zintoz(d, &zb);
 	        zdiv(in_a, zb, bb, &zd);
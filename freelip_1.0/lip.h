@@ -163,7 +163,8 @@ Overview of available functions
   ----------------
         zstart, zsadd, zadd, zsub, zsubpos,
         zsmul, zmul, zmulin, zmul_plain, zsq, zsqin, zsq_plain,
-        zsdiv, zdiv, zsmod, zmod
+        zsdiv, zdiv, zsmod, zmod, zrecip_init, zrecip_free, zdiv_recip,
+        zmod_recip, zsrecip_init, zsdiv_recip, zsmod_recip, zsmod_block
 
   Shifting and bit manipulation
   -----------------------------
@@ -191,15 +192,21 @@ Overview of available functions
   Modular arithmetic
   ------------------
         zaddmod, zsubmod, zmulmods, zsmulmod, zmulmod, zsqmod, zdivmod,
-        zinvmod, zexpmods, z2expmod, zsexpmod, zexpmod, zexpmod_m_ary,
+        zinvmod, zinvmod_batch, zexpmods, z2expmod, zsexpmod, zexpmod, zexpmod_m_ary,
         zdefault_m, zexpmod_doub1, zexpmod_doub2, zexpmod_doub3, zexpmod_doub,
-        zmulmod26
+        zmulmod26, zbarrett_init, zbarrett_free, zbarrett_mod,
+        zbarrett_mulmod, zbarrett_sqmod, zbarrett_expmod, zspecial_init,
+        zspecial_form, zspecial_free, zspecial_mod, zspecial_mulmod,
+        zspecial_sqmod, zspecial_expmod, zfixbase_init, zfixbase_free,
+        zfixbase_exp, zfixbase_write, zfixbase_read
 
   Montgomery modular arithmetic
   -----------------------------
         zmstart, zmfree, ztom, zmtoz, zmontadd, zmontsub, zsmontmul, zmontmul,
-        zmontsq, zmontdiv, zmontinv, zmontexp, zmontexp_m_ary,
-        zmontexp_doub1, zmontexp_doub2, zmontexp_doub3, zmontexp_doub
+        zmontsq, zmontmul_batch, zmontsq_batch, zmontlanes, zmontdiv,
+        zmontinv, zmontinv_batch, zmontexp, zmontexp_m_ary,
+        zmontexp_doub1, zmontexp_doub2, zmontexp_doub3, zmontexp_doub,
+        zmontexp_multi
 
   Euclidean algorithms
   --------------------
@@ -213,11 +220,13 @@ Overview of available functions
 
   Small prime generation
   ----------------------
-        zpstart, zpstart2, zpnext, zpnextb, zp
+        zpstart, zpstart2, zpnext, zpnextb, zp,
+        zpiter_start, zpiter_next, zpiter_nextb, zpiter_last, zpiter_free,
+        zprange, zprange_array
 
   Compositeness testing and factorization
   ---------------------------------------
-        zcomposite, zmcomposite, zprime, zprobprime,
+        zcomposite, zmcomposite, zlcomposite, zprime, zprobprime,
         ztridiv, zpollardrho, zecm_trial, zecm, zfecm, zsquf
 
   NIST`s Digital Signature Algorithm (DSA) (Bellcore proprietary)
@@ -227,11 +236,13 @@ Overview of available functions
 
   Allocation
   ----------
-        zsetlength, zfree
+        zsetlength, zfree, zinline, zset_alloc,
+        zarena_open, zarena_close, zarena_free
 
   Timing
   ------
-        gettime, getutime, getstime, starttime, printtime
+        gettime, getutime, getstime, starttime, printtime,
+        zcount_get, zcount_reset
 
   Input and output
   ----------------
@@ -356,6 +367,38 @@ Remarks
   you can use the -DPRT_REALLOC flag. The indications will be
   printed on stderr.
 
+- With the -DZCOUNT flag the package counts calls, nits and time of
+  its main primitives, and the allocations it makes, see zcount_get.
+  Without it the counters cost nothing, and stay 0.
+
+- With the -DTHREADS flag (gcc and clang only) all state of the
+  package is thread local (__thread): the Montgomery modulus set by
+  zmstart, the state of the random generator (zrstart, zrstarts), the
+  small prime generator (zpstart, zpnext), the scratch space of zmul
+  and zsq, and the internal local variables. Every thread then works
+  as if it had the package to itself, so different threads can for
+  instance use different Montgomery moduli at the same time. Very long
+  ints themselves are not protected: don`t let one thread write a very
+  long int while another one uses it. With -DSTART, call zstart once
+  in every thread. zprange and zprange_array then also sieve in
+  several threads of their own (POSIX threads, link with -lpthread).
+
+- Montgomery multiplication and squaring (zmontmul, zmontsq, and
+  everything using them) have separate routines, with all loop bounds
+  fixed at compile time, for moduli of 256, 512, 1024, 2048, 3072
+  and 4096 bits; zexpmod_m_ary uses them, through Montgomery
+  arithmetic, for odd moduli of these sizes. Compile with
+  -DNO_MONT_FIXED to leave them out.
+
+- On x86-64 (with -DALPHA, and gcc or a compiler like it) the
+  processor is checked at run time for AVX-512 IFMA and AVX2. With
+  IFMA, zmontmul and zmontsq use a vectorized routine on 52 bit
+  digits for moduli of at least MONT_SIMD_CROV nits (default 10) and
+  at most 8192 bits. zmontmul_batch and zmontsq_batch do 8 (IFMA) or
+  4 (AVX2, from MONT_SIMD_CROV nits on) independent multiplications
+  at the same time, one in every lane. Compile with -DNO_SIMD to
+  leave all this out.
+
 - If an error is detected (division by zero, undefined Montgomery
   modulus, undefined results, etc) a message is printed on stderr
   and the program exits. If the -DNO_HALT flag is used, the
@@ -442,6 +485,12 @@ Before you compile
         in doubles are ordered high-low. Use -DDOUBLE_LOW_HIGH if it`s
         the other way around)
 
+	(Addition: on 64-bit machines whose compiler has the 128-bit
+        integer type __int128 (gcc, clang), use -DALPHA -DINT128 to get
+        the inner loops done by single 64x64->128 bit multiplies instead
+        of the half-word Karatsuba macros; NBITS stays 62, and the
+        quotient digits in zdiv and zmod are computed exactly)
+
         #define RADIX           (1<<NBITS)      Don`t touch this, but it`s
                                                 good to know what the radix is.
 
@@ -457,7 +506,93 @@ Before you compile
                 choices above are not too far from optimal on a DEC5000;
                 on Sparcs the optimal values are somewhat smaller. You
                 can make KAR_DEPTH as large as you like, as long as you
-                have enough memory.
+                have enough memory. The scratch space of the recursion,
+                about 20 times the length of the longest operand, is
+                allocated in one piece before the recursion starts (see
+                zmul_r and -DTHREADS).
+
+        #define TOOM3_MUL_CROV  400             If in a call zmul(a, b, &c)
+        #define TOOM3_SQU_CROV  400             both a and b have at least
+        #define TOOM4_MUL_CROV  1000            TOOM3_MUL_CROV nits, then
+        #define TOOM4_SQU_CROV  1000            Toom-3 is used instead of
+                Karatsuba, and Toom-4 if the smaller of the two has at
+                least TOOM4_MUL_CROV nits; the recursion falls back to
+                Karatsuba below TOOM3_MUL_CROV. If one of a and b is more
+                than twice as long as the other, the longer one is cut
+                in pieces of the length of the shorter one. Same for zsq
+                with TOOM3_SQU_CROV and TOOM4_SQU_CROV. The values above
+                are for 62-bit nits (-DALPHA); set them with -D flags
+                for your machine.
+
+        #define NTT_MUL_CROV    3000            With -DALPHA, zmul(a, b, &c)
+        #define NTT_SQU_CROV    3000            multiplies by a number
+                theoretic transform modulo three primes, followed by
+                Chinese remaindering, as soon as the smaller of a and b
+                has at least NTT_MUL_CROV nits and the product has less
+                than 2^24 nits; same for zsq and NTT_SQU_CROV. They
+                should not be smaller than the TOOM3 crossovers.
+
+        #define DIV_CROV        60              If in a call zdiv(a, b, &q,
+                &r) or zmod(a, b, &r) both b and the quotient have at
+                least DIV_CROV nits, the quotient is computed by divide
+                and conquer: by recursive divisions by the top half of b,
+                each followed by a multiplication by the bottom half, so
+                that division becomes about as fast as zmul. Below
+                DIV_CROV ordinary long division is used.
+
+        #define RECIP_CROV      1500            zrecip_init(&m, b)
+                precomputes a reciprocal of b if b has at least
+                RECIP_CROV nits; zdiv_recip and zmod_recip then divide
+                by b with two calls to zmul per b[0] nits of the
+                dividend. For smaller b they call zdiv and zmod.
+
+        #define BARRETT_CROV    60              Moduli of 2 up to
+                BARRETT_CROV nits are reduced by Barrett`s method in
+                the zbarrett_ functions, in zexpmod, and in zmulmod and
+                zsqmod once the same modulus is used twice in a row.
+                Larger moduli are reduced by zmod, whose divide and
+                conquer division is faster there.
+
+        #define SPECIAL_CROV    10              Moduli 2^p - c with c of
+                more than one nit are reduced by shifts and adds (see
+                zspecial_init) from SPECIAL_CROV nits on; below, Barrett
+                reduction is faster. For c of one nit there is no bound.
+
+        #define LEHMER_CROV     8               zgcd and zgcdeucl switch
+        #define HGCD_CROV       100             from the binary and the
+                plain Euclidean algorithm to Lehmer`s algorithm when
+                both arguments have at least LEHMER_CROV nits. When both
+                have at least HGCD_CROV nits, zgcd, zgcdeucl, zexteucl,
+                zinv, zinvmod and zmontinv use a half gcd: the quotients
+                of the top halves of the arguments are found recursively
+                and applied to the whole with zmul, so that the gcd is
+                only a log factor slower than zmul. HGCD_CROV is also
+                where that recursion stops.
+
+        #define RADIX_CROV      30              Radix conversion (zfwrite,
+                zswrite, zstobas, ztobas and their inverses zfread,
+                zsread, zstrtoz, zsbastoz, zbastoz) splits a number on
+                the square powers base^(2^k), or joins the digits
+                back, until the pieces have about RADIX_CROV nits; the
+                pieces are converted digit by digit. The powers are
+                cached for the last base used, so repeated conversions
+                in the same base pay for them once. Hexadecimal in- and
+                output (zhfwrite, zhfread, zhsread) is linear.
+
+        #define PIPPENGER_CROV  128             zmontexp_multi with fewer
+                than PIPPENGER_CROV bases interleaves one sliding
+                window per base over a common chain of squarings; from
+                PIPPENGER_CROV bases on it sorts the bases into buckets
+                by their exponent digits (Pippenger), which costs about
+                one multiplication per base and digit.
+
+        #define SDIV_CROV       3               With -DALPHA and a compiler
+                with 128-bit integers, zsdiv and zsmod divide numbers of
+                at least SDIV_CROV nits by a positive d < RADIX with a
+                precomputed reciprocal of d (see zsrecip_init), which
+                replaces the division of each step by two
+                multiplications. Below SDIV_CROV computing the
+                reciprocal costs more than it saves.
 
         #define SIZE            20      <------ Set this to anything such that
                                                 SIZE*NBITS>=CHARL*SIZEOFLONG
@@ -485,11 +620,16 @@ Before you compile
                 This should not be too restrictive, because long lines
                 can easily be split into smaller lines, see below.
 
-        #define PRIM_BND         16500            This enables you to
-                                                generate the primes
-                less than (2*PRIM_BND+1)^2 using zpnext, see below.
-                For 16500 the last prime that can thus be generated is
-                1089065981.
+        #define PRIM_BND         16500            The primes below
+                                                2*PRIM_BND+3 are computed
+                at once when zpnext is first used, see below; larger
+                primes needed to sieve further are computed as needed.
+                zpnext generates the primes less than RADIX.
+
+        #define PRIM_SEG         32768            zpnext sieves
+                                                30*PRIM_SEG numbers at
+                a time, one bit for each number prime to 30. Choose it
+                so that PRIM_SEG bytes fit in the level 1 or 2 cache.
 }
 #endif
 
@@ -502,6 +642,109 @@ Before you compile
 /*The type of very long ints.*/
 typedef long * verylong;
 
+/*Declares a very long int a with room for len nits on the stack, see zinline.*/
+#define ZINLINE(a, len) long a##_inl[(len) + 2]; verylong a = zinline(a##_inl, (len))
+
+/*An arena new very long ints can be allocated from, see zarena_open.*/
+#define ZARENA_CLASSES 48
+typedef struct zarena_s {
+	struct zarena_s *prev;
+	void *chunks;
+	long *next;
+	long *end;
+	long *free[ZARENA_CLASSES];
+	long current;
+	long peak;
+	long size;
+} zarena;
+
+/*Calls, nits and seconds spent in one primitive, see zcount_get.*/
+typedef struct {
+	long calls;
+	long nits;
+	double time;
+} zcount_op;
+
+/*Counters of the package, see zcount_get.*/
+typedef struct {
+	zcount_op mul;
+	zcount_op sq;
+	zcount_op montmul;
+	zcount_op montsq;
+	zcount_op div;
+	zcount_op gcd;
+	long kar_depth;
+	long allocs;
+	long reallocs;
+	long frees;
+	long bytes;
+	double time;
+} zcounters;
+
+/*A Montgomery modulus with its precomputed constants, see zmont_ctx_init.*/
+typedef struct {
+	verylong n;
+	verylong r;
+	verylong rr;
+	verylong rrr;
+	verylong nm;
+	long top;
+	long inv1;
+	long inv2;
+} zmont_ctx;
+
+/*A divisor with its precomputed reciprocal, see zrecip_init.*/
+typedef struct {
+	verylong b;
+	verylong v;
+} zrecip;
+
+/*A divisor of one nit with its precomputed reciprocal, see zsrecip_init.*/
+typedef struct {
+	long d;
+	long s;
+	unsigned long dn;
+	unsigned long v;
+} zsrecip;
+
+/*A prime iterator with its own sieve segment, see zpiter_start.*/
+typedef struct {
+	unsigned char *seg;
+	long k;
+	long len;
+	long i;
+	long b;
+	long small;
+	long last;
+	long base;
+} zpiter;
+
+/*A modulus with its Barrett reciprocal, see zbarrett_init.*/
+typedef struct {
+	verylong n;
+	verylong v;
+	long k;
+} zbarrett;
+
+/*A modulus 2^p-c with small c, see zspecial_init.*/
+#define ZSPECIAL_TERMS 8
+typedef struct {
+	verylong n;
+	verylong c;
+	long p;
+	long w;
+	long e[ZSPECIAL_TERMS];
+} zspecial;
+
+/*A fixed base with its table of powers, see zfixbase_init.*/
+typedef struct {
+	zmont_ctx m;
+	verylong *t;
+	verylong top;
+	long w;
+	long rows;
+} zfixbase;
+
 
 
 #define ILLEGAL 0
@@ -536,8 +779,10 @@ typedef long * verylong;
 #  define ILLEGAL	1
 # endif
 # ifndef PLAIN
-#  undef KARAT
-#  define KARAT  1
+#  ifndef INT128
+#   undef KARAT
+#   define KARAT  1
+#  endif
 # endif
 # ifdef SINGLE_MUL
 #  undef ILLEGAL
@@ -633,15 +878,13 @@ typedef long * verylong;
 # else
 #  define PRIM_BND      (1L<<(NBITSH-1))
 # endif
-                        /* to generate primes <= (2*PRIM_BND+1)^2 */
-                        /* last prime for NBITS == 30 is 1073807359 */
-			/* same for SINGLE_MUL */
+                        /* base primes < 2*PRIM_BND+3 computed at once */
 #elif (PRIM_BND>(1L<<(NBITSH-1)))
 # undef PRIM_BND
 # define PRIM_BND       (1L<<(NBITSH-1))
 #endif
 
-#define PRIM_UP         ((((PRIM_BND<<1)+1)*((PRIM_BND<<1)+1))-(NBITS<<2))
+#define PRIM_UP         RADIX
 
 #if (NBITS&1)
 # undef ILLEGAL
@@ -685,6 +928,21 @@ typedef long * verylong;
 # endif
 #endif
 
+#ifdef INT128
+# ifndef ALPHA
+#  undef ILLEGAL
+#  define ILLEGAL 1
+# endif
+# ifdef PLAIN_OR_KARAT
+#  undef ILLEGAL
+#  define ILLEGAL 1
+# endif
+# ifdef SINGLE_MUL
+#  undef ILLEGAL
+#  define ILLEGAL 1
+# endif
+#endif
+
 /******************************************************************************\
 *   Internal macros
 *
@@ -742,8 +1000,12 @@ typedef long * verylong;
 *  
 *  Addition, subtraction, multiplication, squaring, and
 *  division with remainder on signed arbitrary length integers.
-*  Multiplication and squaring use Karatsuba, if inputs large enough;
-*  see KAR_MUL_CROV, KAR_SQU_CROV, and KAR_DEPTH as explained above.
+*  Multiplication and squaring use Karatsuba, if inputs large enough,
+*  Toom-3 or Toom-4 for even larger inputs, and (with -DALPHA) a number
+*  theoretic transform for the largest ones; see KAR_MUL_CROV,
+*  KAR_SQU_CROV, KAR_DEPTH, and the TOOM and NTT crossovers as explained
+*  above. Division of large inputs is done by divide and conquer, see
+*  DIV_CROV.
 \******************************************************************************/
 
     void zstart(void);
@@ -798,6 +1060,19 @@ typedef long * verylong;
         * output cannot be input
         \******************************************************************/
 
+    void zmul_r(verylong a, verylong b, verylong *c, verylong *s);
+        /******************************************************************\
+        * *c = a * b;
+        * 
+        * output cannot be input. Same as zmul, but the scratch space
+        * of the Karatsuba recursion is taken from *s, which is grown
+        * (once, before the recursion) as needed and can be reused by
+        * the caller for later calls. zmul itself uses one internal
+        * scratch space, which is thread local if compiled with
+        * -DTHREADS. Different threads can call zmul_r at the same
+        * time, as long as they use different *s.
+        \******************************************************************/
+
     void zmulin(verylong a, verylong *b);
         /******************************************************************\
         * *b = a * b;
@@ -819,6 +1094,13 @@ typedef long * verylong;
         * output cannot be input
         \******************************************************************/
 
+    void zsq_r(verylong a, verylong *c, verylong *s);
+        /******************************************************************\
+        * *c = a * a;
+        * 
+        * output cannot be input, scratch space in *s as in zmul_r
+        \******************************************************************/
+
     void zsqin(verylong *a);
         /******************************************************************\
         * *a = a ^ 2;
@@ -880,6 +1162,72 @@ typedef long * verylong;
         * result undefined if error occurs
         \******************************************************************/
 
+    void zrecip_init(zrecip *m, verylong b);
+        /******************************************************************\
+        * initializes *m with the divisor b > 0, and its reciprocal
+        * RADIX^(2*b[0]) / b if b has at least RECIP_CROV nits. Declare
+        * *m as zrecip m = {0}; *m may have been used for another
+        * divisor before
+        *
+        * possible error message:
+        *   zero or negative divisor in zrecip_init
+        * result undefined if error occurs
+        \******************************************************************/
+
+    void zrecip_free(zrecip *m);
+        /******************************************************************\
+        * frees the space used by *m
+        \******************************************************************/
+
+    void zdiv_recip(zrecip *m, verylong a, verylong *q, verylong *r);
+    void zmod_recip(zrecip *m, verylong a, verylong *r);
+        /******************************************************************\
+        * as zdiv(a, m->b, q, r) and zmod(a, m->b, r), faster if many
+        * numbers are divided by the same large m->b
+        *
+        * possible error message:
+        *   undefined divisor in zdiv_recip
+        * result undefined if error occurs
+        \******************************************************************/
+
+    void zsrecip_init(zsrecip *m, long d);
+        /******************************************************************\
+        * initializes *m with the divisor 0 < d < RADIX, and its reciprocal
+        * for division without a division instruction (Moller and
+        * Granlund); declare *m as zsrecip m = {0}. The reciprocal is
+        * used with -DALPHA and a compiler with 128-bit integers (gcc,
+        * clang), otherwise the functions below call zsdiv and zsmod
+        *
+        * possible error message:
+        *   wrong divisor in zsrecip_init
+        * result undefined if error occurs
+        \******************************************************************/
+
+    long zsdiv_recip(zsrecip *m, verylong a, verylong *q);
+    long zsmod_recip(zsrecip *m, verylong a);
+        /******************************************************************\
+        * as zsdiv(a, m->d, q) and zsmod(a, m->d), faster if many
+        * numbers are divided by the same m->d
+        *
+        * possible error messages:
+        *   undefined divisor in zsdiv_recip
+        *   undefined divisor in zsmod_block
+        * result undefined if error occurs
+        \******************************************************************/
+
+    void zsmod_block(zsrecip *m, long k, verylong a, long *r);
+        /******************************************************************\
+        * r[i] = zsmod(a, m[i].d) for 0 <= i < k, in one pass over a,
+        * so that a is read once for a block of divisors, as in trial
+        * division by many small primes. ztridiv does this for blocks
+        * of TRIDIV_BLOCK (default 32) primes, which also serves
+        * zprobprime and zfecm
+        *
+        * possible error message:
+        *   undefined divisor in zsmod_block
+        * result undefined if error occurs
+        \******************************************************************/
+
 
 /******************************************************************************\
 *  Shifting and bit manipulation
@@ -1262,7 +1610,7 @@ typedef long * verylong;
         /******************************************************************\
         * sets *len to m and row[i] such that |n| equals
         * sum from i = 0 to i = m - 1 of row[i] * |base| ^ i,
-        * with 0 <= row[i] < |base|
+        * with 0 <= row[i] < |base|, subquadratic (see RADIX_CROV)
         * returns 1 if m <= *len on input
         * (which should on input be the length of row[])
         * returns 0 if *len on input is too small to represent
@@ -1461,6 +1809,96 @@ long zispower( verylong a, verylong *f);
         * result undefined if error occurs
         \******************************************************************/
 
+    void zbarrett_init(zbarrett *m, verylong n);
+        /******************************************************************\
+        * initializes *m with the modulus n > 0 and the reciprocal
+        * RADIX^(2*n[0]) / n used by Barrett reduction. n may be even.
+        * Declare *m as zbarrett m = {0}; *m may have been used for
+        * another modulus before
+        *
+        * possible error message:
+        *   zero or negative modulus in zbarrett_init
+        * result undefined if error occurs
+        \******************************************************************/
+
+    void zbarrett_free(zbarrett *m);
+        /******************************************************************\
+        * frees the space used by *m
+        \******************************************************************/
+
+    void zbarrett_mod(zbarrett *m, verylong a, verylong *c);
+    void zbarrett_mulmod(zbarrett *m, verylong a, verylong b, verylong *c);
+    void zbarrett_sqmod(zbarrett *m, verylong a, verylong *c);
+        /******************************************************************\
+        * as zmod(a, m->n, c), zmulmod(a, b, m->n, c) and
+        * zsqmod(a, m->n, c), without a division if a (or the product)
+        * is non-negative and has at most 2*m->n[0] nits
+        *
+        * possible error message:
+        *   undefined modulus in zbarrett_mod
+        * result undefined if error occurs
+        \******************************************************************/
+
+    void zbarrett_expmod(zbarrett *m, verylong a, verylong e, verylong *b);
+        /******************************************************************\
+        * *b = (a ^ e) % m->n, by sliding windows of zdefault_m(e[0])
+        * bits; as zexpmod otherwise
+        *
+        * possible error message:
+        *   undefined modulus in zbarrett_expmod
+        *   undefined quotient in zbarrett_expmod  (caused by negative exponent)
+        * result undefined if error occurs
+        \******************************************************************/
+
+    long zspecial_init(zspecial *m, verylong n);
+        /******************************************************************\
+        * initializes *m with the modulus n > 0, and returns 1 if n is
+        * of the form 2^p - c with 0 < c < 2^(p/2), where c is either
+        * less than RADIX or, if n has at least SPECIAL_CROV nits, a
+        * sum of at most ZSPECIAL_TERMS signed powers of two. This
+        * covers the Mersenne numbers, 2^p - c for small c, and large
+        * generalized Mersenne numbers such as 2^1024 - 2^341 + 2^204 - 1.
+        * Then zspecial_ reduces by shifts and adds. Otherwise it
+        * returns 0, and zspecial_ uses zmod. Declare *m as
+        * zspecial m = {0}; *m may have been used for another modulus
+        * before.
+        * zmulmod, zsqmod, zexpmod and zmcomposite detect these moduli
+        * by themselves
+        *
+        * possible error message:
+        *   zero or negative modulus in zspecial_init
+        * result undefined if error occurs
+        \******************************************************************/
+
+    void zspecial_form(zspecial *m, long p, verylong c);
+        /******************************************************************\
+        * as zspecial_init(m, 2^p - c), for a declared form
+        *
+        * possible error message:
+        *   2^p-c not a special modulus in zspecial_form
+        * result undefined if error occurs
+        \******************************************************************/
+
+    void zspecial_free(zspecial *m);
+        /******************************************************************\
+        * frees the space used by *m
+        \******************************************************************/
+
+    void zspecial_mod(zspecial *m, verylong a, verylong *c);
+    void zspecial_mulmod(zspecial *m, verylong a, verylong b, verylong *c);
+    void zspecial_sqmod(zspecial *m, verylong a, verylong *c);
+    void zspecial_expmod(zspecial *m, verylong a, verylong e, verylong *b);
+        /******************************************************************\
+        * as zbarrett_mod, zbarrett_mulmod, zbarrett_sqmod and
+        * zbarrett_expmod, for the modulus m->n
+        *
+        * possible error message:
+        *   undefined modulus in zspecial_mod
+        *   undefined modulus in zspecial_expmod
+        *   undefined quotient in zspecial_expmod  (caused by negative exponent)
+        * result undefined if error occurs
+        \******************************************************************/
+
     void zsqrtmod(verylong a, verylong p, verylong *s);
         /******************************************************************\
         * computes x so that x^2 == a mod p for prime p, and puts x in *s.
@@ -1509,6 +1947,24 @@ long zispower( verylong a, verylong *f);
         * (of course, only if the -DNO_HALT flag is used)
         \******************************************************************/
 
+    void zinvmod_batch(verylong *a, long count, verylong n, verylong *c);
+        /******************************************************************\
+        * c[i] = (1 / a[i]) % n;   for 0 <= i < count
+        *
+        * with 0 <= a[i], c[i] < n (and n positive), a and c different
+        * arrays; Montgomery`s trick: one zinv and 3 (count - 1) calls
+        * to zmulmod instead of count calls to zinvmod
+        *
+        * possible error message:
+        *   modulus zero in zinvmod_batch
+        *   input and output the same in zinvmod_batch
+        *   undefined inverse in zinvmod_batch
+        * result undefined if error occurs, except if some inverse is
+        * undefined, in which case the factor gcd(a[i], n) of n, for
+        * the first such i, will be returned in c[0] (of course, only
+        * if the -DNO_HALT flag is used)
+        \******************************************************************/
+
     long zexpmods(long a, long e, long n);
         /******************************************************************\
         * return ((a ^ |e|) % n);
@@ -1768,6 +2224,37 @@ long zispower( verylong a, verylong *f);
         * result undefined if error occurs
         \******************************************************************/
 
+    void zmontmul_batch(long k, verylong *ma, verylong *mb, verylong *mc);
+        /******************************************************************\
+        * mc[i] = (ma[i] * mb[i]) % zn; for 0 <= i < k
+        * 
+        * for Montgomery numbers ma[i] and mb[i] only. The k products
+        * are independent, and done zmontlanes() at a time if the
+        * processor has vector instructions. mc[i] can be ma[i] or mb[i].
+        *
+        * possible error message:
+        *   undefined Montgomery modulus in zmontmul_batch
+        * result undefined if error occurs
+        \******************************************************************/
+
+    void zmontsq_batch(long k, verylong *ma, verylong *mb);
+        /******************************************************************\
+        * mb[i] = (ma[i] * ma[i]) % zn; for 0 <= i < k
+        * 
+        * as zmontmul_batch
+        *
+        * possible error message:
+        *   undefined Montgomery modulus in zmontsq_batch
+        * result undefined if error occurs
+        \******************************************************************/
+
+    long zmontlanes();
+        /******************************************************************\
+        * returns the number of products zmontmul_batch and zmontsq_batch
+        * do at the same time: 8 with AVX-512 IFMA, 4 with AVX2, 1
+        * otherwise. Use a multiple of it for k to use all lanes.
+        \******************************************************************/
+
     void zmontdiv(verylong ma, verylong mb, verylong *mc);
         /******************************************************************\
         * *mc becomes the Montgomery quotient of ma and mb,
@@ -1802,6 +2289,20 @@ long zispower( verylong a, verylong *f);
         * (of course, only if the -DNO_HALT flag is used)
         \******************************************************************/
 
+    void zmontinv_batch(verylong *ma, long count, verylong *mb);
+        /******************************************************************\
+        * mb[i] becomes the Montgomery inverse of ma[i], for
+        * 0 <= i < count, as zinvmod_batch
+        *
+        * possible error message:
+        *   undefined Montgomery modulus in zmontinv_batch
+        *   input and output the same in zmontinv_batch
+        *   undefined inverse in zmontinv_batch
+        * result undefined if error occurs, except if some inverse
+        * is undefined, in which case a factor of zn will be returned
+        * in mb[0] (of course, only if the -DNO_HALT flag is used)
+        \******************************************************************/
+
     void zmontexp(verylong ma, verylong e, verylong *mb);
         /******************************************************************\
         * *mb = (ma ^ e) % zn;
@@ -1892,6 +2393,133 @@ long zispower( verylong a, verylong *f);
         * result undefined if error occurs
         \******************************************************************/
 
+    void zmontexp_multi(verylong *x, verylong *e, long k, verylong *b);
+        /******************************************************************\
+        * b = (x[0] ^ e[0]) * ... * (x[k-1] ^ e[k-1]) % zn;
+        *
+        * for Montgomery numbers x[i] and normal e[i] >= 0, with a single
+        * chain of squarings for all k powers: interleaved sliding windows
+        * for small k, Pippenger's bucket method from PIPPENGER_CROV on.
+        * For k = 2 about as fast as zmontexp_doub, for k = 8 twice and
+        * for k = 1000 five times as fast as k / 2 calls to zmontexp_doub.
+        * b may be one of the x[i] or e[i]; b = 1 (in Montgomery
+        * representation) if k <= 0 or all e[i] are zero
+        *
+        * possible error message:
+        *  undefined Montgomery modulus in zmontexp_multi
+        *  negative exponent in zmontexp_multi     (if some e[i] negative)
+        *  allocation failure in zmontexp_multi
+        * result undefined if error occurs
+        \******************************************************************/
+
+/******************************************************************************\
+*  Montgomery contexts
+*
+*  Instead of a single modulus zn installed by zmstart, a zmont_ctx holds
+*  a Montgomery modulus together with the constants zmstart computes for
+*  it, so that several moduli (for instance p and q in CRT RSA or DSA)
+*  can be used side by side without recomputing anything. Declare it as
+*  zmont_ctx m = {0}; or call zmont_ctx_init on it directly. The _ctx
+*  functions work exactly as the functions without _ctx, but modulo the
+*  modulus of m; they don`t change the modulus installed by zmstart.
+*  Numbers in Montgomery representation belong to the context they were
+*  made with.
+\******************************************************************************/
+
+    void zmont_ctx_init(zmont_ctx *m, verylong n);
+        /******************************************************************\
+        * initializes *m with the Montgomery modulus n and its constants,
+        * only for odd positive n; *m may have been used for another
+        * modulus before
+        *
+        * possible error message:
+        *   zero, or even, or negative modulus in zmstart
+        * result undefined if error occurs
+        \******************************************************************/
+
+    void zmont_ctx_free(zmont_ctx *m);
+        /******************************************************************\
+        * frees the space used by *m
+        \******************************************************************/
+
+    void ztom_ctx(zmont_ctx *m, verylong a, verylong *ma);
+    void zmtoz_ctx(zmont_ctx *m, verylong ma, verylong *a);
+    void zmontmul_ctx(zmont_ctx *m, verylong ma, verylong mb, verylong *mc);
+    void zmontsq_ctx(zmont_ctx *m, verylong ma, verylong *mb);
+    void zmontexp_ctx(zmont_ctx *m, verylong ma, verylong e, verylong *mb);
+    void zmontexp_m_ary_ctx(zmont_ctx *m, verylong ma, verylong e,
+                       verylong *mb, long k);
+    void zmontexp_doub_ctx(zmont_ctx *m, verylong x1, verylong e1,
+                       verylong x2, verylong e2, verylong *b);
+    void zmontexp_multi_ctx(zmont_ctx *m, verylong *x, verylong *e, long k,
+                       verylong *b);
+        /******************************************************************\
+        * as ztom, zmtoz, zmontmul, zmontsq, zmontexp, zmontexp_m_ary,
+        * zmontexp_doub and zmontexp_multi, with modulus m->n instead of zn
+        *
+        * possible error messages: as for the functions without _ctx
+        \******************************************************************/
+
+
+/******************************************************************************\
+*  Fixed-base exponentiation
+*
+*  When the same base g is raised to many exponents modulo the same n, as
+*  the generator in DSA or Diffie-Hellman, a zfixbase holds g^(d*2^(w*j))
+*  mod n for all w-bit digits d and all digit positions j of exponents of
+*  up to a given number of bits. g^e then takes one multiplication per
+*  nonzero digit of e and no squarings. Declare it as zfixbase f = {0};
+\******************************************************************************/
+
+    void zfixbase_init(zfixbase *f, verylong g, verylong n, long bits, long w);
+        /******************************************************************\
+        * initializes *f with the table of g mod n for exponents of at most
+        * bits bits (if bits < 1, as many bits as n), in w-bit digits,
+        * only for odd n > 1. The table has (2^w - 1)*ceil(bits/w) entries
+        * of n[0] nits; if w < 1 the largest w <= 8 with at most 8*bits
+        * entries is taken (w = 5 for both 160 and 2048 bits),
+        * w > 16 is taken as 16. *f may have been used before
+        *
+        * possible error message:
+        *   zero, or even, or negative modulus in zfixbase_init
+        *   allocation failure in zfixbase_init
+        * result undefined if error occurs
+        \******************************************************************/
+
+    void zfixbase_free(zfixbase *f);
+        /******************************************************************\
+        * frees the space used by *f
+        \******************************************************************/
+
+    void zfixbase_exp(zfixbase *f, verylong e, verylong *b);
+        /******************************************************************\
+        * *b = (g ^ e) % n, for g and n of zfixbase_init, with 0 <= b < n;
+        * e of more bits than the table covers is allowed, the excess bits
+        * cost an ordinary exponentiation. For the 160-bit exponents of
+        * DSA about five times as fast as zexpmod
+        *
+        * possible error message:
+        *   undefined table in zfixbase_exp
+        *   undefined quotient in zfixbase_exp  (caused by negative exponent)
+        * result undefined if error occurs, except if the quotient
+        * is undefined, in which case a factor of n will be returned in b
+        * (of course, only if the -DNO_HALT flag is used)
+        \******************************************************************/
+
+    long zfixbase_write(FILE *f, zfixbase *fb);
+    long zfixbase_read(FILE *f, zfixbase *fb);
+        /******************************************************************\
+        * write *fb to the binary file f, and read it back into *fb (which
+        * may have been used before), so that a table computed once can be
+        * loaded at startup. Return 1 if success, 0 if not; the file can
+        * only be read by the package compiled with the same NBITS and
+        * size of longs. zfixbase_read checks that the entries are reduced
+        * mod n, and leaves *fb empty if they are not
+        *
+        * possible error message:
+        *   allocation failure in zfixbase_read
+        \******************************************************************/
+
 
 /******************************************************************************\
 *  Euclidean algorithms 
@@ -1904,7 +2532,8 @@ long zispower( verylong a, verylong *f);
         /******************************************************************\
         * *r = greatest common divisor of m1 and m2;
         * 
-        * uses binary gcd algorithm
+        * uses binary gcd algorithm, or Lehmer`s algorithm and the
+        * half gcd for longer m1 and m2 (see LEHMER_CROV and HGCD_CROV)
         \******************************************************************/
 
     void zgcdeucl(verylong m1, verylong m2, verylong *r);
@@ -1912,7 +2541,8 @@ long zispower( verylong a, verylong *f);
         * *r = greatest common divisor of m1 and m2;
         * 
         * uses plain Euclidean algorithm (which might be
-        * faster than the binary method in special cases)
+        * faster than the binary method in special cases),
+        * the same as zgcd from LEHMER_CROV nits on
         \******************************************************************/
 
     void zexteucl(verylong a, verylong *xa,
@@ -1923,7 +2553,8 @@ long zispower( verylong a, verylong *f);
         * 
         * sets *d, *xa and *xb given a and b,
         * arguments cannot be the same,
-        * uses Lehmer`s trick
+        * uses Lehmer`s trick, and the half gcd if a and b have
+        * at least HGCD_CROV nits
         *
         * possible error message:
         *   non-zero remainder in zexteucl...BUG      (report this)
@@ -1964,7 +2595,8 @@ long zispower( verylong a, verylong *f);
         * }
         * 
         * where inv is such that (inv * a) % b == 1
-        * a,b > 0, uses Lehmer`s trick
+        * a,b > 0, uses Lehmer`s trick, and the half gcd if a and b
+        * have at least HGCD_CROV nits
         *
         * possible error message:
         *   zero or negative argument(s) in zinv
@@ -2105,7 +2737,9 @@ long zispower( verylong a, verylong *f);
         * zrandomprime works by picking odd number of right size, keep adding
         * two until probably prime, or too large in which case pick again,
         * and start adding again (in accordance with NIST DSS Appendix),
-        * generator as in zrandoml
+        * generator as in zrandoml; the candidates are sieved PRIME_WINDOW
+        * (default 4096) at a time by the primes up to PRIME_WINDOW_BND
+        * (default 32768), and only the survivors go to zprobprime
         \******************************************************************/
             
     long zrandomqprime(long lp, long lq, long nbtests,
@@ -2126,7 +2760,8 @@ long zispower( verylong a, verylong *f);
         * q-search as in zrandomprime, p-search: keep generating random
         * p of right size with q|p-1 until p is probably prime (in accordance
         * with NIST DSS Appendix), so this only works if lp is substantially
-        * larger than |lq|, generator as in zrandoml
+        * larger than |lq|, generator as in zrandoml; each random p starts
+        * a window of p, p+2q, p+4q, ... that is sieved as in zrandomprime
         *
         * possible error message:
         *   wrong second argument in zrandomqprime
@@ -2139,7 +2774,9 @@ long zispower( verylong a, verylong *f);
         /******************************************************************\
         * returns 1 if successfully generated random probable primes q
         * and p such that p = frac*q+1, where q has binary length lq,
-        * repeatedly uses zrandoml to set q until q and p prime
+        * repeatedly uses zrandoml to set q until q and p prime; each
+        * random q starts a window of q, q+2, q+4, ... in which both q and
+        * frac*q+1 are sieved as in zrandomprime
         *
         * returns 0 if frac<2 or frac odd, or if it couldn`t find a
         * prime q of lq bits, generator as in zrandoml
@@ -2163,7 +2800,8 @@ long zispower( verylong a, verylong *f);
 /******************************************************************************\
 *  Small prime generation
 *
-*  Functions to generate the sequence of primes up to (2*PRIM_BND+1)^2
+*  Functions to generate the sequence of primes up to RADIX, by a
+*  segmented sieve over the numbers prime to 30
 \******************************************************************************/
 
     long zpnext(void);
@@ -2171,7 +2809,7 @@ long zispower( verylong a, verylong *f);
         * returns the next prime, starting at 2, unless zpstart
         * has been called in which case the first subsequent zpnext call
         * returns 3
-        * after returning the last prime before (2*PRIM_BND+1)^2 it
+        * after returning the last prime before RADIX it
         * returns 2 on the next call
         \******************************************************************/
 
@@ -2202,6 +2840,77 @@ long zispower( verylong a, verylong *f);
         * by zpnext otherwise
         \******************************************************************/
 
+    void zpiter_start(zpiter *it);
+        /******************************************************************\
+        * initializes the prime iterator *it, so that the next call to
+        * zpiter_next(it) will produce 2
+        * 
+        * zpnext and friends above share one position in the sequence of
+        * primes, so a function that uses them disturbs its caller. An
+        * iterator has its own position and sieve segment instead, and
+        * only shares the base primes with zpnext and the other
+        * iterators (of the same thread with -DTHREADS): any number of
+        * them can walk the primes at the same time. Below the end of
+        * the base primes (at least 2*PRIM_BND+3) an iterator takes its
+        * primes from them, so a restart there costs no sieving and
+        * the segment is only allocated above them. Call zpiter_free
+        * when done. With -DTHREADS an iterator can be handed over to
+        * another thread, as long as one thread at a time uses it.
+        * 
+        *     zpiter it;
+        *     long p;
+        * 
+        *     zpiter_start(&it);
+        *     for (p = zpiter_nextb(&it, 1000); p < 2000; p = zpiter_next(&it))
+        *         ...
+        *     zpiter_free(&it);
+        \******************************************************************/
+
+    long zpiter_next(zpiter *it);
+        /******************************************************************\
+        * returns the next prime of *it, as zpnext does
+        \******************************************************************/
+
+    long zpiter_nextb(zpiter *it, long b);
+        /******************************************************************\
+        * returns the next prime >= b, and repositions *it so that
+        * zpiter_next(it) will return the next bigger prime, etc.
+        * returns 0 if b >= RADIX
+        \******************************************************************/
+
+    long zpiter_last(zpiter *it);
+        /******************************************************************\
+        * returns the prime previously returned by zpiter_next(it) or
+        * zpiter_nextb(it, b), or 0 if there is none since zpiter_start
+        \******************************************************************/
+
+    void zpiter_free(zpiter *it);
+        /******************************************************************\
+        * frees the sieve segment of *it, which is then as after
+        * zpiter_start
+        \******************************************************************/
+
+    long zprange(long lo, long hi, long nthreads,
+                 void (*f)(long p, void *arg), void *arg);
+        /******************************************************************\
+        * calls f(p, arg) for all primes p with lo <= p < hi, in
+        * increasing order, and returns their number, hi <= RADIX
+        * 
+        * With -DTHREADS the range is split in segments of 30*PRIM_SEG
+        * numbers, which nthreads threads sieve, while the calling
+        * thread calls f; without it, or for nthreads <= 1, the calling
+        * thread sieves as well. f may use all functions of the package,
+        * including zpnext. The global position of zpnext is not changed
+        \******************************************************************/
+
+    long zprange_array(long lo, long hi, long nthreads, long **a);
+        /******************************************************************\
+        * same as zprange, but puts the primes p with lo <= p < hi in
+        * (*a)[0], (*a)[1], ..., and returns their number. *a is
+        * allocated with malloc (free it with free) or set to 0 if
+        * there are none
+        \******************************************************************/
+
 
 /******************************************************************************\
 *  Compositeness testing and factorization 
@@ -2274,6 +2983,19 @@ long zispower( verylong a, verylong *f);
         * already suspected to be prime
         \******************************************************************/
 
+    long zlcomposite(verylong m);
+        /******************************************************************\
+        * returns 1 if the strong Lucas test (Selfridge`s parameters:
+        * the first D of 5, -7, 9, -11, ... with J(D, m) = -1, P = 1,
+        * Q = (1 - D) / 4) proves that m is composite, or if m < 2 or
+        * m is a square, and returns 0 otherwise
+        * 
+        * together with the test of zcomposite(&m, 1, 2) it makes the
+        * Baillie-PSW test: no composite m is known that passes both,
+        * and there are none below 2^64. Costs about three times as
+        * much as one test of zmcomposite
+        \******************************************************************/
+
     long zprobprime(verylong n, long nbtests);
         /******************************************************************\
         * returns 1 if n is probably prime, 0 if n is composite,
@@ -2282,6 +3004,14 @@ long zispower( verylong a, verylong *f);
         * zcomposite with firstbase 2, if not yet proved composite uses
         * zmcomposite with t = nbtests
         * 
+        * for nbtests < 0, zlcomposite follows zcomposite instead (the
+        * Baillie-PSW test), and then zmcomposite with t = -nbtests-1;
+        * no composite is known to pass with nbtests = -1, which costs
+        * about 4 tests instead of nbtests + 1
+        * 
+        * a one nit n is always decided correctly: by trial division, or
+        * by the Baillie-PSW test, whatever nbtests
+        * 
         * faster than zprime for most randomly selected composites
         * because small prime divisors are detected quickly
         \******************************************************************/
@@ -2292,7 +3022,7 @@ long zispower( verylong a, verylong *f);
         * returns this divisor if found, or first prime >b2 if nothing found,
         * if factor found, cof will be set to the cofactor (n divided by the
         * factor), only intended for large n, and only for
-        * b2 <= (2 * PRIM_BND + 1) ^ 2 so it is Not clever about trial
+        * b2 < RADIX so it is Not clever about trial
         * division with primes > sqrt(n)
         * 
         \******************************************************************/
@@ -2466,7 +3196,85 @@ long zispower( verylong a, verylong *f);
         * frees the memory allocated for x, and sets x back to 0,
         * where x is a very long int allocated by the functions internally
         * or by zsetlength, use this to free the memory of very long ints
-        * which are local to functions (unless the locals are static)
+        * which are local to functions (unless the locals are static);
+        * for a very long int made by zinline that has not outgrown its
+        * buffer, only sets x back to 0
+        \******************************************************************/
+
+    verylong zinline(long *buf, long len);
+        /******************************************************************\
+        * returns a very long int of value 0 that keeps up to len nits in
+        * buf, which must have room for len + 2 longs, so that short
+        * temporaries need no calloc and free. It can be used with all
+        * functions as any other very long int; when it needs more than
+        * len nits it is moved to the heap like a normal one, and zfree
+        * frees it then. Usually declared as ZINLINE(a, len); in a list
+        * of declarations, which declares verylong a with its buffer on
+        * the stack. It must not outlive buf: don`t zswap it with a very
+        * long int of a caller, or return it.
+        * zjacobi and zsquf keep their temporaries in buffers of
+        * INLINE_SIZE (default 8) nits, and so do zsmulmod and zsdiv
+        * when compiled with -DFREE
+        *
+        * possible error message:
+        *   non-positive length in zinline
+        \******************************************************************/
+
+    void zset_alloc(void *(*alloc)(size_t),
+        void *(*ralloc)(void *p, size_t oldsize, size_t newsize),
+        void (*dealloc)(void *p, size_t size));
+        /******************************************************************\
+        * makes zsetlength and zfree get memory for very long ints from
+        * alloc, grow it with ralloc and give it back with dealloc instead
+        * of calloc, realloc and free; sizes are in bytes, and memory
+        * from alloc need not be cleared. The arenas below get their
+        * chunks from alloc as well. zset_alloc(0, 0, 0) goes back to
+        * calloc, realloc and free. Call it before any very long int is
+        * allocated, or free them all before changing it, since a very
+        * long int is always given back to the current dealloc
+        \******************************************************************/
+
+    void zarena_open(zarena *a);
+        /******************************************************************\
+        * makes all very long ints allocated from now on come from arena
+        * a, until zarena_close(a); declare it as zarena a = {0};
+        * Arenas nest: opening another one inside a suspends a until
+        * the other one is closed. An arena gets memory in chunks of
+        * ARENA_CHUNK (default 8192) longs, and cuts them into blocks of
+        * a power of two longs; zfree puts a block on a list of free
+        * blocks of its size in its own arena, for the next allocation
+        * from that arena, whether or not the arena is still open, and
+        * a number that outgrows its block moves to a larger block of
+        * the same arena. So a computation that makes and frees many
+        * temporaries (see -DFREE) calls calloc and free a few times
+        * instead of thousands of times.
+        * a.current holds the number of bytes in blocks that are in use,
+        * a.peak the largest value a.current has had, and a.size the
+        * number of bytes a got from the allocator
+        \******************************************************************/
+
+    void zarena_close(zarena *a);
+        /******************************************************************\
+        * stops allocating from arena a, the last one opened, and goes
+        * back to the arena that was open before a, or to the heap;
+        * the very long ints in a remain valid
+        *
+        * possible error message:
+        *   not the last open arena in zarena_close
+        \******************************************************************/
+
+    void zarena_free(zarena *a);
+        /******************************************************************\
+        * closes arena a if it is the last one opened, and gives back at
+        * once every chunk of a that has no block in use; a can be used
+        * again after that, or go out of scope. A chunk with a block in
+        * use is left behind until all its blocks are freed by zfree, so
+        * very long ints allocated in a remain valid, including the
+        * static temporaries functions keep between calls when compiled
+        * without -DFREE
+        *
+        * possible error message:
+        *   arena still open in zarena_free
         \******************************************************************/
 
 
@@ -2512,6 +3320,38 @@ long zispower( verylong a, verylong *f);
         * followed by newline, and flushes f
         \******************************************************************/
 
+    void zcount_get(zcounters *c);
+        /******************************************************************\
+        * copies the counters kept by the package when compiled with
+        * -DZCOUNT into c; without -DZCOUNT all of c is set to 0.
+        * For each of
+        *     c->mul      zmul, zmul_r
+        *     c->sq       zsq, zsq_r
+        *     c->montmul  zmontmul
+        *     c->montsq   zmontsq
+        *     c->div      zdiv, zmod
+        *     c->gcd      zgcd, and zinvmod, zexteucl and the other
+        *                 functions using extended Euclid
+        * calls is the number of calls, nits the sum of the lengths of
+        * the inputs of these calls, and time the number of seconds
+        * (wall clock, from clock_gettime) spent in them. Calls made by
+        * the package itself are counted as well, so zmul(a, a, &b)
+        * counts as a call of zmul and of zsq; a call made inside a call
+        * of the same primitive (as in Toom-Cook multiplication) is not
+        * timed again. c->kar_depth is the deepest level of recursion
+        * reached in Karatsuba multiplication and squaring, c->allocs,
+        * c->reallocs and c->frees count what zsetlength and zfree did,
+        * c->bytes is the number of bytes zsetlength asked for, and
+        * c->time the number of seconds since zcount_reset (or since the
+        * first counted call). The counters are kept per thread with
+        * -DTHREADS
+        \******************************************************************/
+
+    void zcount_reset(void);
+        /******************************************************************\
+        * sets all counters to 0 and restarts c->time of zcount_get
+        \******************************************************************/
+
 
 /******************************************************************************\
 *  Input and output 
@@ -2533,11 +3373,11 @@ long zispower( verylong a, verylong *f);
         * writes decimal representation of a to file f with at most
         * approximately linelen char per line, \ indicates continuation on
         * next line, first line begins with str1, each consecutive line
-        * with str2, returns decimal length of a
+        * with str2, returns decimal length of a; the digits are found
+        * by divide and conquer (see RADIX_CROV)
         *
         * possible error message:
-        *   allocation failure in zfwrite      (a too large to print)
-        *   reallocation failure in zfwrite    (a too large to print)
+        *   allocation failure in zfwrite_c    (a too large to print)
         * result undefined if error occurs
         \******************************************************************/
 
@@ -2581,11 +3421,10 @@ long zispower( verylong a, verylong *f);
     long zswrite(char *str, verylong a);
         /******************************************************************\
         * writes decimal representation of a to string str, returns
-        * decimal length a
+        * decimal length a, not counting the sign
         *
         * possible error message:
-        *   allocation failure in zfwrite      (a too large to print)
-        *   reallocation failure in zfwrite    (a too large to print)
+        *   allocation failure in zswrite      (a too large to print)
         * result undefined if error occurs
         \******************************************************************/
 